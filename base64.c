@@ -36,10 +36,367 @@
 
 #include <ctype.h>
 #include <stdint.h>
+#include <string.h>
 #include "base64.h"
 #include "base64_luts.h"
 #include <stdio.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define BASE64_NEON
+#include <arm_neon.h>
+#endif
+
+/* Vector kernels.
+ * Each encode kernel converts as many whole 3-byte groups as it can and returns
+ * the number of input bytes it consumed, leaving the tail to the scalar code.
+ * Each decode kernel converts consecutive 4-char groups while they are all
+ * plain base64 digits and returns how many groups it did, so anything unusual
+ * (a newline between lines, padding, garbage) is still handled by the scalar
+ * code exactly as before. Decode kernels are told how many non-final groups are
+ * left and never read or write beyond what the scalar loop would.
+ */
+typedef int (encode_kernel)(unsigned char *out, const unsigned char *in, int inlen);
+typedef int (decode_kernel)(char *out, const char *in, int ngroups);
+
+static int encode_none(unsigned char *out, const unsigned char *in, int inlen)
+{
+    (void)out;
+    (void)in;
+    (void)inlen;
+    return 0;
+}
+
+static int decode_none(char *out, const char *in, int ngroups)
+{
+    (void)out;
+    (void)in;
+    (void)ngroups;
+    return 0;
+}
+
+#ifdef BASE64_X86
+/* Muła and Lemire, "Faster Base64 Encoding and Decoding using AVX2 Instructions".
+ * The 128-bit helpers are shared by the SSSE3 and AVX2 kernels, the latter just
+ * runs them on both lanes.
+ */
+
+/* spread 12 bytes per lane into 16 six bit indices */
+__attribute__((target("ssse3"))) static inline __m128i enc_split128(__m128i v)
+{
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(t0, t1);
+}
+
+__attribute__((target("avx2"))) static inline __m256i enc_split256(__m256i v)
+{
+    __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+
+    return _mm256_or_si256(t0, t1);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i enc_translate128(__m128i idx)
+{
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12, then add the offset for that range */
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i r  = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    __m128i lt = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+
+    r = _mm_or_si128(r, _mm_and_si128(lt, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, r), idx);
+}
+
+__attribute__((target("avx2"))) static inline __m256i enc_translate256(__m256i idx)
+{
+    const __m256i shift = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m256i r  = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    __m256i lt = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+
+    r = _mm256_or_si256(r, _mm256_and_si256(lt, _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(_mm256_shuffle_epi8(shift, r), idx);
+}
+
+/* 16 bytes are loaded for every 12 converted */
+__attribute__((target("ssse3"))) static int encode_ssse3(unsigned char *out, const unsigned char *in, int inlen)
+{
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    int done             = 0;
+
+    for (; inlen - done >= 16; done += 12, out += 16)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + done)), spread);
+
+        _mm_storeu_si128((__m128i *)out, enc_translate128(enc_split128(v)));
+    }
+    return done;
+}
+
+/* 28 bytes are loaded for every 24 converted */
+__attribute__((target("avx2"))) static int encode_avx2(unsigned char *out, const unsigned char *in, int inlen)
+{
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+                                            4, 7, 6, 8, 7, 10, 9, 11, 10);
+    int done             = 0;
+
+    for (; inlen - done >= 28; done += 24, out += 32)
+    {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + done))),
+                                            _mm_loadu_si128((const __m128i *)(in + done + 12)), 1);
+
+        v = enc_split256(_mm256_shuffle_epi8(v, spread));
+        _mm256_storeu_si256((__m256i *)out, enc_translate256(v));
+    }
+    return done;
+}
+
+/* map 16 chars to their six bit values, return 0 if any is not a base64 digit */
+__attribute__((target("ssse3"))) static inline int dec_translate128(__m128i *v)
+{
+    const __m128i lut_lo  = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B,
+                                         0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi  = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10);
+    const __m128i lut_off = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nib     = _mm_set1_epi8(0x0f);
+    __m128i hi            = _mm_and_si128(_mm_srli_epi32(*v, 4), nib);
+    __m128i lo            = _mm_and_si128(*v, nib);
+    __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff)
+        return 0;
+
+    /* '/' shares its high nibble with '+', move it to its own slot */
+    hi = _mm_add_epi8(hi, _mm_cmpeq_epi8(*v, _mm_set1_epi8('/')));
+    *v = _mm_add_epi8(*v, _mm_shuffle_epi8(lut_off, hi));
+    return 1;
+}
+
+__attribute__((target("avx2"))) static inline int dec_translate256(__m256i *v)
+{
+    const __m256i lut_lo  = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                            0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi  = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_off = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+                                             -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nib     = _mm256_set1_epi8(0x0f);
+    __m256i hi            = _mm256_and_si256(_mm256_srli_epi32(*v, 4), nib);
+    __m256i lo            = _mm256_and_si256(*v, nib);
+    __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi));
+
+    if (!_mm256_testz_si256(bad, bad))
+        return 0;
+
+    hi = _mm256_add_epi8(hi, _mm256_cmpeq_epi8(*v, _mm256_set1_epi8('/')));
+    *v = _mm256_add_epi8(*v, _mm256_shuffle_epi8(lut_off, hi));
+    return 1;
+}
+
+/* 16 chars in, 16 bytes stored for 12 produced, so one more full group must follow */
+__attribute__((target("ssse3"))) static int decode_ssse3(char *out, const char *in, int ngroups)
+{
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int done           = 0;
+
+    for (; ngroups - done >= 5; done += 4, in += 16, out += 12)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+
+        if (!dec_translate128(&v))
+            break;
+        /* pack each 4 six bit values into 24 bits, then drop the empty bytes */
+        v = _mm_madd_epi16(_mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, pack));
+    }
+    return done;
+}
+
+/* 32 chars in, 32 bytes stored for 24 produced, so three more full groups must follow */
+__attribute__((target("avx2"))) static int decode_avx2(char *out, const char *in, int ngroups)
+{
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+                                          10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int done           = 0;
+
+    for (; ngroups - done >= 11; done += 8, in += 32, out += 24)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)in);
+
+        if (!dec_translate256(&v))
+            break;
+        v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), join);
+        _mm256_storeu_si256((__m256i *)out, v);
+    }
+
+    /* a 16 char block may still fit */
+    return done + decode_ssse3(out, in, ngroups - done);
+}
+#endif /* BASE64_X86 */
+
+#ifdef BASE64_NEON
+/* 48 bytes in, 64 chars out */
+static int encode_neon(unsigned char *out, const unsigned char *in, int inlen)
+{
+    const uint8x16_t m6 = vdupq_n_u8(0x3f);
+    uint8x16x4_t lut;
+    int done = 0;
+
+    lut.val[0] = vld1q_u8((const uint8_t *)base64digits);
+    lut.val[1] = vld1q_u8((const uint8_t *)base64digits + 16);
+    lut.val[2] = vld1q_u8((const uint8_t *)base64digits + 32);
+    lut.val[3] = vld1q_u8((const uint8_t *)base64digits + 48);
+
+    for (; inlen - done >= 48; done += 48, out += 64)
+    {
+        uint8x16x3_t s = vld3q_u8(in + done);
+        uint8x16x4_t d;
+
+        d.val[0] = vshrq_n_u8(s.val[0], 2);
+        d.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(s.val[1], 4), vshlq_n_u8(s.val[0], 4)), m6);
+        d.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(s.val[2], 6), vshlq_n_u8(s.val[1], 2)), m6);
+        d.val[3] = vandq_u8(s.val[2], m6);
+
+        d.val[0] = vqtbl4q_u8(lut, d.val[0]);
+        d.val[1] = vqtbl4q_u8(lut, d.val[1]);
+        d.val[2] = vqtbl4q_u8(lut, d.val[2]);
+        d.val[3] = vqtbl4q_u8(lut, d.val[3]);
+        vst4q_u8(out, d);
+    }
+    return done;
+}
+
+/* map 16 chars to their six bit values, lanes that are not base64 digits end up 0 in ok */
+static inline uint8x16_t dec_translate_neon(uint8x16_t c, uint8x16_t *ok)
+{
+    uint8x16_t up = vcltq_u8(vsubq_u8(c, vdupq_n_u8('A')), vdupq_n_u8(26));
+    uint8x16_t lo = vcltq_u8(vsubq_u8(c, vdupq_n_u8('a')), vdupq_n_u8(26));
+    uint8x16_t dg = vcltq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(10));
+    uint8x16_t pl = vceqq_u8(c, vdupq_n_u8('+'));
+    uint8x16_t sl = vceqq_u8(c, vdupq_n_u8('/'));
+    uint8x16_t v;
+
+    v   = vandq_u8(sl, vdupq_n_u8(63));
+    v   = vbslq_u8(pl, vdupq_n_u8(62), v);
+    v   = vbslq_u8(dg, vaddq_u8(c, vdupq_n_u8(4)), v);
+    v   = vbslq_u8(lo, vsubq_u8(c, vdupq_n_u8(71)), v);
+    v   = vbslq_u8(up, vsubq_u8(c, vdupq_n_u8(65)), v);
+    *ok = vandq_u8(*ok, vorrq_u8(vorrq_u8(up, lo), vorrq_u8(vorrq_u8(dg, pl), sl)));
+    return v;
+}
+
+/* 64 chars in, 48 bytes out */
+static int decode_neon(char *out, const char *in, int ngroups)
+{
+    int done = 0;
+
+    for (; ngroups - done >= 16; done += 16, in += 64, out += 48)
+    {
+        uint8x16x4_t s = vld4q_u8((const uint8_t *)in);
+        uint8x16_t ok  = vdupq_n_u8(0xff);
+        uint8x16x3_t d;
+        uint8x16_t a, b, c, e;
+
+        a = dec_translate_neon(s.val[0], &ok);
+        b = dec_translate_neon(s.val[1], &ok);
+        c = dec_translate_neon(s.val[2], &ok);
+        e = dec_translate_neon(s.val[3], &ok);
+        if (vminvq_u8(ok) == 0)
+            break;
+
+        d.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        d.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        d.val[2] = vorrq_u8(vshlq_n_u8(c, 6), e);
+        vst3q_u8((uint8_t *)out, d);
+    }
+    return done;
+}
+#endif /* BASE64_NEON */
+
+static encode_kernel *encode_fast;
+static decode_kernel *decode_fast;
+
+/* pick the widest kernels this cpu can run, once */
+static void pick_kernels(void)
+{
+    encode_kernel *enc = encode_none;
+    decode_kernel *dec = decode_none;
+
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        enc = encode_avx2;
+        dec = decode_avx2;
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        enc = encode_ssse3;
+        dec = decode_ssse3;
+    }
+#elif defined(BASE64_NEON)
+    enc = encode_neon;
+    dec = decode_neon;
+#endif
+
+    /* every thread computes the same answer, so racing here is harmless */
+    decode_fast = dec;
+    encode_fast = enc;
+}
+
+int base64_use_kernels(const char *name)
+{
+    if (!strcmp(name, "auto"))
+    {
+        pick_kernels();
+        return 0;
+    }
+
+    if (!strcmp(name, "none"))
+    {
+        encode_fast = encode_none;
+        decode_fast = decode_none;
+        return 0;
+    }
+
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+    {
+        encode_fast = encode_avx2;
+        decode_fast = decode_avx2;
+        return 0;
+    }
+    if (!strcmp(name, "ssse3") && __builtin_cpu_supports("ssse3"))
+    {
+        encode_fast = encode_ssse3;
+        decode_fast = decode_ssse3;
+        return 0;
+    }
+#elif defined(BASE64_NEON)
+    if (!strcmp(name, "neon"))
+    {
+        encode_fast = encode_neon;
+        decode_fast = decode_neon;
+        return 0;
+    }
+#endif
+
+    return -1;
+}
+
 /* convert inlen raw bytes at in to base64 string (NUL-terminated) at out. 
  * out size should be at least 4*inlen/3 + 4.
  * return length of out (sans trailing NUL).
@@ -48,8 +405,18 @@ int to64frombits(unsigned char *out, const unsigned char *in, int inlen)
 {
     uint16_t *b64lut = (uint16_t *)base64lut;
     int dlen         = ((inlen + 2) / 3) * 4; /* 4/3, rounded up */
-    uint16_t *wbuf   = (uint16_t *)out;
+    uint16_t *wbuf;
+    int done;
+
+    if (encode_fast == NULL)
+        pick_kernels();
 
+    done = encode_fast(out, in, inlen);
+    out += done / 3 * 4;
+    in += done;
+    inlen -= done;
+
+    wbuf = (uint16_t *)out;
     for (; inlen > 2; inlen -= 3)
     {
         uint32_t n = in[0] << 16 | in[1] << 8 | in[2];
@@ -99,10 +466,26 @@ int from64tobits_fast(char *out, const char *in, int inlen)
     int n         = (inlen / 4) - 1;
     uint16_t *inp = (uint16_t *)in;
 
+    if (decode_fast == NULL)
+        pick_kernels();
+
     for (j = 0; j < n; j++)
     {
+        int k;
+
         if (in[0] == '\n')
             in++;
+
+        /* take whole runs of plain digits at once, typically up to the end of the line */
+        k = decode_fast(out, in, n - j);
+        if (k > 0)
+        {
+            in += 4 * k;
+            out += 3 * k;
+            j += k - 1;
+            continue;
+        }
+
         inp = (uint16_t *)in;
 
         s1 = rbase64lut[inp[0]];
@@ -30,6 +30,8 @@ extern "C" {
 
 /**
  * \defgroup base64 Base 64 Functions: Convert from and to base64
+ *
+ * The bulk of the work is done with SSSE3, AVX2 or NEON where the CPU supports it, picked at run time.
  */
 /*@{*/
 
@@ -51,6 +53,12 @@ extern int to64frombits(unsigned char *out, const unsigned char *in, int inlen);
 extern int from64tobits(char *out, const char *in);
 extern int from64tobits_fast(char *out, const char *in, int inlen);
 
+/** \brief Force the vector kernels used by the functions above, for tests.
+    \param name "avx2", "ssse3", "neon", "none" for the scalar code only or "auto" for the best this CPU can run.
+    \return 0 on success, -1 if the kernels are not compiled in or the CPU can not run them.
+ */
+extern int base64_use_kernels(const char *name);
+
 /*@}*/
 
 #ifdef __cplusplus
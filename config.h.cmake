@@ -6,3 +6,9 @@
 
 /* Set when theora is detected */
 #cmakedefine HAVE_THEORA
+
+/* Set when epoll is available */
+#cmakedefine HAVE_EPOLL
+
+/* Set when memfd_create is available to share BLOBs with indiserver */
+#cmakedefine HAVE_MEMFD_CREATE
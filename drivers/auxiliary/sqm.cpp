@@ -178,6 +178,7 @@ bool SQM::getReadings()
     char buffer[57] = {0};
 
     tcflush(PortFD, TCIOFLUSH);
+    tty_clear_read_buffer(PortFD);
 
     LOGF_DEBUG("CMD <%s>", cmd);
 
@@ -302,6 +303,7 @@ bool SQM::getDeviceInfo()
 {
     const char *cmd = "ix";
     char buffer[39] = {0};
+    int nbytes_written = 0, rc = 0;
 
     if (getActiveConnection() == serialConnection)
     {
@@ -314,11 +316,11 @@ bool SQM::getDeviceInfo()
 
     LOGF_DEBUG("CMD <%s>", cmd);
 
-    ssize_t written = write(PortFD, cmd, 2);
-
-    if (written < 2)
+    if ( (rc = tty_write(PortFD, cmd, 2, &nbytes_written)) != TTY_OK)
     {
-        LOGF_ERROR("Error getting device info while writing to device: %s", strerror(errno));
+        char errorMessage[MAXRBUF] = {0};
+        tty_error_msg(rc, errorMessage, MAXRBUF);
+        LOGF_ERROR("Error getting device info while writing to device: %s", errorMessage);
         return false;
     }
 
@@ -345,7 +347,7 @@ bool SQM::getDeviceInfo()
     LOGF_DEBUG("RES <%s>", buffer);
 
     int protocol, model, feature, serial;
-    int rc = sscanf(buffer, "i,%d,%d,%d,%d", &protocol, &model, &feature, &serial);
+    rc = sscanf(buffer, "i,%d,%d,%d,%d", &protocol, &model, &feature, &serial);
 
     if (rc < 4)
     {
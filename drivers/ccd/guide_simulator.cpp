@@ -26,6 +26,7 @@
 #include <libnova/julian_day.h>
 #include <libnova/precession.h>
 
+#include <chrono>
 #include <cmath>
 #include <unistd.h>
 
@@ -1040,8 +1041,8 @@ void *GuideSim::streamVideoHelper(void *context)
 
 void *GuideSim::streamVideo()
 {
-    struct itimerval tframe1, tframe2;
-    double s1, s2, deltas;
+    auto start  = std::chrono::steady_clock::now();
+    auto finish = std::chrono::steady_clock::now();
 
     while (true)
     {
@@ -1067,19 +1068,16 @@ void *GuideSim::streamVideo()
 
         PrimaryCCD.binFrame();
 
-        getitimer(ITIMER_REAL, &tframe1);
+        finish = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
 
-        s1 = ((double)tframe1.it_value.tv_sec) + ((double)tframe1.it_value.tv_usec / 1e6);
-        s2 = ((double)tframe2.it_value.tv_sec) + ((double)tframe2.it_value.tv_usec / 1e6);
-        deltas = fabs(s2 - s1);
-
-        if (deltas < ExposureRequest)
-            usleep(fabs(ExposureRequest - deltas) * 1e6);
+        if (elapsed.count() < ExposureRequest)
+            usleep(fabs(ExposureRequest - elapsed.count()) * 1e6);
 
         uint32_t size = PrimaryCCD.getFrameBufferSize() / (PrimaryCCD.getBinX() * PrimaryCCD.getBinY());
         Streamer->newFrame(PrimaryCCD.getFrameBuffer(), size);
 
-        getitimer(ITIMER_REAL, &tframe2);
+        start = std::chrono::steady_clock::now();
     }
 
     pthread_mutex_unlock(&condMutex);
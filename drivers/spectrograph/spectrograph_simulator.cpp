@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <indilogger.h>
+#include <chrono>
 #include <memory>
 
 #define SPECTRUM_SIZE (256)
@@ -327,11 +328,8 @@ bool RadioSim::StopStreaming()
 
 void RadioSim::streamCaptureHelper()
 {
-    struct itimerval tframe1, tframe2;
-    double deltas;
-    getitimer(ITIMER_REAL, &tframe1);
-    auto s1 = ((double)tframe2.it_value.tv_sec) + ((double)tframe2.it_value.tv_usec / 1e6);
-    auto s2 = ((double)tframe2.it_value.tv_sec) + ((double)tframe2.it_value.tv_usec / 1e6);
+    auto start  = std::chrono::steady_clock::now();
+    auto finish = std::chrono::steady_clock::now();
 
     while (true)
     {
@@ -352,20 +350,16 @@ void RadioSim::streamCaptureHelper()
         // Simulate exposure time
         //usleep(ExposureRequest*1e5);
         grabData();
-        getitimer(ITIMER_REAL, &tframe1);
+        finish = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
 
-        s2 = ((double)tframe2.it_value.tv_sec) + ((double)tframe2.it_value.tv_usec / 1e6);
-        deltas = fabs(s2 - s1);
-
-        if (deltas < IntegrationTime)
-            usleep(fabs(IntegrationTime - deltas) * 1e6);
+        if (elapsed.count() < IntegrationTime)
+            usleep(fabs(IntegrationTime - elapsed.count()) * 1e6);
 
         int32_t size = getBufferSize();
         Streamer->newFrame(getBuffer(), size);
 
-        s1 = ((double)tframe1.it_value.tv_sec) + ((double)tframe1.it_value.tv_usec / 1e6);
-
-        getitimer(ITIMER_REAL, &tframe2);
+        start = std::chrono::steady_clock::now();
     }
 
     pthread_mutex_unlock(&condMutex);
@@ -65,19 +65,6 @@ const char *LX200AstroPhysicsExperimental::getDefaultName()
     return "AstroPhysics Experimental";
 }
 
-bool LX200AstroPhysicsExperimental::Connect()
-{
-    Connection::Interface *activeConnection = getActiveConnection();
-    if (!activeConnection->name().compare("CONNECTION_TCP"))
-    {
-        // When using a tcp connection, the GTOCP4 adds trailing LF to response.
-        // this small hack will get rid of them as they are not expected in the driver. and generated
-        // lot of communication errors.
-        tty_clr_trailing_read_lf(1);
-    }
-    return LX200Generic::Connect();
-}
-
 bool LX200AstroPhysicsExperimental::initProperties()
 {
     LX200Generic::initProperties();
@@ -1132,6 +1119,14 @@ bool LX200AstroPhysicsExperimental::Handshake()
         return true;
     }
 
+    if (!getActiveConnection()->name().compare("CONNECTION_TCP"))
+    {
+        // When using a tcp connection, the GTOCP4 adds trailing LF to response.
+        // this small hack will get rid of them as they are not expected in the driver. and generated
+        // lot of communication errors.
+        tty_set_port_clr_trailing_lf(PortFD, 1);
+    }
+
     int err = 0;
 
     if ((err = setAPClearBuffer(PortFD)) < 0)
@@ -48,7 +48,6 @@ class LX200AstroPhysicsExperimental : public LX200Generic
     virtual bool ReadScopeStatus() override;
     virtual bool Handshake() override;
     virtual bool Disconnect() override;
-    virtual bool Connect() override;
 
     // Parking
     virtual bool SetCurrentPark() override;
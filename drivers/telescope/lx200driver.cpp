@@ -177,7 +177,7 @@ int check_lx200_connection(int in_fd)
     int i       = 0;
     char ack[1] = { 0x06 };
     char MountAlign[64];
-    int nbytes_read = 0;
+    int nbytes_read = 0, nbytes_write = 0;
 
     DEBUGDEVICE(lx200Name, INDI::Logger::DBG_DEBUG, "Testing telescope connection using ACK...");
 
@@ -189,7 +189,7 @@ int check_lx200_connection(int in_fd)
 
     for (i = 0; i < 2; i++)
     {
-        if (write(in_fd, ack, 1) < 0)
+        if (tty_write(in_fd, ack, 1, &nbytes_write) != TTY_OK)
             return -1;
         tty_read(in_fd, MountAlign, 1, LX200_TIMEOUT, &nbytes_read);
         if (nbytes_read == 1)
@@ -221,9 +221,7 @@ char ACK(int fd)
 
     DEBUGFDEVICE(lx200Name, DBG_SCOPE, "CMD <%#02X>", ack[0]);
 
-    nbytes_write = write(fd, ack, 1);
-
-    if (nbytes_write < 0)
+    if (tty_write(fd, ack, 1, &nbytes_write) != TTY_OK)
         return -1;
 
     error_type = tty_read(fd, MountAlign, 1, LX200_TIMEOUT, &nbytes_read);
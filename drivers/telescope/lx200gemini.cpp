@@ -64,19 +64,6 @@ const char *LX200Gemini::getDefaultName()
     return static_cast<const char *>("Losmandy Gemini");
 }
 
-bool LX200Gemini::Connect()
-{
-    Connection::Interface *activeConnection = getActiveConnection();
-
-
-    if (!activeConnection->name().compare("CONNECTION_TCP"))
-    {
-        tty_set_gemini_udp_format(1);
-    }
-
-    return LX200Generic::Connect();
-}
-
 void LX200Gemini::ISGetProperties(const char *dev)
 {
     LX200Generic::ISGetProperties(dev);
@@ -320,6 +307,11 @@ bool LX200Gemini::checkConnection()
     if (isSimulation())
         return true;
 
+    // Over the network every command and reply carries a sequence number. Set it on this port only, a serial Gemini
+    // served by the same process must keep plain framing.
+    if (!getActiveConnection()->name().compare("CONNECTION_TCP"))
+        tty_set_port_framing(PortFD, TTY_FRAMING_GEMINI_UDP);
+
     // Response
     char response[8] = { 0 };
     int rc = 0, nbytes_read = 0, nbytes_written = 0;
@@ -41,8 +41,6 @@ class LX200Gemini : public LX200Generic
   protected:
     virtual const char *getDefaultName() override;
 
-    virtual bool Connect() override;
-
     virtual bool initProperties() override ;
     virtual bool updateProperties() override;
 
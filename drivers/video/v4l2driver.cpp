@@ -1318,12 +1318,12 @@ void V4L2_Driver::newFrame()
             memcpy(PrimaryCCD.getFrameBuffer(), buffer, totalBytes);
             PrimaryCCD.binFrame();
             guard.unlock();
-            Streamer->newFrame(PrimaryCCD.getFrameBuffer(), frameBytes / PrimaryCCD.getBinX());
+            Streamer->newFrame(PrimaryCCD.getFrameBuffer(), frameBytes / PrimaryCCD.getBinX(), v4l_base->getFrameTimestamp());
         }
         else
         {
             guard.unlock();
-            Streamer->newFrame(buffer, frameBytes);
+            Streamer->newFrame(buffer, frameBytes, v4l_base->getFrameTimestamp());
         }
         return;
     }
@@ -32,7 +32,12 @@
  #define MAIN_TEST for a stand-alone test program.
  */
 
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +46,10 @@
 #include <sys/types.h>
 #include <sys/time.h>
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include "eventloop.h"
 
 /* info about one registered callback.
@@ -49,31 +58,53 @@
  */
 typedef struct
 {
-    int in_use; /* flag to mark this record is active */
-    int fd;     /* fd descriptor to watch for read */
-    void *ud;   /* user's data handle */
-    CBF *fp;    /* callback function */
+    int in_use;   /* flag to mark this record is active */
+    int fd;       /* fd descriptor to watch for read */
+    void *ud;     /* user's data handle */
+    CBF *fp;      /* callback function */
+    unsigned gen; /* bumped on each reuse, tells apart epoll events of a previous user of the slot */
 } CB;
 static CB *cback;    /* malloced list of callbacks */
 static int ncback;   /* n entries in cback[] */
 static int ncbinuse; /* n entries in cback[] marked in_use */
 static int lastcb;   /* cback index of last cb called */
 
+#ifdef HAVE_EPOLL
+/* epoll instance watching every callback fd, -1 until first used. if the kernel refuses an fd, e.g. the same
+ * fd registered twice, we fall back to select() for good.
+ */
+static int epollfd = -1;
+static int epollfailed;
+#endif
+
 /* info about one registered timer function.
- * the entries are kept sorted by decreasing time from epoch, ie,
- *   the next entry to fire is at the end of the array.
+ * the entries form a binary min-heap on trigger time, ie, timef[0] fires next.
+ * ties go to the older timer, so timers due at the same time run in the order they were added.
  */
 typedef struct
 {
-    double tgo; /* trigger time, ms from epoch */
+    double tgo; /* trigger time, ms on the monotonic clock */
     void *ud;   /* user's data handle */
     TCF *fp;    /* timer function */
     int tid;    /* unique id for this timer */
+    int slot;   /* index of this timer in timerids[] */
 } TF;
-static TF *timef;  /* malloced list of timer functions */
-static int ntimef; /* n entries in ntimef[] */
+static TF *timef;  /* malloced heap of timer functions */
+static int ntimef; /* n entries in timef[] */
+static int mtimef; /* n entries allocated in timef[] */
 static int tid;    /* source of unique timer ids */
-#define EPOCHDT(tp) /* ms from epoch to timeval *tp */ (((tp)->tv_usec) / 1000.0 + ((tp)->tv_sec) * 1000.0)
+
+/* open addressing hash from timer id to heap index, so rmTimer() need not search the heap.
+ * a tid of 0 marks a free slot. size is a power of two, at least twice ntimef.
+ */
+typedef struct
+{
+    int tid;  /* timer id, 0 if free */
+    int heap; /* index of the timer in timef[] */
+} TID;
+static TID *timerids;
+static int ntimerids;
+static int timeridshift; /* 32 - log2(ntimerids) */
 
 /* info about one registered work procedure.
  * the malloced array wproc is never shrunk, entries are reused. new id's are
@@ -96,6 +127,14 @@ static void checkTimer();
 static void oneLoop(void);
 static void deferTO(void *p);
 
+/* ms on a clock that is not moved by changes to the system time */
+static double msNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 /* inf loop to dispatch callbacks, work procs and timers as necessary.
  * never returns.
  */
@@ -152,6 +191,60 @@ int deferLoop0(int maxms, int *flagp)
     return (0);
 }
 
+#ifdef HAVE_EPOLL
+/* start watching callback cid with epoll, or give up on epoll for good */
+static void epollAdd(int cid)
+{
+    struct epoll_event ev;
+
+    if (epollfailed)
+        return;
+
+    if (epollfd < 0 && (epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        epollfailed = 1;
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u64 = ((uint64_t)cback[cid].gen << 32) | (uint32_t)cid;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, cback[cid].fd, &ev) < 0)
+    {
+        /* e.g. EEXIST if the fd already has a callback, select copes with that */
+        epollfailed = 1;
+        close(epollfd);
+        epollfd = -1;
+    }
+}
+
+/* whether a callback in use watches fd */
+static int fdWatched(int fd)
+{
+    CB *cp;
+
+    for (cp = cback; cp < &cback[ncback]; cp++)
+        if (cp->in_use && cp->fd == fd)
+            return (1);
+    return (0);
+}
+
+/* watch the callbacks in use with a new epoll instance. the only way to drop a registration epoll_ctl can no
+ * longer name: it belongs to the open file, not to the fd, and lives on in a dup or a child after close().
+ */
+static void epollRebuild()
+{
+    int cid;
+
+    close(epollfd);
+    epollfd = -1;
+
+    for (cid = 0; cid < ncback; cid++)
+        if (cback[cid].in_use)
+            epollAdd(cid);
+}
+#endif
+
 /* register a new callback, fp, to be called with ud as arg when fd is ready.
  * return a unique callback id for use with rmCallback().
  */
@@ -166,7 +259,8 @@ int addCallback(int fd, CBF *fp, void *ud)
     if (cp == &cback[ncback])
     {
         cback = cback ? (CB *)realloc(cback, (ncback + 1) * sizeof(CB)) : (CB *)malloc(sizeof(CB));
-        cp    = &cback[ncback++];
+        cp      = &cback[ncback++];
+        cp->gen = 0;
     }
 
     /* init new entry */
@@ -174,14 +268,20 @@ int addCallback(int fd, CBF *fp, void *ud)
     cp->fp     = fp;
     cp->ud     = ud;
     cp->fd     = fd;
+    cp->gen++;
     ncbinuse++;
 
+#ifdef HAVE_EPOLL
+    epollAdd(cp - cback);
+#endif
+
     /* id is index into array */
     return (cp - cback);
 }
 
 /* remove the callback with the given id, as returned from addCallback().
  * silently ignore if id not valid.
+ * call before closing the fd, see the epoll note below.
  */
 void rmCallback(int cid)
 {
@@ -197,39 +297,176 @@ void rmCallback(int cid)
     /* mark for reuse */
     cp->in_use = 0;
     ncbinuse--;
+
+#ifdef HAVE_EPOLL
+    /* DEL fails if the fd was closed already. the kernel only drops the registration once every dup of the
+     * file is closed, until then epoll_wait would keep returning its events and the loop would spin skipping
+     * them. if the fd was closed and opened again for another callback, DEL would take away that one's
+     * registration instead. start over in both cases.
+     */
+    if (epollfd >= 0 && (fdWatched(cp->fd) || epoll_ctl(epollfd, EPOLL_CTL_DEL, cp->fd, NULL) < 0))
+        epollRebuild();
+#endif
+}
+
+/* home slot of timer id t. fibonacci hashing scatters the consecutive ids, which would
+ * otherwise pile up into one long run of taken slots.
+ */
+static int timerIdHome(int t)
+{
+    return ((uint32_t)t * 2654435769u) >> timeridshift;
+}
+
+/* find the timerids[] slot of timer id t, -1 if not there */
+static int findTimerId(int t)
+{
+    int i;
+
+    if (!ntimerids || t <= 0)
+        return (-1);
+
+    for (i = timerIdHome(t); timerids[i].tid; i = (i + 1) & (ntimerids - 1))
+        if (timerids[i].tid == t)
+            return (i);
+
+    return (-1);
+}
+
+/* store heap index h of timer id t, return its slot. timerids[] must have a free slot. */
+static int insertTimerId(int t, int h)
+{
+    int i;
+
+    for (i = timerIdHome(t); timerids[i].tid; i = (i + 1) & (ntimerids - 1))
+        ;
+    timerids[i].tid  = t;
+    timerids[i].heap = h;
+    timef[h].slot    = i;
+    return (i);
+}
+
+/* free slot i, moving back the entries that probed past it so lookups never stop early */
+static void removeTimerId(int i)
+{
+    int mask = ntimerids - 1;
+    int j    = i;
+
+    timerids[i].tid = 0;
+    while (1)
+    {
+        int home;
+
+        j = (j + 1) & mask;
+        if (!timerids[j].tid)
+            return;
+
+        /* entry j may move to i unless its home lies cyclically in (i, j] */
+        home = timerIdHome(timerids[j].tid);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        timerids[i]                  = timerids[j];
+        timef[timerids[i].heap].slot = i;
+        timerids[j].tid              = 0;
+        i                            = j;
+    }
+}
+
+/* timer a runs before timer b */
+static int timerBefore(const TF *a, const TF *b)
+{
+    return (a->tgo < b->tgo || (a->tgo == b->tgo && a->tid < b->tid));
+}
+
+/* store tf at heap index h */
+static void placeTimer(int h, TF tf)
+{
+    timef[h]               = tf;
+    timerids[tf.slot].heap = h;
+}
+
+/* move the timer at heap index h up or down until the heap is in order again */
+static void fixTimer(int h)
+{
+    TF tf = timef[h];
+
+    /* up */
+    while (h > 0 && timerBefore(&tf, &timef[(h - 1) / 2]))
+    {
+        placeTimer(h, timef[(h - 1) / 2]);
+        h = (h - 1) / 2;
+    }
+
+    /* down */
+    while (1)
+    {
+        int c = 2 * h + 1;
+        if (c >= ntimef)
+            break;
+        if (c + 1 < ntimef && timerBefore(&timef[c + 1], &timef[c]))
+            c++;
+        if (!timerBefore(&timef[c], &tf))
+            break;
+        placeTimer(h, timef[c]);
+        h = c;
+    }
+
+    placeTimer(h, tf);
+}
+
+/* take the timer at heap index h out of the heap */
+static void removeTimerAt(int h)
+{
+    removeTimerId(timef[h].slot);
+
+    ntimef--;
+    if (h < ntimef)
+    {
+        /* the slot of the last timer may have moved in removeTimerId, placeTimer reads it from timef[] */
+        timef[h] = timef[ntimef];
+        fixTimer(h);
+    }
 }
 
 /* register a new timer function, fp, to be called with ud as arg after ms
- * milliseconds. add to list in order of decreasing time from epoch, ie,
- * last entry runs soonest. return id for use with rmTimer().
+ * milliseconds. return id for use with rmTimer().
  */
 int addTimer(int ms, TCF *fp, void *ud)
 {
-    struct timeval t;
     TF *tp;
 
-    /* get time now */
-    gettimeofday(&t, NULL);
+    /* grow the heap by doubling, and the id hash along with it */
+    if (ntimef == mtimef)
+    {
+        int i;
+
+        mtimef = mtimef ? 2 * mtimef : 16;
+        timef  = (TF *)realloc(timef, mtimef * sizeof(TF));
+
+        free(timerids);
+        ntimerids = 2 * mtimef;
+        timerids  = (TID *)calloc(ntimerids, sizeof(TID));
+        for (timeridshift = 32; (1 << (32 - timeridshift)) < ntimerids; timeridshift--)
+            ;
+        for (i = 0; i < ntimef; i++)
+            insertTimerId(timef[i].tid, i);
+    }
 
-    /* add one entry */
-    timef = timef ? (TF *)realloc(timef, (ntimef + 1) * sizeof(TF)) : (TF *)malloc(sizeof(TF));
-    tp    = &timef[ntimef++];
+    /* ids stay positive, 0 marks a free hash slot */
+    tid = (tid == INT_MAX) ? 1 : tid + 1;
 
     /* init new entry */
+    tp      = &timef[ntimef++];
     tp->ud  = ud;
     tp->fp  = fp;
-    tp->tgo = EPOCHDT(&t) + ms;
+    tp->tgo = msNow() + ms;
+    tp->tid = tid;
+    insertTimerId(tid, ntimef - 1);
 
-    /* insert maintaining sort */
-    for (; tp > timef && tp[0].tgo > tp[-1].tgo; tp--)
-    {
-        TF tmptf = tp[-1];
-        tp[-1]   = tp[0];
-        tp[0]    = tmptf;
-    }
+    fixTimer(ntimef - 1);
 
-    /* store and return new unique id */
-    return (tp->tid = ++tid);
+    /* return new unique id */
+    return (tid);
 }
 
 /* remove the timer with the given id, as returned from addTimer().
@@ -237,28 +474,12 @@ int addTimer(int ms, TCF *fp, void *ud)
  */
 void rmTimer(int timer_id)
 {
-    TF *tp;
+    int i = findTimerId(timer_id);
 
-    /* find it */
-    for (tp = timef; tp < &timef[ntimef]; tp++)
-        if (tp->tid == timer_id)
-            break;
-    if (tp == &timef[ntimef])
+    if (i < 0)
         return;
 
-    /* bubble it out */
-    for (++tp; tp < &timef[ntimef]; tp++)
-        tp[-1] = tp[0];
-
-    /* shrink list */
-    ntimef--;
-    if (ntimef == 0)
-    {
-        free(timef);
-        timef = NULL;
-        return;
-    }
-    timef = (TF *)realloc(timef, ntimef * sizeof(TF));
+    removeTimerAt(timerids[i].heap);
 }
 
 /* add a new work procedure, fp, to be called with ud when nothing else to do.
@@ -347,27 +568,59 @@ static void callCallback(fd_set *rfdp)
     (*cp->fp)(cp->fd, cp->ud);
 }
 
-/* run the next timer callback whose time has come, if any. all we have to do
- * is is check the last entry in timef[] because it is sorted in decreasing
- * order of time from epoch to run, ie, last entry runs soonest.
+#ifdef HAVE_EPOLL
+/* run the callback ready in evp[0..nev-1] that comes next after lastcb, like callCallback().
+ * only one per loop: a callback may well read the fd of another, which would then block on stale readiness.
+ */
+static void callEpollCallback(struct epoll_event *evp, int nev)
+{
+    int best = -1, bestdist = ncback, i;
+
+    for (i = 0; i < nev; i++)
+    {
+        int cid = (int)(uint32_t)evp[i].data.u64;
+        int dist;
+
+        /* skip events of callbacks removed, or removed and added again, since the wait began */
+        if (cid >= ncback || !cback[cid].in_use || cback[cid].gen != (unsigned)(evp[i].data.u64 >> 32))
+            continue;
+
+        dist = (cid - lastcb - 1 + ncback) % ncback;
+        if (dist < bestdist)
+        {
+            best     = cid;
+            bestdist = dist;
+        }
+    }
+
+    if (best < 0)
+        return;
+
+    lastcb = best;
+    (*cback[best].fp)(cback[best].fd, cback[best].ud);
+}
+#endif
+
+/* run every timer callback whose time has come. timef[0] is always the next
+ * to run. timers added meanwhile wait for the next loop, so a timer that
+ * keeps adding itself with no delay cannot hold up callbacks and work procs.
  */
 static void checkTimer()
 {
-    struct timeval now;
     double tgonow;
-    TF *tp;
+    int n = ntimef;
 
     /* skip if list is empty */
     if (!ntimef)
         return;
 
-    gettimeofday(&now, NULL);
-    tgonow = EPOCHDT(&now);
-    tp     = &timef[ntimef - 1];
-    if (tp->tgo <= tgonow)
+    tgonow = msNow();
+    while (n-- > 0 && ntimef > 0 && timef[0].tgo <= tgonow)
     {
-        ntimef--; /* pop then call */
-        (*tp->fp)(tp->ud);
+        TF tf = timef[0];
+
+        removeTimerAt(0); /* pop then call */
+        (*tf.fp)(tf.ud);
     }
 }
 
@@ -380,6 +633,48 @@ static void oneLoop()
     fd_set rfd;
     CB *cp;
     int maxfd, ns;
+    double late = -1; /* ms to wait, -1 for ever */
+
+    /* determine timeout:
+	 * if there are work procs
+	 *   set delay = 0
+	 * else if there is at least one timer func
+	 *   set delay = time until soonest timer func expires
+	 * else
+	 *   set delay = forever
+	 */
+    if (nwpinuse > 0)
+        late = 0;
+    else if (ntimef > 0)
+    {
+        late = timef[0].tgo - msNow(); /* ms late */
+        if (late < 0)
+            late = 0;
+    }
+
+#ifdef HAVE_EPOLL
+    if (epollfd >= 0)
+    {
+        struct epoll_event ev[64];
+
+        /* round up, waking before the timer is due would only spin */
+        ns = epoll_wait(epollfd, ev, sizeof(ev) / sizeof(ev[0]), late < 0 ? -1 : (int)ceil(late));
+        if (ns < 0)
+        {
+            if (errno != EINTR)
+                perror("epoll_wait");
+            return;
+        }
+
+        /* dispatch */
+        checkTimer();
+        if (ns == 0)
+            runWorkProc();
+        else
+            callEpollCallback(ev, ns);
+        return;
+    }
+#endif
 
     /* build list of callback file descriptors to check */
     FD_ZERO(&rfd);
@@ -394,34 +689,15 @@ static void oneLoop()
         }
     }
 
-    /* determine timeout:
-	 * if there are work procs
-	 *   set delay = 0
-	 * else if there is at least one timer func
-	 *   set delay = time until soonest timer func expires
-	 * else
-	 *   set delay = forever
-	 */
-    if (nwpinuse > 0)
-    {
-        tvp         = &tv;
-        tvp->tv_sec = tvp->tv_usec = 0;
-    }
-    else if (ntimef > 0)
+    if (late < 0)
+        tvp = NULL;
+    else
     {
-        struct timeval now;
-        double late;
-        gettimeofday(&now, NULL);
-        late = timef[ntimef - 1].tgo - EPOCHDT(&now); /* ms late */
-        if (late < 0)
-            late = 0;
         late /= 1000.0; /* secs late */
         tvp          = &tv;
         tvp->tv_sec  = (long)floor(late);
         tvp->tv_usec = (long)floor((late - tvp->tv_sec) * 1000000.0);
     }
-    else
-        tvp = NULL;
 
     /* check file descriptors, timeout depending on pending work */
     ns = select(maxfd + 1, &rfd, NULL, NULL, tvp);
@@ -64,7 +64,8 @@ extern void eventLoop();
 */
 extern int addCallback(int fd, CBF *fp, void *ud);
 
-/** Remove a callback function.
+/** Remove a callback function. Call it before closing the file descriptor: removing the callback of a closed
+* descriptor costs a rebuild of the whole watch list.
 *
 * \param cid the callback ID returned from addCallback().
 */
@@ -84,7 +85,7 @@ extern int addWorkProc(WPF *fp, void *ud);
 */
 extern void rmWorkProc(int wid);
 
-/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms. Add to list in order of decreasing time from epoch, ie, last entry runs soonest. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
+/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms, measured on the monotonic clock so changes to the system time do not move it. Timers due at the same time run in the order they were added. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
 *
 * \param ms timer period in milliseconds.
 * \param fp a pointer to the callback function.
@@ -114,6 +114,25 @@ void *peekiFQ(FQ *q, int i)
     return (q->nq > 0 ? q->q[q->head - q->nq + i] : NULL);
 }
 
+/* remove and return ith element from head of the given FQ, or NULL if none.
+ * elements behind it move up one, so this is cheapest near the end.
+ */
+void *rmiFQ(FQ *q, int i)
+{
+    void **ep;
+    void *e;
+
+    if (i < 0 || i >= q->nq)
+        return (NULL);
+
+    ep = &q->q[q->head - q->nq + i];
+    e  = *ep;
+    memmove(ep, ep + 1, (q->nq - i - 1) * sizeof(void *));
+    q->head--;
+    q->nq--;
+    return (e);
+}
+
 /* return the number of elements in the given FQ */
 int nFQ(FQ *q)
 {
@@ -188,6 +207,7 @@ int main(int ac, char *av[])
     printf(" P  = push a letter a-z\n");
     printf(" p  = pop a letter\n");
     printf(" k  = peek into queue\n");
+    printf(" r  = remove second letter\n");
 
     while ((c = fgetc(stdin)) != EOF)
     {
@@ -213,6 +233,14 @@ int main(int ac, char *av[])
                     printf("peeked empty q\n");
                 prFQ(q);
                 break;
+            case 'r':
+                p = rmiFQ(q, 1);
+                if (p)
+                    printf("removed %c\n", (char)(int)p);
+                else
+                    printf("nothing to remove\n");
+                prFQ(q);
+                break;
             default:
                 break;
         }
@@ -234,6 +234,7 @@ __attribute__((format(printf, 2, 3)))
 /** \brief Tell client to update an existing BLOB vector property.
     \param b pointer to the vector BLOB property.
     \param msg message in printf style to send to the client. May be NULL.
+    \note If b->timestamp is not empty it is sent instead of the current time, e.g. the capture time of a video frame.
  */
 extern void IDSetBLOB(const IBLOBVectorProperty *b, const char *msg, ...)
 #ifdef __GNUC__
@@ -20,8 +20,14 @@
 
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "indidriver.h"
 
+#include "config.h"
+
 #include "base64.h"
 #include "eventloop.h"
 #include "indicom.h"
@@ -37,11 +43,39 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#endif
 
 pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #define MAXRBUF 2048
 
+/* client input is read CLIRBUF bytes at a time, doubling up to CLIRBUFMAX
+ * while reads keep filling the buffer
+ */
+#define CLIRBUF    (64 * 1024)
+#define CLIRBUFMAX (16 * 1024 * 1024)
+static char *clibuf;
+static int nclibuf;
+
+/* BLOBs are sent base64 encoded in lines of B64LINE chars, B64WINDOW lines per write */
+#define B64LINE   72
+#define B64WINDOW 1024
+#define B64WSIZE  (B64WINDOW * (B64LINE + 1) + 1)
+
+/* scratch window for IDSetBLOB, guarded by stdout_mutex */
+static unsigned char b64window[B64WSIZE];
+
+/* set once indiserver offers to take BLOBs as raw bytes */
+static int binaryBLOBs;
+
+/* set once indiserver offers to take BLOBs in shared memory, max per message */
+static int sharedBLOBs;
+#define MAXSHMFD 16
+
 /*! INDI property type */
 enum
 {
@@ -857,11 +891,18 @@ int IUSnoopBLOB(XMLEle *root, IBLOBVectorProperty *bvp)
 void clientMsgCB(int fd, void *arg)
 {
     (void)arg;
-    char buf[MAXRBUF], msg[MAXRBUF], *bp;
+    char msg[MAXRBUF];
+    XMLEle **nodes, **np;
     int nr;
 
+    if (!clibuf)
+    {
+        nclibuf = CLIRBUF;
+        clibuf  = (char *)malloc(nclibuf);
+    }
+
     /* one read */
-    nr = read(fd, buf, sizeof(buf));
+    nr = read(fd, clibuf, nclibuf);
     if (nr < 0)
     {
         fprintf(stderr, "%s: %s\n", me, strerror(errno));
@@ -873,18 +914,23 @@ void clientMsgCB(int fd, void *arg)
         exit(1);
     }
 
-    /* crack and dispatch when complete */
-    for (bp = buf; nr-- > 0; bp++)
+    /* crack all of it, then dispatch each complete element */
+    nodes = parseXMLChunk(clixml, clibuf, nr, msg);
+    if (msg[0])
+        fprintf(stderr, "%s XML error: %s\n", me, msg);
+    for (np = nodes; *np; np++)
     {
-        XMLEle *root = readXMLEle(clixml, *bp, msg);
-        if (root)
-        {
-            if (dispatch(root, msg) < 0)
-                fprintf(stderr, "%s dispatch error: %s\n", me, msg);
-            delXMLEle(root);
-        }
-        else if (msg[0])
-            fprintf(stderr, "%s XML error: %s\n", me, msg);
+        if (dispatch(*np, msg) < 0)
+            fprintf(stderr, "%s dispatch error: %s\n", me, msg);
+        delXMLEle(*np);
+    }
+    free(nodes);
+
+    /* a full read means more is waiting, take bigger bites */
+    if (nr == nclibuf && nclibuf < CLIRBUFMAX)
+    {
+        nclibuf *= 2;
+        clibuf = (char *)realloc(clibuf, nclibuf);
     }
 }
 
@@ -921,6 +967,18 @@ int dispatch(XMLEle *root, char msg[])
             exit(1);
         }
 
+        /* only indiserver offers this, clients can not */
+        if (!strcmp(findXMLAttValu(root, "binary"), "On"))
+            binaryBLOBs = 1;
+#ifdef HAVE_MEMFD_CREATE
+        /* fds can only go along if we still talk over its socket */
+        if (!strcmp(findXMLAttValu(root, "shared"), "On"))
+        {
+            struct stat st;
+            sharedBLOBs = fstat(fileno(stdout), &st) == 0 && S_ISSOCK(st.st_mode);
+        }
+#endif
+
         // Get device
         dev = findXMLAtt(root, "device");
 
@@ -1671,6 +1729,35 @@ void IUSaveConfigSwitch(FILE *fp, const ISwitchVectorProperty *svp)
     fprintf(fp, "</newSwitchVector>\n");
 }
 
+/* base64 encode bloblen bytes at blob to fp in lines of B64LINE chars.
+ * The encoding is done a window at a time in the B64WSIZE buffer at window and
+ * each window goes out in one write, so the whole encoded blob never exists at once.
+ */
+static void writeBLOB64(FILE *fp, const void *blob, int bloblen, unsigned char *window)
+{
+    const unsigned char *in = blob;
+    const int rawline       = B64LINE / 4 * 3;
+
+    while (bloblen > 0)
+    {
+        unsigned char *out = window;
+        int nlines;
+
+        for (nlines = 0; nlines < B64WINDOW && bloblen > 0; nlines++)
+        {
+            int n = bloblen < rawline ? bloblen : rawline;
+
+            out += to64frombits(out, in, n);
+            *out++ = '\n';
+            in += n;
+            bloblen -= n;
+        }
+
+        if (fwrite(window, 1, out - window, fp) != (size_t)(out - window))
+            break;
+    }
+}
+
 void IUSaveConfigBLOB(FILE *fp, const IBLOBVectorProperty *bvp)
 {
     int i;
@@ -1680,28 +1767,16 @@ void IUSaveConfigBLOB(FILE *fp, const IBLOBVectorProperty *bvp)
     for (i = 0; i < bvp->nbp; i++)
     {
         IBLOB *bp = &bvp->bp[i];
-        unsigned char *encblob = NULL;
-        int l = 0;
+        unsigned char *window;
 
         fprintf(fp, "  <oneBLOB\n");
         fprintf(fp, "    name='%s'\n", bp->name);
         fprintf(fp, "    size='%d'\n", bp->size);
         fprintf(fp, "    format='%s'>\n", bp->format);
 
-        encblob        = malloc(4 * bp->bloblen / 3 + 4);
-        l              = to64frombits(encblob, bp->blob, bp->bloblen);
-        size_t written = 0;
-
-        while ((int)written < l)
-        {
-            size_t towrite = ((l - written) > 72) ? 72 : l - written;
-            size_t wr      = fwrite(encblob + written, 1, towrite, fp);
-
-            fputc('\n', fp);
-            if (wr > 0)
-                written += wr;
-        }
-        free(encblob);
+        window = malloc(B64WSIZE);
+        writeBLOB64(fp, bp->blob, bp->bloblen, window);
+        free(window);
 
         fprintf(fp, "  </oneBLOB>\n");
     }
@@ -2187,13 +2262,131 @@ void IDSetLight(const ILightVectorProperty *lvp, const char *fmt, ...)
     pthread_mutex_unlock(&stdout_mutex);
 }
 
+/* 1 if bp has content to send, else only its state changes */
+static int hasBLOBContent(const IBLOB *bp)
+{
+    return (bp->size > 0 && bp->bloblen > 0);
+}
+
+#ifdef HAVE_MEMFD_CREATE
+/* copy the bytes of bp to a new sealed shared memory file.
+ * return its fd, or -1 if that fails.
+ */
+static int blobToShm(const IBLOB *bp)
+{
+    const char *p = bp->blob;
+    int n         = bp->bloblen;
+    int fd        = memfd_create(bp->name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0)
+        return -1;
+
+    while (n > 0)
+    {
+        int nw = write(fd, p, n);
+        if (nw < 0 && errno == EINTR)
+            continue;
+        if (nw <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        p += nw;
+        n -= nw;
+    }
+
+    /* indiserver maps it as is, so it must stay put */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+/* put each BLOB of bvp with content in shared memory, fds in order in shmfd[].
+ * return how many, or -1 if they can not all go that way.
+ */
+static int shareBLOBs(const IBLOBVectorProperty *bvp, int *shmfd)
+{
+    int i, n = 0;
+
+    for (i = 0; i < bvp->nbp; i++)
+    {
+        if (!hasBLOBContent(&bvp->bp[i]))
+            continue;
+        if (n == MAXSHMFD || (shmfd[n] = blobToShm(&bvp->bp[i])) < 0)
+        {
+            while (n > 0)
+                close(shmfd[--n]);
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/* send the last text of a message along with the fds of its shared BLOBs */
+static void sendShared(const char *text, int *shmfd, int nshmfd)
+{
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(MAXSHMFD * sizeof(int))];
+    } cmsgbuf;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t nw;
+    int i;
+
+    iov.iov_base = (void *)text;
+    iov.iov_len  = strlen(text);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cmsgbuf.buf;
+    msg.msg_controllen = CMSG_SPACE(nshmfd * sizeof(int));
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(nshmfd * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), shmfd, nshmfd * sizeof(int));
+
+    /* indiserver takes the fds with the first byte, so the rest may trickle.
+     * if they could not go at all it reports the shared BLOBs without fd.
+     */
+    fflush(stdout);
+    while ((nw = sendmsg(fileno(stdout), &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (nw < 0)
+    {
+        fprintf(stderr, "%s: sendmsg: %s\n", me, strerror(errno));
+        nw = 0;
+    }
+    if ((size_t)nw < iov.iov_len)
+    {
+        fputs(text + nw, stdout);
+        fflush(stdout);
+    }
+
+    for (i = 0; i < nshmfd; i++)
+        close(shmfd[i]);
+}
+#endif
+
 /* tell client to update an existing BLOB vector property */
 void IDSetBLOB(const IBLOBVectorProperty *bvp, const char *fmt, ...)
 {
     int i;
+    int shmfd[MAXSHMFD];
+    int nshmfd = -1;
 
     pthread_mutex_lock(&stdout_mutex);
 
+#ifdef HAVE_MEMFD_CREATE
+    /* all of them go in shared memory or none do */
+    if (sharedBLOBs)
+        nshmfd = shareBLOBs(bvp, shmfd);
+#endif
+
     xmlv1();
     locale_char_t *orig = indi_locale_C_numeric_push();
     printf("<setBLOBVector\n");
@@ -2201,7 +2394,8 @@ void IDSetBLOB(const IBLOBVectorProperty *bvp, const char *fmt, ...)
     printf("  name='%s'\n", bvp->name);
     printf("  state='%s'\n", pstateStr(bvp->s));
     printf("  timeout='%g'\n", bvp->timeout);
-    printf("  timestamp='%s'\n", timestamp());
+    /* streams stamp the BLOB with the frame capture time */
+    printf("  timestamp='%s'\n", bvp->timestamp[0] ? bvp->timestamp : timestamp());
     if (fmt)
     {
         va_list ap;
@@ -2216,48 +2410,49 @@ void IDSetBLOB(const IBLOBVectorProperty *bvp, const char *fmt, ...)
     for (i = 0; i < bvp->nbp; i++)
     {
         IBLOB *bp = &bvp->bp[i];
-        unsigned char *encblob;
-        int l;
 
         printf("  <oneBLOB\n");
         printf("    name='%s'\n", bp->name);
         printf("    size='%d'\n", bp->size);
 
-        // If size is zero, we are only sending a state-change
-        if (bp->size == 0)
+        // Without content, we are only sending a state-change
+        if (!hasBLOBContent(bp))
         {
             printf("    enclen='0'\n");
             printf("    format='%s'>\n", bp->format);
         }
+        else if (nshmfd >= 0)
+        {
+            /* the bytes follow in shared memory */
+            printf("    binlen='%d'\n", bp->bloblen);
+            printf("    format='%s'\n", bp->format);
+            printf("    shared='On'/>\n");
+            continue;
+        }
+        else if (binaryBLOBs)
+        {
+            /* the raw bytes follow the opening tag directly */
+            printf("    binlen='%d'\n", bp->bloblen);
+            printf("    format='%s'>", bp->format);
+            fwrite(bp->blob, 1, bp->bloblen, stdout);
+            printf("\n");
+        }
         else
         {
-            encblob = malloc(4 * bp->bloblen / 3 + 4);
-            l       = to64frombits(encblob, bp->blob, bp->bloblen);
-            printf("    enclen='%d'\n", l);
+            printf("    enclen='%d'\n", (bp->bloblen + 2) / 3 * 4);
             printf("    format='%s'>\n", bp->format);
-            size_t written = 0;
-
-            while ((int)written < l)
-            {
-                size_t towrite = ((l - written) > 72) ? 72 : l - written;
-                size_t wr      = fwrite(encblob + written, 1, towrite, stdout);
-
-                if (wr > 0)
-                    written += wr;
-                if ((written % 72) == 0)
-                    fputc('\n', stdout);
-            }
-
-            if ((written % 72) != 0)
-                fputc('\n', stdout);
-
-            free(encblob);
+            writeBLOB64(stdout, bp->blob, bp->bloblen, b64window);
         }
 
         printf("  </oneBLOB>\n");
     }
 
-    printf("</setBLOBVector>\n");
+#ifdef HAVE_MEMFD_CREATE
+    if (nshmfd > 0)
+        sendShared("</setBLOBVector>\n", shmfd, nshmfd);
+    else
+#endif
+        printf("</setBLOBVector>\n");
     indi_locale_C_numeric_pop(orig);
     fflush(stdout);
 
@@ -42,12 +42,59 @@
  * consumer is finished. XMLEle are converted to linear strings before being
  * sent to optimize write system calls and avoid blocking to slow clients.
  * Clients that get more than maxqsiz bytes behind are shut down.
+ *
+ * Each client keeps a running count of the bytes on its queue. Msg content
+ * is only set after it has been queued everywhere, so a Msg is counted the
+ * first time its queue is looked at after that, and uncounted when popped.
+ * A client may lower its own limits and ask to have messages dropped rather
+ * than be shut down when it falls behind, with maxqueue='MB', maxstream='MB'
+ * and lagging='drop' in getProperties. Only set*Vector updates that a newer
+ * one would replace are dropped, anything else still shuts the client down.
+ *
+ * Clients may also have superseded updates coalesced, with -c for everybody
+ * or coalesce='On' in getProperties. A set*Vector without a message, or with
+ * stream BLOBs, then takes the place of any unsent one for the same property
+ * still on the client queue: the old one is removed and the new one goes at
+ * the end, so a slow client only ever gets the latest value.
+ *
+ * setBLOBVectors from drivers are not printed again. Driver input is read
+ * into reference counted buffers and a BLOB Msg just refers to the pieces of
+ * them holding its original bytes, which are then written to every consumer
+ * straight from there with writev(). The driver parsers skip over BLOB
+ * content without storing it, so routing a BLOB costs about the same no
+ * matter how large it is.
+ *
+ * Local drivers are offered binary BLOBs with binary='On' in their first
+ * getProperties, and clients ask for them the same way in enableBLOB. A
+ * binary oneBLOB has binlen='n' in place of enclen and its n raw bytes
+ * follow the opening tag directly. Such a BLOB is passed as is to clients
+ * that asked for binary; for everyone else, including snooping drivers, we
+ * base64 it once into a second Msg. Binary content is only kept while
+ * parsing if somebody may need that second Msg.
+ *
+ * Local drivers write to us over a unix socket rather than a pipe, so they
+ * are also offered shared='On'. A driver taking that up puts each BLOB in a
+ * shared memory file and sends the fd along with a content-less oneBLOB
+ * marked shared='On'. We map it and clients get the bytes written straight
+ * from those pages, so a frame is copied once on its way through us.
+ *
+ * Who wants what is kept in an index of every device and device/property
+ * pair mentioned, each entry holding bitsets of the clients and drivers
+ * interested in it. Routing a message looks up its two entries once and then
+ * tests one bit per client or driver, however many properties each watches.
+ *
+ * Where epoll is available every fd is registered with the poller once when
+ * it is opened and removed just before it is closed. Interest in writing is
+ * only turned on while a client or driver has messages queued, so each
+ * wakeup costs in proportion to the fds that are actually ready rather than
+ * to the number of clients and drivers. Otherwise we fall back to select().
  */
 
 #define _GNU_SOURCE // needed for siginfo_t and sigaction
 
 #include "config.h"
 
+#include "base64.h"
 #include "fq.h"
 #include "indiapi.h"
 #include "indidevapi.h"
@@ -66,11 +113,16 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #define INDIPORT      7624    /* default TCP/IP port to listen */
 #define REMOTEDVR     (-1234) /* invalid PID to flag remote drivers */
@@ -81,18 +133,52 @@
 #define DEFMAXQSIZ    128   /* default max q behind, MB */
 #define DEFMAXSSIZ    5     /* default max stream behind, MB */
 #define DEFMAXRESTART 10    /* default max restarts */
+#define MAXPOLLEVT    64    /* max events handled per wakeup */
+#define MAXIOV        16    /* max pieces per writev */
+#define MAXSHMFD      16    /* max shared BLOB fds taken per read */
+#define PROPIDXSIZ    256   /* initial buckets in the property index */
+#define IDXBITS       (8 * sizeof(unsigned long)) /* bits per bitset word */
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
 
 #ifdef OSX_EMBEDED_MODE
 #define LOGNAME  "/Users/%s/Library/Logs/indiserver.log"
 #define FIFONAME "/tmp/indiserverFIFO"
 #endif
 
-/* associate a usage count with queuded client or device message */
+/* bytes shared by all Msgs passing some of them along: one read from a
+ * driver, text we put together, or a BLOB a driver shared with us.
+ */
+typedef struct
+{
+    int count;     /* number of users left */
+    char *data;    /* the bytes: buf, malloced or mapped */
+    size_t maplen; /* n bytes mapped at data, else 0 */
+    char buf[];    /* bytes as read, if a read */
+} RBuf;
+
+/* piece of Msg content that lives in an RBuf */
 typedef struct
 {
-    int count;         /* number of consumers left */
-    unsigned long cl;  /* content length */
-    char *cp;          /* content: buf or malloced */
+    RBuf *rb;            /* holds the bytes, we own one count */
+    int off;             /* first byte in rb->data */
+    int len;             /* n bytes */
+    unsigned long start; /* offset of first byte within the whole Msg */
+} Seg;
+
+/* associate a usage count with queuded client or device message */
+typedef struct Msg_
+{
+    int count;           /* number of consumers left */
+    unsigned long cl;    /* content length */
+    char *cp;            /* content: buf or malloced, NULL if segs */
+    Seg *segs;           /* malloced content passed through from a driver */
+    int nsegs;           /* n entries in segs[] */
+    int binary;          /* 1 if content has binary BLOBs */
+    struct Msg_ *alt;    /* Msg with them in base64 while queuing, if possible */
+    struct PropIdx_ *pi; /* property this set*Vector supersedes updates of, else NULL */
     char buf[SHORTMSGSIZ];    /* local buf for most messages */
 } Msg;
 
@@ -111,6 +197,34 @@ typedef struct {
 } Property;
 */
 
+/* the bitsets kept for each entry of the property index, over slots in
+ * clinfo[] or dvrinfo[]
+ */
+enum
+{
+    PS_CLIENT, /* clients with dev/name in props[] */
+    PS_CLBLOB, /* ... whose entry is not B_NEVER */
+    PS_SNOOP,  /* drivers with dev/name in sprops[] */
+    PS_SNBLOB, /* ... whose entry is not B_NEVER */
+    PS_SNONLY, /* ... whose entry is B_ONLY */
+    PS_OWNER,  /* drivers serving dev, only used when name is "" */
+    NPROPSETS
+};
+
+/* index entry for one device/property, name "" standing for the whole device */
+typedef struct PropIdx_
+{
+    char dev[MAXINDIDEVICE];
+    char name[MAXINDINAME];
+    unsigned long *sets[NPROPSETS]; /* malloced bitsets of nidxw words */
+    struct PropIdx_ *next;          /* next entry in same bucket */
+    int id;                         /* n entries made before this one */
+} PropIdx;
+static PropIdx **propidx; /* malloced hash buckets, entries are never freed */
+static int npropidx;      /* n buckets, a power of 2 */
+static int npropent;      /* n entries */
+static int nidxw = 1;     /* n words in each bitset */
+
 struct
 {
     const char *name; /* Path to FIFO for dynamic startups & shutdowns of drivers */
@@ -118,18 +232,35 @@ struct
     //FILE *fs;
 } fifo;
 
+/* what to do with a client more than maxqsiz bytes behind */
+typedef enum
+{
+    LAG_DISCONNECT, /* shut it down */
+    LAG_DROP,       /* drop superseded updates until it catches up */
+} LagPolicy;
+
 /* info for each connected client */
 typedef struct
 {
-    int active;         /* 1 when this record is in use */
-    Property *props;    /* malloced array of props we want */
-    int nprops;         /* n entries in props[] */
-    int allprops;       /* saw getProperties w/o device */
-    BLOBHandling blob;  /* when to send setBLOBs */
-    int s;              /* socket for this client */
-    LilXML *lp;         /* XML parsing context */
-    FQ *msgq;           /* Msg queue */
-    unsigned int nsent; /* bytes of current Msg sent so far */
+    int active;          /* 1 when this record is in use */
+    Property *props;     /* malloced array of props we want */
+    int nprops;          /* n entries in props[] */
+    int allprops;        /* saw getProperties w/o device */
+    BLOBHandling blob;   /* when to send setBLOBs */
+    int s;               /* socket for this client */
+    LilXML *lp;          /* XML parsing context */
+    FQ *msgq;            /* Msg queue */
+    unsigned int nsent;  /* bytes of current Msg sent so far */
+    int wpoll;           /* 1 when polling s for writability */
+    int binary;          /* 1 if client takes binary BLOBs */
+    unsigned long qsize; /* bytes of the first qsized Msgs in msgq */
+    int qsized;          /* n Msgs at the head of msgq counted in qsize */
+    int maxqsiz;         /* bytes behind before lagging applies */
+    int maxstreamsiz;    /* bytes behind before stream BLOBs are dropped */
+    LagPolicy lagging;   /* what to do when more than maxqsiz behind */
+    int coalesce;        /* 1 if new set*Vectors replace unsent ones */
+    Msg **latest;        /* malloced unsent Msg on msgq by PropIdx id */
+    int nlatest;         /* n entries in latest[] */
 } ClInfo;
 static ClInfo *clinfo; /*  malloced pool of clients */
 static int nclinfo;    /* n total (not active) */
@@ -158,6 +289,13 @@ typedef struct
     LilXML *lp;         /* XML parsing context */
     FQ *msgq;           /* Msg queue */
     unsigned int nsent; /* bytes of current Msg sent so far */
+    int wpoll;          /* 1 when polling wfd for writability */
+    RBuf *rb;           /* buffer for next read, we own one count */
+    Seg *raw;           /* malloced bytes read so far of element in progress */
+    int nraw;           /* n entries in raw[] */
+    int rawbad;         /* 1 if raw[] may include bytes from a bad element */
+    int *shmfd;         /* malloced fds of shared BLOBs not yet parsed */
+    int nshmfd;         /* n entries in shmfd[] */
 } DvrInfo;
 static DvrInfo *dvrinfo; /* malloced array of drivers */
 static int ndvrinfo;     /* n total */
@@ -170,8 +308,24 @@ static char *ldir;                                     /* where to log driver me
 static int maxqsiz       = (DEFMAXQSIZ * 1024 * 1024); /* kill if these bytes behind */
 static int maxstreamsiz  = (DEFMAXSSIZ * 1024 * 1024); /* drop blobs if these bytes behind while streaming*/
 static int maxrestarts   = DEFMAXRESTART;
+static int coalesce;                                   /* default for coalescing client updates */
 static int terminateddrv = 0;
 
+/* what an fd registered with the poller belongs to */
+enum
+{
+    IO_FIFO,
+    IO_LISTEN,
+    IO_CLIENT,    /* client socket */
+    IO_DRIVER,    /* driver read pipe, or socket if remote */
+    IO_DRIVERW,   /* local driver write pipe */
+    IO_DRIVERERR, /* local driver stderr pipe */
+};
+
+#ifdef HAVE_EPOLL
+static int epfd = -1; /* epoll instance watching all our fds */
+#endif
+
 static void logStartup(int ac, char *av[]);
 static void usage(void);
 //static void noZombies(void);
@@ -179,6 +333,14 @@ static void reapZombies(void);
 static void noSIGPIPE(void);
 static void indiFIFO(void);
 static void indiRun(void);
+static void ioInit(void);
+static void ioAdd(int fd, int what, int idx, int wantwrite);
+static void ioMod(int fd, int what, int idx, int wantwrite);
+static void ioDel(int fd);
+static void setClWriteInterest(ClInfo *cp, int on);
+static void setDvrWriteInterest(DvrInfo *dp, int on);
+static void pushClMsg(ClInfo *cp, Msg *mp);
+static void pushDvrMsg(DvrInfo *dp, Msg *mp);
 static void indiListen(void);
 static void newFIFO(void);
 static void newClient(void);
@@ -199,11 +361,41 @@ static void addSDevice(DvrInfo *dp, const char *dev, const char *name);
 static Property *findSDevice(DvrInfo *dp, const char *dev, const char *name);
 static void addClDevice(ClInfo *cp, const char *dev, const char *name, int isblob);
 static int findClDevice(ClInfo *cp, const char *dev, const char *name);
+static PropIdx *findPropIdx(const char *dev, const char *name, int add);
+static unsigned int hashProp(const char *dev, const char *name);
+static int propBit(PropIdx *pi, int set, int slot);
+static void setPropBit(PropIdx *pi, int set, int slot, int on);
+static void idxClProp(ClInfo *cp, Property *pp, int on);
+static void idxSProp(DvrInfo *dp, Property *sp, int on);
+static void idxDvrDev(DvrInfo *dp, const char *dev, int on);
 static int readFromDriver(DvrInfo *dp);
 static int stderrFromDriver(DvrInfo *dp);
-static int msgQSize(FQ *q);
+static unsigned long clQSize(ClInfo *cp);
+static unsigned long msgSize(Msg *mp);
+static void popClMsg(ClInfo *cp);
+static void crackLagging(ClInfo *cp, XMLEle *root);
+static PropIdx *supersedes(XMLEle *root, const char *dev, const char *name);
+static void pushClLatest(ClInfo *cp, Msg *mp);
 static void setMsgXMLEle(Msg *mp, XMLEle *root);
 static void setMsgStr(Msg *mp, char *str);
+static void setMsgRaw(Msg *mp, DvrInfo *dp);
+static int skipBLOB(XMLEle *ep, const char *data, int len, void *aux);
+static int needB64(const char *dev, const char *name);
+static int isBinaryMsg(XMLEle *root, int *whole);
+static void setMsgB64(Msg *mp, XMLEle *root);
+static ssize_t readDvr(DvrInfo *dp, char *buf, size_t n);
+static int mapShared(DvrInfo *dp, XMLEle *root, RBuf **maps);
+static void setMsgShared(Msg *mp, XMLEle *root, RBuf **maps, int binary);
+static void prXMLTag(FILE *fp, XMLEle *ep, int binary);
+static void addMsgText(Msg *mp, char *text, size_t len);
+static void addMsgSeg(Msg *mp, RBuf *rb, int off, int len);
+static RBuf *newRBuf(char *data, size_t maplen);
+static RBuf *getRBuf(DvrInfo *dp);
+static void unrefRBuf(RBuf *rb);
+static void addRaw(DvrInfo *dp, RBuf *rb, int off, int len);
+static void clearRaw(DvrInfo *dp);
+static ssize_t writeMsg(int fd, Msg *mp, unsigned long nsent);
+static const char *msgContent(Msg *mp, unsigned long off, int *np);
 static void freeMsg(Msg *mp);
 static Msg *newMsg(void);
 static int sendClientMsg(ClInfo *cp);
@@ -299,6 +491,9 @@ int main(int ac, char *av[])
                         maxrestarts = 0;
                     ac--;
                     break;
+                case 'c':
+                    coalesce = 1;
+                    break;
                 case 'v':
                     verbose++;
                     break;
@@ -317,6 +512,9 @@ int main(int ac, char *av[])
     reapZombies();
     noSIGPIPE();
 
+    /* prepare to watch fds */
+    ioInit();
+
     /* realloc seed for client pool */
     clinfo  = (ClInfo *)malloc(1);
     nclinfo = 0;
@@ -373,6 +571,7 @@ static void usage(void)
     fprintf(stderr, " -p p     : alternate IP port, default %d\n", INDIPORT);
     fprintf(stderr, " -r r     : maximum driver restarts on error, default %d\n", DEFMAXRESTART);
     fprintf(stderr, " -f path  : Path to fifo for dynamic startup and shutdown of drivers.\n");
+    fprintf(stderr, " -c       : send clients only the latest of queued property updates\n");
     fprintf(stderr, " -v       : show key events, no traffic\n");
     fprintf(stderr, " -vv      : -v + key message content\n");
     fprintf(stderr, " -vvv     : -vv + complete xml\n");
@@ -479,7 +678,7 @@ static void startDvr(DvrInfo *dp)
 static void startLocalDvr(DvrInfo *dp)
 {
     Msg *mp;
-    char buf[32];
+    char buf[64];
     int rp[2], wp[2], ep[2];
     int pid;
 
@@ -488,10 +687,12 @@ static void startLocalDvr(DvrInfo *dp)
     fflush(stderr);
 #endif
 
-    /* build three pipes: r, w and error*/
-    if (pipe(rp) < 0)
+    /* build three pipes: r, w and error.
+     * r is a socket so shared BLOBs can come along.
+     */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, rp) < 0)
     {
-        fprintf(stderr, "%s: read pipe: %s\n", indi_tstamp(NULL), strerror(errno));
+        fprintf(stderr, "%s: read socketpair: %s\n", indi_tstamp(NULL), strerror(errno));
         Bye();
     }
     if (pipe(wp) < 0)
@@ -590,21 +791,27 @@ static void startLocalDvr(DvrInfo *dp)
     dp->efd     = ep[0];
     dp->lp      = newLilXML();
     dp->msgq    = newFQ(1);
+    setXMLBlobHandler(dp->lp, skipBLOB, NULL);
+    setXMLMaxBinlen(dp->lp, MAXXMLBINLEN);
     dp->sprops  = (Property *)malloc(1); /* seed for realloc */
     dp->nsprops = 0;
     dp->nsent   = 0;
     dp->active  = 1;
     dp->ndev    = 0;
     dp->dev     = (char **)malloc(sizeof(char *));
+    dp->wpoll   = 0;
+
+    /* watch for output and complaints from the driver */
+    ioAdd(dp->rfd, IO_DRIVER, dp - dvrinfo, 0);
+    ioAdd(dp->efd, IO_DRIVERERR, dp - dvrinfo, 0);
 
     /* first message primes driver to report its properties -- dev known
      * if restarting
      */
     mp = newMsg();
-    pushFQ(dp->msgq, mp);
-    snprintf(buf, sizeof(buf), "<getProperties version='%g'/>\n", INDIV);
+    snprintf(buf, sizeof(buf), "<getProperties version='%g' binary='On' shared='On'/>\n", INDIV);
     setMsgStr(mp, buf);
-    mp->count++;
+    pushDvrMsg(dp, mp);
 
     if (verbose > 0)
         fprintf(stderr, "%s: Driver %s: pid=%d rfd=%d wfd=%d efd=%d\n", indi_tstamp(NULL), dp->name, dp->pid, dp->rfd,
@@ -641,12 +848,18 @@ static void startRemoteDvr(DvrInfo *dp)
     dp->wfd     = sockfd;
     dp->lp      = newLilXML();
     dp->msgq    = newFQ(1);
+    setXMLBlobHandler(dp->lp, skipBLOB, NULL);
+    setXMLMaxBinlen(dp->lp, MAXXMLBINLEN);
     dp->sprops  = (Property *)malloc(1); /* seed for realloc */
     dp->nsprops = 0;
     dp->nsent   = 0;
     dp->active  = 1;
     dp->ndev    = 1;
     dp->dev     = (char **)malloc(sizeof(char *));
+    dp->wpoll   = 0;
+
+    /* socket carries traffic both ways */
+    ioAdd(dp->rfd, IO_DRIVER, dp - dvrinfo, 0);
 
     /* N.B. storing name now is key to limiting outbound traffic to this
      * dev.
@@ -654,15 +867,15 @@ static void startRemoteDvr(DvrInfo *dp)
     dp->dev[0] = (char *)malloc(MAXINDIDEVICE * sizeof(char));
     strncpy(dp->dev[0], dev, MAXINDIDEVICE - 1);
     dp->dev[0][MAXINDIDEVICE - 1] = '\0';
+    idxDvrDev(dp, dp->dev[0], 1);
 
     /* Sending getProperties with device lets remote server limit its
      * outbound (and our inbound) traffic on this socket to this device.
      */
     mp = newMsg();
-    pushFQ(dp->msgq, mp);
     sprintf(buf, "<getProperties device='%s' version='%g'/>\n", dp->dev[0], INDIV);
     setMsgStr(mp, buf);
-    mp->count++;
+    pushDvrMsg(dp, mp);
 
     if (verbose > 0)
         fprintf(stderr, "%s: Driver %s: socket=%d\n", indi_tstamp(NULL), dp->name, sockfd);
@@ -752,6 +965,7 @@ static void indiListen()
 
     /* ok */
     lsocket = sfd;
+    ioAdd(lsocket, IO_LISTEN, 0, 0);
     if (verbose > 0)
         fprintf(stderr, "%s: listening to port %d on fd %d\n", indi_tstamp(NULL), port, sfd);
 }
@@ -759,6 +973,8 @@ static void indiListen()
 /* Attempt to open up FIFO */
 static void indiFIFO(void)
 {
+    if (fifo.fd >= 0)
+        ioDel(fifo.fd);
     close(fifo.fd);
     fifo.fd = -1;
 
@@ -772,9 +988,233 @@ static void indiFIFO(void)
             fprintf(stderr, "%s: open(%s): %s.\n", indi_tstamp(NULL), fifo.name, strerror(errno));
             Bye();
         }
+
+        ioAdd(fifo.fd, IO_FIFO, 0, 0);
+    }
+}
+
+/* create the poller, if we have one */
+static void ioInit(void)
+{
+#ifdef HAVE_EPOLL
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        fprintf(stderr, "%s: epoll_create1: %s\n", indi_tstamp(NULL), strerror(errno));
+        Bye();
+    }
+#endif
+}
+
+#ifdef HAVE_EPOLL
+/* fill ev for fd belonging to what/idx, always interested in reading unless
+ * fd is a local driver write pipe.
+ */
+static void ioEvent(struct epoll_event *ev, int what, int idx, int wantwrite)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->events   = (what == IO_DRIVERW ? 0 : EPOLLIN) | (wantwrite ? EPOLLOUT : 0);
+    ev->data.u64 = ((uint64_t)what << 32) | (uint32_t)idx;
+}
+#endif
+
+/* start watching fd on behalf of what/idx */
+static void ioAdd(int fd, int what, int idx, int wantwrite)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+
+    ioEvent(&ev, what, idx, wantwrite);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        fprintf(stderr, "%s: epoll add fd %d: %s\n", indi_tstamp(NULL), fd, strerror(errno));
+        Bye();
+    }
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(what);
+    INDI_UNUSED(idx);
+    INDI_UNUSED(wantwrite);
+#endif
+}
+
+/* change whether we want to know when fd can be written */
+static void ioMod(int fd, int what, int idx, int wantwrite)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+
+    ioEvent(&ev, what, idx, wantwrite);
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        fprintf(stderr, "%s: epoll mod fd %d: %s\n", indi_tstamp(NULL), fd, strerror(errno));
+        Bye();
     }
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(what);
+    INDI_UNUSED(idx);
+    INDI_UNUSED(wantwrite);
+#endif
+}
+
+/* stop watching fd. N.B. must be called before fd is closed, forked drivers
+ * may still share the underlying file and keep it alive in the poller.
+ */
+static void ioDel(int fd)
+{
+#ifdef HAVE_EPOLL
+    /* harmless if fd was never added */
+    (void)epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+#else
+    INDI_UNUSED(fd);
+#endif
+}
+
+/* turn interest in writing to client cp on or off */
+static void setClWriteInterest(ClInfo *cp, int on)
+{
+    if (cp->wpoll == on)
+        return;
+    ioMod(cp->s, IO_CLIENT, cp - clinfo, on);
+    cp->wpoll = on;
+}
+
+/* turn interest in writing to driver dp on or off.
+ * local drivers have a separate write pipe which is only in the poller while
+ * there is something to send, else it would report errors while idle.
+ */
+static void setDvrWriteInterest(DvrInfo *dp, int on)
+{
+    if (dp->wpoll == on)
+        return;
+    if (dp->pid == REMOTEDVR)
+        ioMod(dp->wfd, IO_DRIVER, dp - dvrinfo, on);
+    else if (on)
+        ioAdd(dp->wfd, IO_DRIVERW, dp - dvrinfo, 1);
+    else
+        ioDel(dp->wfd);
+    dp->wpoll = on;
+}
+
+/* add one more use of mp to the queue of client cp */
+static void pushClMsg(ClInfo *cp, Msg *mp)
+{
+    mp->count++;
+    pushFQ(cp->msgq, mp);
+    setClWriteInterest(cp, 1);
+}
+
+/* add one more use of mp to the queue of driver dp */
+static void pushDvrMsg(DvrInfo *dp, Msg *mp)
+{
+    mp->count++;
+    pushFQ(dp->msgq, mp);
+    setDvrWriteInterest(dp, 1);
 }
 
+#ifdef HAVE_EPOLL
+/* service traffic from clients and drivers */
+static void indiRun(void)
+{
+    struct epoll_event ev[MAXPOLLEVT];
+    int i, n;
+
+    /* wait for action */
+    n = epoll_wait(epfd, ev, MAXPOLLEVT, -1);
+    if (n < 0)
+    {
+        if (errno == EINTR)
+            return;
+        fprintf(stderr, "%s: epoll_wait: %s\n", indi_tstamp(NULL), strerror(errno));
+        Bye();
+    }
+
+    /* N.B. we are level triggered, so whenever a handler reports it had to
+     * shut something down we just return and let anything left over in ev[]
+     * be reported again next time rather than risk using a recycled slot.
+     */
+    for (i = 0; i < n; i++)
+    {
+        int what       = (int)(ev[i].data.u64 >> 32);
+        int idx        = (int)(ev[i].data.u64 & 0xffffffff);
+        uint32_t flags = ev[i].events;
+        int canread    = (flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        int canwrite   = (flags & (EPOLLOUT | EPOLLERR)) != 0;
+
+        switch (what)
+        {
+            case IO_FIFO:
+                /* may start and stop drivers, which reuses their slots */
+                newFIFO();
+                return;
+
+            case IO_LISTEN:
+                newClient();
+                break;
+
+            case IO_CLIENT:
+            {
+                ClInfo *cp = &clinfo[idx];
+                if (!cp->active)
+                    break;
+                if (canread)
+                {
+                    if (readFromClient(cp) < 0)
+                        return; /* fds effected */
+                }
+                if (canwrite && nFQ(cp->msgq) > 0)
+                {
+                    if (sendClientMsg(cp) < 0)
+                        return; /* fds effected */
+                }
+                break;
+            }
+
+            case IO_DRIVER:
+            {
+                DvrInfo *dp = &dvrinfo[idx];
+                if (!dp->active)
+                    break;
+                if (canread)
+                {
+                    if (readFromDriver(dp) < 0)
+                        return; /* fds effected */
+                }
+                /* only remote drivers share this fd for writing */
+                if (dp->pid == REMOTEDVR && canwrite && nFQ(dp->msgq) > 0)
+                {
+                    if (sendDriverMsg(dp) < 0)
+                        return; /* fds effected */
+                }
+                break;
+            }
+
+            case IO_DRIVERW:
+            {
+                DvrInfo *dp = &dvrinfo[idx];
+                if (dp->active && nFQ(dp->msgq) > 0)
+                {
+                    if (sendDriverMsg(dp) < 0)
+                        return; /* fds effected */
+                }
+                break;
+            }
+
+            case IO_DRIVERERR:
+            {
+                DvrInfo *dp = &dvrinfo[idx];
+                if (dp->active && dp->pid != REMOTEDVR)
+                {
+                    if (stderrFromDriver(dp) < 0)
+                        return; /* fds effected */
+                }
+                break;
+            }
+        }
+    }
+}
+#else
 /* service traffic from clients and drivers */
 static void indiRun(void)
 {
@@ -907,17 +1347,11 @@ static void indiRun(void)
         }
     }
 }
+#endif /* HAVE_EPOLL */
 
 int isDeviceInDriver(const char *dev, DvrInfo *dp)
 {
-    int i = 0;
-    for (i = 0; i < dp->ndev; i++)
-    {
-        if (!strcmp(dev, dp->dev[i]))
-            return 1;
-    }
-
-    return 0;
+    return (propBit(findPropIdx(dev, "", 0), PS_OWNER, dp - dvrinfo));
 }
 
 /* Read commands from FIFO and process them. Start/stop drivers accordingly */
@@ -1126,12 +1560,18 @@ static void newClient()
 
     /* rig up new clinfo entry */
     memset(cp, 0, sizeof(*cp));
-    cp->active = 1;
-    cp->s      = s;
-    cp->lp     = newLilXML();
-    cp->msgq   = newFQ(1);
-    cp->props  = malloc(1);
-    cp->nsent  = 0;
+    cp->active       = 1;
+    cp->s            = s;
+    cp->lp           = newLilXML();
+    cp->msgq         = newFQ(1);
+    cp->props        = malloc(1);
+    cp->nsent        = 0;
+    cp->wpoll        = 0;
+    cp->maxqsiz      = maxqsiz;
+    cp->maxstreamsiz = maxstreamsiz;
+    cp->lagging      = LAG_DISCONNECT;
+    cp->coalesce     = coalesce;
+    ioAdd(s, IO_CLIENT, cp - clinfo, 0);
 
     if (verbose > 0)
     {
@@ -1163,6 +1603,8 @@ static int readFromClient(ClInfo *cp)
 
     /* read client */
     nr = read(cp->s, buf, sizeof(buf));
+    if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return (0);
     if (nr <= 0)
     {
         if (nr < 0)
@@ -1208,7 +1650,19 @@ static int readFromClient(ClInfo *cp)
 
             /* snag enableBLOB -- send to remote drivers too */
             if (!strcmp(roottag, "enableBLOB"))
+            {
                 crackBLOBHandling(dev, name, pcdataXMLEle(root), cp);
+                cp->binary = !strcmp(findXMLAttValu(root, "binary"), "On");
+            }
+
+            /* only we offer binary BLOBs to drivers.
+             * how this client wants to be treated when lagging is for us alone.
+             */
+            if (!strcmp(roottag, "getProperties"))
+            {
+                rmXMLAtt(root, "binary");
+                crackLagging(cp, root);
+            }
 
             /* build a new message -- set content iff anyone cares */
             mp = newMsg();
@@ -1256,16 +1710,20 @@ static int readFromClient(ClInfo *cp)
  */
 static int readFromDriver(DvrInfo *dp)
 {
-    char buf[MAXRBUF];
+    RBuf *rb    = getRBuf(dp);
+    char *buf   = rb->data;
     int shutany = 0;
     ssize_t nr;
     char err[1024];
     XMLEle **nodes;
     XMLEle *root;
-    int inode = 0;
+    int *ends;
+    int inode = 0, from = 0, rawok, whole, nshared, i;
+    RBuf **maps;
+    Msg *alt;
 
     /* read driver */
-    nr = read(dp->rfd, buf, sizeof(buf));
+    nr = readDvr(dp, buf, MAXRBUF);
     if (nr <= 0)
     {
         if (nr < 0)
@@ -1278,10 +1736,11 @@ static int readFromDriver(DvrInfo *dp)
     }
 
     /* process XML chunk */
-    nodes = parseXMLChunk(dp->lp, buf, nr, err);
+    nodes = parseXMLChunkEnds(dp->lp, buf, nr, &ends, err);
 
     if (!nodes)
     {
+        free(ends);
         if (err[0])
         {
             char *ts = indi_tstamp(NULL);
@@ -1293,6 +1752,11 @@ static int readFromDriver(DvrInfo *dp)
         return -1;
     }
 
+    /* we can not tell where a bad element ended, so do not trust the raw
+     * bytes of any element from this chunk or the one still in progress.
+     */
+    rawok = !err[0] && !dp->rawbad;
+
     root = nodes[inode];
     while (root)
     {
@@ -1300,8 +1764,28 @@ static int readFromDriver(DvrInfo *dp)
         const char *dev  = findXMLAttValu(root, "device");
         const char *name = findXMLAttValu(root, "name");
         int isblob       = !strcmp(tagXMLEle(root), "setBLOBVector");
+        int hasblob      = isblob || !strcmp(roottag, "newBLOBVector");
         Msg *mp;
 
+        /* collect the original bytes of root */
+        addRaw(dp, rb, from, ends[inode] - from);
+        from = ends[inode];
+
+        /* BLOB content was skipped, so without the original bytes there is
+         * nothing we could send.
+         */
+        if (hasblob && !rawok)
+        {
+            fprintf(stderr, "%s: Driver %s: dropping <%s device='%s' name='%s'> after XML error\n",
+                    indi_tstamp(NULL), dp->name, roottag, dev, name);
+            clearRaw(dp);
+            rawok = !err[0];
+            delXMLEle(root);
+            inode++;
+            root = nodes[inode];
+            continue;
+        }
+
         if (verbose > 2)
         {
             fprintf(stderr, "%s: Driver %s: read ", indi_tstamp(0), dp->name);
@@ -1329,6 +1813,7 @@ static int readFromDriver(DvrInfo *dp)
                 setMsgXMLEle(mp, root);
             else
                 freeMsg(mp);
+            clearRaw(dp);
             delXMLEle(root);
             inode++;
             root = nodes[inode];
@@ -1340,7 +1825,11 @@ static int readFromDriver(DvrInfo *dp)
         {
             Property *sp = findSDevice(dp, dev, name);
             if (sp)
+            {
                 crackBLOB(pcdataXMLEle(root), &sp->blob);
+                idxSProp(dp, sp, 1);
+            }
+            clearRaw(dp);
             delXMLEle(root);
             inode++;
             root = nodes[inode];
@@ -1355,6 +1844,7 @@ static int readFromDriver(DvrInfo *dp)
 
             strncpy(dp->dev[dp->ndev], dev, MAXINDIDEVICE - 1);
             dp->dev[dp->ndev][MAXINDIDEVICE - 1] = '\0';
+            idxDvrDev(dp, dp->dev[dp->ndev], 1);
 
 #ifdef OSX_EMBEDED_MODE
             if (!dp->ndev)
@@ -1369,8 +1859,36 @@ static int readFromDriver(DvrInfo *dp)
         if (ldir)
             logDMsg(root, dev);
 
-        /* build a new message -- set content iff anyone cares */
+        /* map BLOBs the driver shared with us */
+        maps    = hasblob ? (RBuf **)malloc((nXMLEle(root) + 1) * sizeof(RBuf *)) : NULL;
+        nshared = hasblob ? mapShared(dp, root, maps) : 0;
+        if (nshared < 0)
+        {
+            fprintf(stderr, "%s: Driver %s: dropping <%s device='%s' name='%s'> without its shared BLOBs\n",
+                    indi_tstamp(NULL), dp->name, roottag, dev, name);
+            free(maps);
+            clearRaw(dp);
+            rawok = !err[0];
+            delXMLEle(root);
+            inode++;
+            root = nodes[inode];
+            continue;
+        }
+
+        /* build a new message -- set content iff anyone cares.
+         * binary BLOBs also get a base64 rendition if we have their content.
+         */
         mp = newMsg();
+        if (nshared > 0)
+        {
+            mp->binary = 1;
+            mp->alt    = newMsg();
+        }
+        else if (hasblob && (mp->binary = isBinaryMsg(root, &whole)) && whole)
+            mp->alt = newMsg();
+        mp->pi = supersedes(root, dev, name);
+        if (mp->alt)
+            mp->alt->pi = mp->pi;
 
         /* send to interested clients */
         if (q2Clients(NULL, isblob, dev, name, mp, root) < 0)
@@ -1379,17 +1897,47 @@ static int readFromDriver(DvrInfo *dp)
         /* send to snooping drivers */
         q2SDrivers(dp, isblob, dev, name, mp, root);
 
-        /* set message content if anyone cares else forget it */
+        /* set message content if anyone cares else forget it.
+         * BLOBs are passed along as read, everything else is small enough
+         * to just print again.
+         */
+        alt     = mp->alt;
+        mp->alt = NULL;
         if (mp->count > 0)
-            setMsgXMLEle(mp, root);
+        {
+            if (nshared > 0)
+                setMsgShared(mp, root, maps, 1);
+            else if (hasblob)
+                setMsgRaw(mp, dp);
+            else
+                setMsgXMLEle(mp, root);
+        }
         else
             freeMsg(mp);
+        if (alt && alt->count > 0 && nshared > 0)
+            setMsgShared(alt, root, maps, 0);
+        else if (alt && alt->count > 0)
+            setMsgB64(alt, root);
+        else if (alt)
+            freeMsg(alt);
+        for (i = 0; i < nshared; i++)
+            unrefRBuf(maps[i]);
+        free(maps);
+        clearRaw(dp);
+        rawok = !err[0];
         delXMLEle(root);
         inode++;
         root = nodes[inode];
     }
 
+    /* hang on to the start of the next element */
+    if (err[0])
+        dp->rawbad = 1;
+    if (from < nr)
+        addRaw(dp, rb, from, nr - from);
+
     free(nodes);
+    free(ends);
 
     return (shutany ? -1 : 0);
 }
@@ -1436,12 +1984,17 @@ static int stderrFromDriver(DvrInfo *dp)
 static void shutdownClient(ClInfo *cp)
 {
     Msg *mp;
+    int i;
 
     /* close connection */
+    ioDel(cp->s);
     shutdown(cp->s, SHUT_RDWR);
     close(cp->s);
+    cp->wpoll = 0;
 
     /* free memory */
+    for (i = 0; i < cp->nprops; i++)
+        idxClProp(cp, &cp->props[i], 0);
     delLilXML(cp->lp);
     free(cp->props);
 
@@ -1450,6 +2003,11 @@ static void shutdownClient(ClInfo *cp)
         if (--mp->count == 0)
             freeMsg(mp);
     delFQ(cp->msgq);
+    cp->qsize  = 0;
+    cp->qsized = 0;
+    free(cp->latest);
+    cp->latest  = NULL;
+    cp->nlatest = 0;
 
     /* ok now to recycle */
     cp->active = 0;
@@ -1494,6 +2052,7 @@ static void shutdownDvr(DvrInfo *dp, int restart)
     if (dp->pid == REMOTEDVR)
     {
         /* socket connection */
+        ioDel(dp->wfd);
         shutdown(dp->wfd, SHUT_RDWR);
         close(dp->wfd); /* same as rfd */
     }
@@ -1501,6 +2060,9 @@ static void shutdownDvr(DvrInfo *dp, int restart)
     {
         /* local pipe connection */
         kill(dp->pid, SIGKILL); /* we've insured there are no zombies */
+        ioDel(dp->wfd);
+        ioDel(dp->rfd);
+        ioDel(dp->efd);
         close(dp->wfd);
         close(dp->rfd);
         close(dp->efd);
@@ -1512,13 +2074,31 @@ static void shutdownDvr(DvrInfo *dp, int restart)
 #endif
 
     /* free memory */
+    for (i = 0; i < dp->nsprops; i++)
+        idxSProp(dp, &dp->sprops[i], 0);
+    for (i = 0; i < dp->ndev; i++)
+    {
+        idxDvrDev(dp, dp->dev[i], 0);
+        free(dp->dev[i]);
+    }
     free(dp->sprops);
     free(dp->dev);
     delLilXML(dp->lp);
+    clearRaw(dp);
+    free(dp->raw);
+    dp->raw = NULL;
+    if (dp->rb)
+        unrefRBuf(dp->rb);
+    dp->rb = NULL;
+    while (dp->nshmfd > 0)
+        close(dp->shmfd[--dp->nshmfd]);
+    free(dp->shmfd);
+    dp->shmfd = NULL;
 
     /* ok now to recycle */
     dp->active = 0;
     dp->ndev   = 0;
+    dp->wpoll  = 0;
 
     /* decrement and possibly free any unsent messages for this client */
     while ((mp = (Msg *)popFQ(dp->msgq)) != NULL)
@@ -1589,8 +2169,7 @@ static void q2RDrivers(const char *dev, Msg *mp, XMLEle *root)
         }
 
         /* ok: queue message to this driver */
-        mp->count++;
-        pushFQ(dp->msgq, mp);
+        pushDvrMsg(dp, mp);
         if (verbose > 1)
         {
             fprintf(stderr, "%s: Driver %s: queuing responsible for <%s device='%s' name='%s'>\n", indi_tstamp(NULL),
@@ -1605,18 +2184,24 @@ static void q2RDrivers(const char *dev, Msg *mp, XMLEle *root)
 static void q2SDrivers(DvrInfo *me, int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
 {
     DvrInfo *dp = NULL;
+    PropIdx *all = findPropIdx(dev, "", 0);
+    PropIdx *one = findPropIdx(dev, name, 0);
 
     for (dp = dvrinfo; dp < &dvrinfo[ndvrinfo]; dp++)
     {
+        int slot = dp - dvrinfo;
+        PropIdx *pi;
+
         if (dp->active == 0)
             continue;
 
-        Property *sp = findSDevice(dp, dev, name);
-
-        /* nothing for dp if not snooping for dev/name or wrong BLOB mode */
-        if (!sp)
+        /* nothing for dp if not snooping for dev/name or wrong BLOB mode.
+         * snooping this very property beats snooping the whole device.
+         */
+        pi = propBit(one, PS_SNOOP, slot) ? one : all;
+        if (!propBit(pi, PS_SNOOP, slot))
             continue;
-        if ((isblob && sp->blob == B_NEVER) || (!isblob && sp->blob == B_ONLY))
+        if ((isblob && !propBit(pi, PS_SNBLOB, slot)) || (!isblob && propBit(pi, PS_SNONLY, slot)))
             continue;
         if (me && me->pid == REMOTEDVR && dp->pid == REMOTEDVR)
         {
@@ -1626,9 +2211,18 @@ static void q2SDrivers(DvrInfo *me, int isblob, const char *dev, const char *nam
                 continue;
         }
 
+        /* drivers only read base64 */
+        if (mp->binary && !mp->alt)
+        {
+            if (verbose > 1)
+                fprintf(stderr, "%s: Driver %s: no base64 for snooped <%s device='%s' name='%s'>\n",
+                        indi_tstamp(NULL), dp->name, tagXMLEle(root), findXMLAttValu(root, "device"),
+                        findXMLAttValu(root, "name"));
+            continue;
+        }
+
         /* ok: queue message to this device */
-        mp->count++;
-        pushFQ(dp->msgq, mp);
+        pushDvrMsg(dp, mp->binary ? mp->alt : mp);
         if (verbose > 1)
         {
             fprintf(stderr, "%s: Driver %s: queuing snooped <%s device='%s' name='%s'>\n", indi_tstamp(NULL), dp->name,
@@ -1663,25 +2257,32 @@ static void addSDevice(DvrInfo *dp, const char *dev, const char *name)
     ip[MAXINDINAME - 1] = '\0';
 
     sp->blob = B_NEVER;
+    idxSProp(dp, sp, 1);
 
     if (verbose)
         fprintf(stderr, "%s: Driver %s: snooping on %s.%s\n", indi_tstamp(NULL), dp->name, dev, name);
 }
 
 /* return Property if dp is snooping dev/name, else NULL.
+ * snooping name itself beats snooping all of dev, as when routing.
  */
 static Property *findSDevice(DvrInfo *dp, const char *dev, const char *name)
 {
+    Property *wild = NULL;
     int i;
 
     for (i = 0; i < dp->nsprops; i++)
     {
         Property *sp = &dp->sprops[i];
-        if (!strcmp(sp->dev, dev) && (!sp->name[0] || !strcmp(sp->name, name)))
+        if (strcmp(sp->dev, dev))
+            continue;
+        if (!strcmp(sp->name, name))
             return (sp);
+        if (!sp->name[0] && !wild)
+            wild = sp;
     }
 
-    return (NULL);
+    return (wild);
 }
 
 /* put Msg mp on queue of each client interested in dev/name, except notme.
@@ -1692,47 +2293,37 @@ static int q2Clients(ClInfo *notme, int isblob, const char *dev, const char *nam
 {
     int shutany = 0;
     ClInfo *cp;
-    int ql, i = 0;
+    int ql;
+    PropIdx *all, *one;
+
+    /* the index entries saying who wants dev and dev/name */
+    if (!name)
+        name = "";
+    all = findPropIdx(dev, "", 0);
+    one = findPropIdx(dev, name, 0);
 
     /* queue message to each interested client */
     for (cp = clinfo; cp < &clinfo[nclinfo]; cp++)
     {
+        int slot = cp - clinfo;
+
         /* cp in use? notme? want this dev/name? blob? */
         if (!cp->active || cp == notme)
             continue;
-        if (findClDevice(cp, dev, name) < 0)
+        if (!cp->allprops && dev[0] && !propBit(all, PS_CLIENT, slot) && !propBit(one, PS_CLIENT, slot))
             continue;
 
         //if ((isblob && cp->blob==B_NEVER) || (!isblob && cp->blob==B_ONLY))
         if (!isblob && cp->blob == B_ONLY)
             continue;
 
-        if (isblob)
-        {
-            if (cp->nprops > 0)
-            {
-                Property *pp   = NULL;
-                int blob_found = 0;
-                for (i = 0; i < cp->nprops; i++)
-                {
-                    pp = &cp->props[i];
-                    if (!strcmp(pp->dev, dev) && (!strcmp(pp->name, name)))
-                    {
-                        blob_found = 1;
-                        break;
-                    }
-                }
-
-                if ((blob_found && pp->blob == B_NEVER) || (blob_found == 0 && cp->blob == B_NEVER))
-                    continue;
-            }
-            else if (cp->blob == B_NEVER)
-                continue;
-        }
+        /* a setting for this very property beats the client's own */
+        if (isblob && (propBit(one, PS_CLIENT, slot) ? !propBit(one, PS_CLBLOB, slot) : cp->blob == B_NEVER))
+            continue;
 
-        /* shut down this client if its q is already too large */
-        ql = msgQSize(cp->msgq);
-        if (isblob && maxstreamsiz > 0 && ql > maxstreamsiz)
+        /* drop stream frames or more if this client is too far behind */
+        ql = clQSize(cp);
+        if (isblob && cp->maxstreamsiz > 0 && ql > cp->maxstreamsiz)
         {
             // Drop frames for streaming blobs
             /* pull out each name/BLOB pair, decode */
@@ -1759,7 +2350,16 @@ static int q2Clients(ClInfo *notme, int isblob, const char *dev, const char *nam
                 continue;
             }
         }
-        if (ql > maxqsiz)
+        /* only updates a newer one replaces may go, the client would lose track of anything else */
+        if (ql > cp->maxqsiz && cp->lagging == LAG_DROP && mp->pi)
+        {
+            if (verbose > 1)
+                fprintf(stderr, "%s: Client %d: %d bytes behind. Dropping <%s device='%s' name='%s'>\n",
+                        indi_tstamp(NULL), cp->s, ql, tagXMLEle(root), findXMLAttValu(root, "device"),
+                        findXMLAttValu(root, "name"));
+            continue;
+        }
+        if (ql > cp->maxqsiz)
         {
             if (verbose)
                 fprintf(stderr, "%s: Client %d: %d bytes behind, shutting down\n", indi_tstamp(NULL), cp->s, ql);
@@ -1768,9 +2368,17 @@ static int q2Clients(ClInfo *notme, int isblob, const char *dev, const char *nam
             continue;
         }
 
+        /* binary BLOBs only go as is to clients that asked for them */
+        if (mp->binary && !cp->binary && !mp->alt)
+        {
+            if (verbose > 1)
+                fprintf(stderr, "%s: Client %d: no base64 for <%s device='%s' name='%s'>\n", indi_tstamp(NULL),
+                        cp->s, tagXMLEle(root), findXMLAttValu(root, "device"), findXMLAttValu(root, "name"));
+            continue;
+        }
+
         /* ok: queue message to this client */
-        mp->count++;
-        pushFQ(cp->msgq, mp);
+        pushClLatest(cp, mp->binary && !cp->binary ? mp->alt : mp);
         if (verbose > 1)
             fprintf(stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n", indi_tstamp(NULL), cp->s,
                     tagXMLEle(root), findXMLAttValu(root, "device"), findXMLAttValu(root, "name"));
@@ -1779,6 +2387,73 @@ static int q2Clients(ClInfo *notme, int isblob, const char *dev, const char *nam
     return (shutany ? -1 : 0);
 }
 
+/* return the index entry of the property whose unsent updates root makes
+ * stale, else NULL. that is a set*Vector that carries no message and, if
+ * BLOBs, is a stream frame.
+ */
+static PropIdx *supersedes(XMLEle *root, const char *dev, const char *name)
+{
+    const char *tag = tagXMLEle(root);
+    XMLEle *ep;
+
+    if (strncmp(tag, "set", 3) || !dev[0] || !name[0] || findXMLAttValu(root, "message")[0])
+        return (NULL);
+    if (!strcmp(tag, "setBLOBVector"))
+    {
+        for (ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+            if (!strstr(findXMLAttValu(ep, "format"), "stream"))
+                return (NULL);
+    }
+
+    return (findPropIdx(dev, name, 1));
+}
+
+/* queue mp for cp. if cp coalesces, first drop any unsent Msg it has for the
+ * same property and remember mp as the latest instead.
+ */
+static void pushClLatest(ClInfo *cp, Msg *mp)
+{
+    Msg *old;
+    int i;
+
+    if (!cp->coalesce || !mp->pi)
+    {
+        pushClMsg(cp, mp);
+        return;
+    }
+
+    if (mp->pi->id >= cp->nlatest)
+    {
+        int n       = mp->pi->id + 64;
+        cp->latest  = (Msg **)realloc(cp->latest, n * sizeof(Msg *));
+        memset(cp->latest + cp->nlatest, 0, (n - cp->nlatest) * sizeof(Msg *));
+        cp->nlatest = n;
+    }
+
+    /* it is most likely near the end, never take it once partly sent */
+    old = cp->latest[mp->pi->id];
+    for (i = old ? nFQ(cp->msgq) - 1 : -1; i >= 0; i--)
+        if (peekiFQ(cp->msgq, i) == old)
+            break;
+    if (i > 0 || (i == 0 && cp->nsent == 0))
+    {
+        rmiFQ(cp->msgq, i);
+        if (i < cp->qsized)
+        {
+            cp->qsize -= msgSize(old);
+            cp->qsized--;
+        }
+        if (--old->count == 0)
+            freeMsg(old);
+        if (verbose > 1)
+            fprintf(stderr, "%s: Client %d: superseded unsent update of %s.%s\n", indi_tstamp(NULL), cp->s,
+                    mp->pi->dev, mp->pi->name);
+    }
+
+    cp->latest[mp->pi->id] = mp;
+    pushClMsg(cp, mp);
+}
+
 /* put Msg mp on queue of each chained server client, except notme.
   * return -1 if had to shut down any clients, else 0.
  */
@@ -1818,8 +2493,8 @@ static int q2Servers(DvrInfo *me, Msg *mp, XMLEle *root)
             continue;
 
         /* shut down this client if its q is already too large */
-        ql = msgQSize(cp->msgq);
-        if (ql > maxqsiz)
+        ql = clQSize(cp);
+        if (ql > cp->maxqsiz)
         {
             if (verbose)
                 fprintf(stderr, "%s: Client %d: %d bytes behind, shutting down\n", indi_tstamp(NULL), cp->s, ql);
@@ -1829,8 +2504,7 @@ static int q2Servers(DvrInfo *me, Msg *mp, XMLEle *root)
         }
 
         /* ok: queue message to this client */
-        mp->count++;
-        pushFQ(cp->msgq, mp);
+        pushClMsg(cp, mp);
         if (verbose > 1)
             fprintf(stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n", indi_tstamp(NULL), cp->s,
                     tagXMLEle(root), findXMLAttValu(root, "device"), findXMLAttValu(root, "name"));
@@ -1839,22 +2513,91 @@ static int q2Servers(DvrInfo *me, Msg *mp, XMLEle *root)
     return (shutany ? -1 : 0);
 }
 
-/* return size of all Msqs on the given q */
-static int msgQSize(FQ *q)
+/* return size of all Msgs on the queue of cp, counting any new ones.
+ * a Msg still being routed has no content yet and waits for next time.
+ */
+static unsigned long clQSize(ClInfo *cp)
 {
-    int i, l = 0;
-
-    for (i = 0; i < nFQ(q); i++)
+    while (cp->qsized < nFQ(cp->msgq))
     {
-        Msg *mp = (Msg *)peekiFQ(q, i);
-        l += sizeof(Msg);
-        if (mp->cp != mp->buf)
-            l += mp->cl;
+        Msg *mp = (Msg *)peekiFQ(cp->msgq, cp->qsized);
+        if (!mp->cp && !mp->nsegs)
+            break;
+        cp->qsize += msgSize(mp);
+        cp->qsized++;
     }
 
+    return (cp->qsize);
+}
+
+/* return how much mp weighs on a queue */
+static unsigned long msgSize(Msg *mp)
+{
+    unsigned long l = sizeof(Msg);
+
+    if (mp->cp != mp->buf)
+        l += mp->cl;
     return (l);
 }
 
+/* pop the head Msg off the queue of cp, with its share of the size */
+static void popClMsg(ClInfo *cp)
+{
+    Msg *mp = (Msg *)popFQ(cp->msgq);
+
+    if (cp->qsized > 0)
+    {
+        cp->qsize -= msgSize(mp);
+        cp->qsized--;
+    }
+    if (mp->pi && mp->pi->id < cp->nlatest && cp->latest[mp->pi->id] == mp)
+        cp->latest[mp->pi->id] = NULL;
+    if (--mp->count == 0)
+        freeMsg(mp);
+}
+
+/* set how cp wants to be treated when it falls behind from the attributes
+ * of its getProperties root, then remove them. it can not ask for more
+ * room than we allow anybody.
+ */
+static void crackLagging(ClInfo *cp, XMLEle *root)
+{
+    XMLAtt *ap;
+
+    if ((ap = findXMLAtt(root, "maxqueue")) != NULL)
+    {
+        int mb = atoi(valuXMLAtt(ap));
+        if (mb > 0 && mb <= maxqsiz / (1024 * 1024))
+            cp->maxqsiz = mb * 1024 * 1024;
+        rmXMLAtt(root, "maxqueue");
+    }
+    if ((ap = findXMLAtt(root, "maxstream")) != NULL)
+    {
+        int mb = atoi(valuXMLAtt(ap));
+        if (mb > 0 && mb <= maxstreamsiz / (1024 * 1024))
+            cp->maxstreamsiz = mb * 1024 * 1024;
+        rmXMLAtt(root, "maxstream");
+    }
+    if ((ap = findXMLAtt(root, "lagging")) != NULL)
+    {
+        if (!strcmp(valuXMLAtt(ap), "drop"))
+            cp->lagging = LAG_DROP;
+        else if (!strcmp(valuXMLAtt(ap), "disconnect"))
+            cp->lagging = LAG_DISCONNECT;
+        rmXMLAtt(root, "lagging");
+    }
+    if ((ap = findXMLAtt(root, "coalesce")) != NULL)
+    {
+        cp->coalesce = !strcmp(valuXMLAtt(ap), "On");
+        rmXMLAtt(root, "coalesce");
+    }
+
+    if (verbose > 1)
+        fprintf(stderr, "%s: Client %d: max %d bytes behind, streams %d, then %s%s\n", indi_tstamp(NULL), cp->s,
+                cp->maxqsiz, cp->maxstreamsiz, cp->lagging == LAG_DROP ? "drop" : "disconnect",
+                cp->coalesce ? ", coalescing" : "");
+}
+
 /* print root as content in Msg mp.
  */
 static void setMsgXMLEle(Msg *mp, XMLEle *root)
@@ -1881,6 +2624,410 @@ static void setMsgStr(Msg *mp, char *str)
     strcpy(mp->cp, str);
 }
 
+/* save the original bytes of the element just read from dp as content in
+ * Msg mp. mp takes over our counts on the buffers holding them.
+ */
+static void setMsgRaw(Msg *mp, DvrInfo *dp)
+{
+    int i;
+
+    mp->segs  = dp->raw;
+    mp->nsegs = dp->nraw;
+    mp->cp    = NULL;
+    mp->cl    = 0;
+    for (i = 0; i < mp->nsegs; i++)
+    {
+        mp->segs[i].start = mp->cl;
+        mp->cl += mp->segs[i].len;
+    }
+
+    dp->raw  = NULL;
+    dp->nraw = 0;
+}
+
+/* BLOB content from drivers is passed along from the raw bytes, so there is
+ * nothing to do with it while parsing. Binary content is kept when somebody
+ * may need it in base64, which is decided once at its opening tag.
+ */
+static int skipBLOB(XMLEle *ep, const char *data, int len, void *aux)
+{
+    XMLEle *root = parentXMLEle(ep);
+
+    INDI_UNUSED(len);
+    INDI_UNUSED(aux);
+
+    /* only content we said we keep comes after the first call */
+    if (data)
+        return (1);
+
+    return (root && findXMLAtt(ep, "binlen") &&
+            needB64(findXMLAttValu(root, "device"), findXMLAttValu(root, "name")));
+}
+
+/* return 1 if any client or snooping driver might want BLOB dev/name in base64 */
+static int needB64(const char *dev, const char *name)
+{
+    PropIdx *all = findPropIdx(dev, "", 0);
+    PropIdx *one = findPropIdx(dev, name, 0);
+    ClInfo *cp;
+    int slot;
+
+    /* same tests as q2Clients() */
+    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++)
+    {
+        slot = cp - clinfo;
+        if (!cp->active || cp->binary)
+            continue;
+        if (!cp->allprops && dev[0] && !propBit(all, PS_CLIENT, slot) && !propBit(one, PS_CLIENT, slot))
+            continue;
+        if (propBit(one, PS_CLIENT, slot) ? propBit(one, PS_CLBLOB, slot) : cp->blob != B_NEVER)
+            return (1);
+    }
+
+    /* same tests as q2SDrivers() */
+    for (slot = 0; slot < ndvrinfo; slot++)
+    {
+        PropIdx *pi = propBit(one, PS_SNOOP, slot) ? one : all;
+
+        if (dvrinfo[slot].active && propBit(pi, PS_SNBLOB, slot))
+            return (1);
+    }
+
+    return (0);
+}
+
+/* return 1 if any oneBLOB in root came with binary content.
+ * set *whole to 1 if all of that content was kept, else 0.
+ */
+static int isBinaryMsg(XMLEle *root, int *whole)
+{
+    XMLEle *ep;
+    int binary = 0;
+
+    *whole = 1;
+    for (ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+    {
+        XMLAtt *ap = findXMLAtt(ep, "binlen");
+
+        if (!ap)
+            continue;
+        binary = 1;
+        if (pcdatalenXMLEle(ep) != atoi(valuXMLAtt(ap)))
+            *whole = 0;
+    }
+
+    return (binary);
+}
+
+/* print root as content in Msg mp with each binary oneBLOB base64 encoded.
+ * N.B. root is changed in the process.
+ */
+static void setMsgB64(Msg *mp, XMLEle *root)
+{
+    XMLEle *ep;
+
+    for (ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+    {
+        int len = pcdatalenXMLEle(ep);
+        char enclen[32];
+        unsigned char *b64;
+
+        if (!findXMLAtt(ep, "binlen"))
+            continue;
+
+        b64 = malloc(4 * len / 3 + 4);
+        if (!b64)
+        {
+            fprintf(stderr, "no memory for base64 BLOB\n");
+            Bye();
+        }
+        snprintf(enclen, sizeof(enclen), "%d", to64frombits(b64, (unsigned char *)pcdataXMLEle(ep), len));
+        editXMLEle(ep, (char *)b64);
+        rmXMLAtt(ep, "binlen");
+        addXMLAtt(ep, "enclen", enclen);
+        free(b64);
+    }
+
+    setMsgXMLEle(mp, root);
+}
+
+/* read up to n bytes from driver dp into buf, queuing the fds of any shared
+ * BLOBs that come along.
+ * return as per read(2).
+ */
+static ssize_t readDvr(DvrInfo *dp, char *buf, size_t n)
+{
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(MAXSHMFD * sizeof(int))];
+    } cmsgbuf;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t nr;
+
+    iov.iov_base = buf;
+    iov.iov_len  = n;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    nr = recvmsg(dp->rfd, &msg, MSG_CMSG_CLOEXEC);
+    if (nr <= 0)
+        return (nr);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        int nfd;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        nfd        = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        dp->shmfd  = (int *)realloc(dp->shmfd, (dp->nshmfd + nfd) * sizeof(int));
+        memcpy(&dp->shmfd[dp->nshmfd], CMSG_DATA(cmsg), nfd * sizeof(int));
+        dp->nshmfd += nfd;
+    }
+    if (msg.msg_flags & MSG_CTRUNC)
+        fprintf(stderr, "%s: Driver %s: too many shared BLOBs at once, some are lost\n", indi_tstamp(NULL), dp->name);
+
+    return (nr);
+}
+
+/* map the content of each shared oneBLOB in root from the next fd dp sent,
+ * into maps[] in order. we own one count on each.
+ * return how many, or -1 if any could not be mapped.
+ */
+static int mapShared(DvrInfo *dp, XMLEle *root, RBuf **maps)
+{
+    XMLEle *ep;
+    int n = 0, bad = 0;
+
+    for (ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+    {
+        size_t len = atoi(findXMLAttValu(ep, "binlen"));
+        struct stat st;
+        void *p;
+        int fd;
+
+        if (strcmp(findXMLAttValu(ep, "shared"), "On"))
+            continue;
+
+        /* fds come in the same order as their elements */
+        if (dp->nshmfd == 0)
+        {
+            fprintf(stderr, "%s: Driver %s: shared BLOB without fd\n", indi_tstamp(NULL), dp->name);
+            bad = 1;
+            continue;
+        }
+        fd = dp->shmfd[0];
+        memmove(dp->shmfd, dp->shmfd + 1, --dp->nshmfd * sizeof(int));
+
+        if (len == 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < len ||
+            (p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            fprintf(stderr, "%s: Driver %s: can not map shared BLOB of %zu bytes\n", indi_tstamp(NULL), dp->name,
+                    len);
+            bad = 1;
+        }
+        else if (!bad)
+            maps[n++] = newRBuf((char *)p, len);
+        else
+            munmap(p, len);
+        close(fd);
+    }
+
+    if (bad)
+    {
+        while (n > 0)
+            unrefRBuf(maps[--n]);
+        return (-1);
+    }
+
+    return (n);
+}
+
+/* set content of Msg mp to root, whose shared oneBLOBs are in maps[] in order.
+ * their bytes are used in place if binary, else base64 encoded.
+ */
+static void setMsgShared(Msg *mp, XMLEle *root, RBuf **maps, int binary)
+{
+    XMLEle *ep;
+    char *text;
+    size_t textl;
+    FILE *fp = open_memstream(&text, &textl);
+    int i    = 0;
+
+    prXMLTag(fp, root, 1);
+    fprintf(fp, ">\n");
+    for (ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+    {
+        RBuf *rb = maps[i];
+
+        if (strcmp(findXMLAttValu(ep, "shared"), "On"))
+        {
+            prXMLEle(fp, ep, 1);
+            continue;
+        }
+        i++;
+
+        fprintf(fp, "    ");
+        prXMLTag(fp, ep, binary);
+        if (binary)
+        {
+            fprintf(fp, ">");
+            fclose(fp);
+            addMsgText(mp, text, textl);
+            addMsgSeg(mp, rb, 0, rb->maplen);
+        }
+        else
+        {
+            char *b64 = malloc(4 * rb->maplen / 3 + 4);
+            int l;
+
+            if (!b64)
+            {
+                fprintf(stderr, "no memory for base64 BLOB\n");
+                Bye();
+            }
+            l = to64frombits((unsigned char *)b64, (unsigned char *)rb->data, rb->maplen);
+            fprintf(fp, " enclen=\"%d\">\n", l);
+            fclose(fp);
+            addMsgText(mp, text, textl);
+            addMsgText(mp, b64, l);
+        }
+
+        fp = open_memstream(&text, &textl);
+        fprintf(fp, "\n    </%s>\n", tagXMLEle(ep));
+    }
+    fprintf(fp, "</%s>\n", tagXMLEle(root));
+    fclose(fp);
+    addMsgText(mp, text, textl);
+}
+
+/* print the opening tag of ep to fp, sans the closing '>'.
+ * shared is left out, as is binlen unless binary.
+ */
+static void prXMLTag(FILE *fp, XMLEle *ep, int binary)
+{
+    XMLAtt *ap;
+
+    fprintf(fp, "<%s", tagXMLEle(ep));
+    for (ap = nextXMLAtt(ep, 1); ap; ap = nextXMLAtt(ep, 0))
+    {
+        if (!strcmp(nameXMLAtt(ap), "shared") || (!binary && !strcmp(nameXMLAtt(ap), "binlen")))
+            continue;
+        fprintf(fp, " %s=\"%s\"", nameXMLAtt(ap), entityXML(valuXMLAtt(ap)));
+    }
+}
+
+/* append the len bytes of malloced text to mp, which takes it over */
+static void addMsgText(Msg *mp, char *text, size_t len)
+{
+    RBuf *rb = newRBuf(text, 0);
+
+    addMsgSeg(mp, rb, 0, len);
+    unrefRBuf(rb);
+}
+
+/* append len bytes at off in rb to the content of mp */
+static void addMsgSeg(Msg *mp, RBuf *rb, int off, int len)
+{
+    Seg *sp;
+
+    mp->segs  = (Seg *)realloc(mp->segs, (mp->nsegs + 1) * sizeof(Seg));
+    sp        = &mp->segs[mp->nsegs++];
+    sp->rb    = rb;
+    sp->off   = off;
+    sp->len   = len;
+    sp->start = mp->cl;
+    mp->cl += len;
+    mp->cp = NULL;
+    rb->count++;
+}
+
+/* return the buffer to use for the next read from dp.
+ * reuse the last one unless some Msg or element in progress still needs it.
+ */
+static RBuf *getRBuf(DvrInfo *dp)
+{
+    if (dp->rb && dp->rb->count == 1)
+        return (dp->rb);
+
+    if (dp->rb)
+        unrefRBuf(dp->rb);
+    dp->rb = (RBuf *)malloc(sizeof(RBuf) + MAXRBUF);
+    if (!dp->rb)
+    {
+        fprintf(stderr, "no memory for driver read buffer\n");
+        Bye();
+    }
+    dp->rb->count  = 1;
+    dp->rb->data   = dp->rb->buf;
+    dp->rb->maplen = 0;
+    return (dp->rb);
+}
+
+/* return a new RBuf holding data, which is malloced or mapped if maplen.
+ * the caller owns the one count.
+ */
+static RBuf *newRBuf(char *data, size_t maplen)
+{
+    RBuf *rb = (RBuf *)malloc(sizeof(RBuf));
+
+    if (!rb)
+    {
+        fprintf(stderr, "no memory for message buffer\n");
+        Bye();
+    }
+    rb->count  = 1;
+    rb->data   = data;
+    rb->maplen = maplen;
+    return (rb);
+}
+
+/* one less user of rb, free it if that was the last */
+static void unrefRBuf(RBuf *rb)
+{
+    if (--rb->count > 0)
+        return;
+    if (rb->maplen)
+        munmap(rb->data, rb->maplen);
+    else if (rb->data != rb->buf)
+        free(rb->data);
+    free(rb);
+}
+
+/* note len bytes at off in rb are part of the element dp is reading */
+static void addRaw(DvrInfo *dp, RBuf *rb, int off, int len)
+{
+    Seg *sp;
+
+    if (len <= 0)
+        return;
+
+    dp->raw   = (Seg *)realloc(dp->raw, (dp->nraw + 1) * sizeof(Seg));
+    sp        = &dp->raw[dp->nraw++];
+    sp->rb    = rb;
+    sp->off   = off;
+    sp->len   = len;
+    sp->start = 0;
+    rb->count++;
+}
+
+/* forget the bytes of the element dp was reading */
+static void clearRaw(DvrInfo *dp)
+{
+    int i;
+
+    for (i = 0; i < dp->nraw; i++)
+        unrefRBuf(dp->raw[i].rb);
+    dp->nraw   = 0;
+    dp->rawbad = 0;
+}
+
 /* return pointer to one new nulled Msg
  */
 static Msg *newMsg(void)
@@ -1891,11 +3038,78 @@ static Msg *newMsg(void)
 /* free Msg mp and everything it contains */
 static void freeMsg(Msg *mp)
 {
+    int i;
+
     if (mp->cp && mp->cp != mp->buf)
         free(mp->cp);
+    for (i = 0; i < mp->nsegs; i++)
+        unrefRBuf(mp->segs[i].rb);
+    free(mp->segs);
     free(mp);
 }
 
+/* return the Seg of mp holding byte off */
+static Seg *findSeg(Msg *mp, unsigned long off)
+{
+    int lo = 0, hi = mp->nsegs - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (mp->segs[mid].start <= off)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return (&mp->segs[lo]);
+}
+
+/* return pointer to the content of mp at offset off and set *np to the
+ * number of bytes available there in one piece.
+ */
+static const char *msgContent(Msg *mp, unsigned long off, int *np)
+{
+    Seg *sp;
+
+    if (!mp->segs)
+    {
+        *np = mp->cl - off;
+        return (&mp->cp[off]);
+    }
+
+    sp  = findSeg(mp, off);
+    *np = sp->len - (off - sp->start);
+    return (&sp->rb->data[sp->off + (off - sp->start)]);
+}
+
+/* write the next chunk of mp to fd, starting nsent bytes in.
+ * never more than MAXWSIZ to reduce blocking.
+ * return as per write(2).
+ */
+static ssize_t writeMsg(int fd, Msg *mp, unsigned long nsent)
+{
+    struct iovec iov[MAXIOV];
+    size_t nsend = 0;
+    int niov     = 0;
+
+    while (nsent < mp->cl && niov < MAXIOV && nsend < MAXWSIZ)
+    {
+        int n;
+        const char *p = msgContent(mp, nsent, &n);
+
+        if (n > MAXWSIZ - (int)nsend)
+            n = MAXWSIZ - nsend;
+        iov[niov].iov_base = (void *)p;
+        iov[niov].iov_len  = n;
+        niov++;
+        nsend += n;
+        nsent += n;
+    }
+
+    return (writev(fd, iov, niov));
+}
+
 /* write the next chunk of the current message in the queue to the given
  * client. pop message from queue when complete and free the message if we are
  * the last one to use it. shut down this client if trouble.
@@ -1904,17 +3118,16 @@ static void freeMsg(Msg *mp)
  */
 static int sendClientMsg(ClInfo *cp)
 {
-    ssize_t nsend, nw;
+    ssize_t nw;
     Msg *mp;
 
     /* get current message */
     mp = (Msg *)peekFQ(cp->msgq);
 
-    /* send next chunk, never more than MAXWSIZ to reduce blocking */
-    nsend = mp->cl - cp->nsent;
-    if (nsend > MAXWSIZ)
-        nsend = MAXWSIZ;
-    nw = write(cp->s, &mp->cp[cp->nsent], nsend);
+    /* send next chunk */
+    nw = writeMsg(cp->s, mp, cp->nsent);
+    if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return (0);
 
     /* shut down if trouble */
     if (nw <= 0)
@@ -1928,14 +3141,15 @@ static int sendClientMsg(ClInfo *cp)
     }
 
     /* trace */
-    if (verbose > 2)
-    {
-        fprintf(stderr, "%s: Client %d: sending msg copy %d nq %d:\n%.*s\n", indi_tstamp(NULL), cp->s, mp->count,
-                nFQ(cp->msgq), (int)nw, &mp->cp[cp->nsent]);
-    }
-    else if (verbose > 1)
+    if (verbose > 1)
     {
-        fprintf(stderr, "%s: Client %d: sending %.50s\n", indi_tstamp(NULL), cp->s, &mp->cp[cp->nsent]);
+        int n;
+        const char *p = msgContent(mp, cp->nsent, &n);
+        if (verbose > 2)
+            fprintf(stderr, "%s: Client %d: sending msg copy %d nq %d:\n%.*s\n", indi_tstamp(NULL), cp->s, mp->count,
+                    nFQ(cp->msgq), (int)(nw < n ? nw : n), p);
+        else
+            fprintf(stderr, "%s: Client %d: sending %.*s\n", indi_tstamp(NULL), cp->s, n < 50 ? n : 50, p);
     }
 
     /* update amount sent. when complete: free message if we are the last
@@ -1944,10 +3158,12 @@ static int sendClientMsg(ClInfo *cp)
     cp->nsent += nw;
     if (cp->nsent == mp->cl)
     {
-        if (--mp->count == 0)
-            freeMsg(mp);
-        popFQ(cp->msgq);
+        popClMsg(cp);
         cp->nsent = 0;
+
+        /* nothing more to send for now */
+        if (nFQ(cp->msgq) == 0)
+            setClWriteInterest(cp, 0);
     }
 
     return (0);
@@ -1961,17 +3177,14 @@ static int sendClientMsg(ClInfo *cp)
  */
 static int sendDriverMsg(DvrInfo *dp)
 {
-    ssize_t nsend, nw;
+    ssize_t nw;
     Msg *mp;
 
     /* get current message */
     mp = (Msg *)peekFQ(dp->msgq);
 
-    /* send next chunk, never more than MAXWSIZ to reduce blocking */
-    nsend = mp->cl - dp->nsent;
-    if (nsend > MAXWSIZ)
-        nsend = MAXWSIZ;
-    nw = write(dp->wfd, &mp->cp[dp->nsent], nsend);
+    /* send next chunk */
+    nw = writeMsg(dp->wfd, mp, dp->nsent);
 
     /* restart if trouble */
     if (nw <= 0)
@@ -1985,14 +3198,15 @@ static int sendDriverMsg(DvrInfo *dp)
     }
 
     /* trace */
-    if (verbose > 2)
+    if (verbose > 1)
     {
-        fprintf(stderr, "%s: Driver %s: sending msg copy %d nq %d:\n%.*s\n", indi_tstamp(NULL), dp->name, mp->count,
-                nFQ(dp->msgq), (int)nw, &mp->cp[dp->nsent]);
-    }
-    else if (verbose > 1)
-    {
-        fprintf(stderr, "%s: Driver %s: sending %.50s\n", indi_tstamp(NULL), dp->name, &mp->cp[dp->nsent]);
+        int n;
+        const char *p = msgContent(mp, dp->nsent, &n);
+        if (verbose > 2)
+            fprintf(stderr, "%s: Driver %s: sending msg copy %d nq %d:\n%.*s\n", indi_tstamp(NULL), dp->name,
+                    mp->count, nFQ(dp->msgq), (int)(nw < n ? nw : n), p);
+        else
+            fprintf(stderr, "%s: Driver %s: sending %.*s\n", indi_tstamp(NULL), dp->name, n < 50 ? n : 50, p);
     }
 
     /* update amount sent. when complete: free message if we are the last
@@ -2005,6 +3219,10 @@ static int sendDriverMsg(DvrInfo *dp)
             freeMsg(mp);
         popFQ(dp->msgq);
         dp->nsent = 0;
+
+        /* nothing more to send for now */
+        if (nFQ(dp->msgq) == 0)
+            setDvrWriteInterest(dp, 0);
     }
 
     return (0);
@@ -2014,16 +3232,12 @@ static int sendDriverMsg(DvrInfo *dp)
  */
 static int findClDevice(ClInfo *cp, const char *dev, const char *name)
 {
-    int i;
+    int slot = cp - clinfo;
 
     if (cp->allprops || !dev[0])
         return (0);
-    for (i = 0; i < cp->nprops; i++)
-    {
-        Property *pp = &cp->props[i];
-        if (!strcmp(pp->dev, dev) && (!pp->name[0] || !strcmp(pp->name, name)))
-            return (0);
-    }
+    if (propBit(findPropIdx(dev, "", 0), PS_CLIENT, slot) || propBit(findPropIdx(dev, name, 0), PS_CLIENT, slot))
+        return (0);
     return (-1);
 }
 
@@ -2033,16 +3247,11 @@ static void addClDevice(ClInfo *cp, const char *dev, const char *name, int isblo
 {
     Property *pp;
     //char *ip;
-    int i = 0;
 
     if (isblob)
     {
-        for (i = 0; i < cp->nprops; i++)
-        {
-            Property *pp = &cp->props[i];
-            if (!strcmp(pp->dev, dev) && (name == NULL || !strcmp(pp->name, name)))
-                return;
-        }
+        if (propBit(findPropIdx(dev, name, 0), PS_CLIENT, cp - clinfo))
+            return;
     }
     /* no dups */
     else if (!findClDevice(cp, dev, name))
@@ -2060,9 +3269,158 @@ static void addClDevice(ClInfo *cp, const char *dev, const char *name, int isblo
     strncpy (ip, name, MAXINDINAME-1);
         ip[MAXINDINAME-1] = '\0';*/
 
-    strncpy(pp->dev, dev, MAXINDIDEVICE);
-    strncpy(pp->name, name, MAXINDINAME);
+    strncpy(pp->dev, dev, MAXINDIDEVICE - 1);
+    pp->dev[MAXINDIDEVICE - 1] = '\0';
+    strncpy(pp->name, name, MAXINDINAME - 1);
+    pp->name[MAXINDINAME - 1] = '\0';
     pp->blob = B_NEVER;
+    idxClProp(cp, pp, 1);
+}
+
+/* return the index entry for dev/name, creating it if add, else NULL if none.
+ * name "" stands for all of dev.
+ */
+static PropIdx *findPropIdx(const char *dev, const char *name, int add)
+{
+    PropIdx *pi;
+    unsigned int h;
+    int i;
+
+    if (!propidx)
+    {
+        if (!add)
+            return (NULL);
+        npropidx = PROPIDXSIZ;
+        propidx  = (PropIdx **)calloc(npropidx, sizeof(PropIdx *));
+    }
+
+    h = hashProp(dev, name);
+    for (pi = propidx[h & (npropidx - 1)]; pi; pi = pi->next)
+        if (!strncmp(pi->dev, dev, MAXINDIDEVICE - 1) && !strncmp(pi->name, name, MAXINDINAME - 1))
+            return (pi);
+    if (!add)
+        return (NULL);
+
+    /* keep chains short */
+    if (npropent >= 2 * npropidx)
+    {
+        PropIdx **old = propidx;
+        int nold      = npropidx;
+
+        npropidx *= 2;
+        propidx = (PropIdx **)calloc(npropidx, sizeof(PropIdx *));
+        for (i = 0; i < nold; i++)
+        {
+            while ((pi = old[i]) != NULL)
+            {
+                PropIdx **bp = &propidx[hashProp(pi->dev, pi->name) & (npropidx - 1)];
+                old[i]       = pi->next;
+                pi->next     = *bp;
+                *bp          = pi;
+            }
+        }
+        free(old);
+    }
+
+    pi = (PropIdx *)calloc(1, sizeof(PropIdx));
+    if (!pi)
+    {
+        fprintf(stderr, "no memory for property index\n");
+        Bye();
+    }
+    strncpy(pi->dev, dev, MAXINDIDEVICE - 1);
+    strncpy(pi->name, name, MAXINDINAME - 1);
+    for (i = 0; i < NPROPSETS; i++)
+        pi->sets[i] = (unsigned long *)calloc(nidxw, sizeof(unsigned long));
+    pi->id                      = npropent;
+    pi->next                    = propidx[h & (npropidx - 1)];
+    propidx[h & (npropidx - 1)] = pi;
+    npropent++;
+
+    return (pi);
+}
+
+/* FNV-1a hash of dev/name, as much of each as we keep */
+static unsigned int hashProp(const char *dev, const char *name)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i = 0; i < MAXINDIDEVICE - 1 && dev[i]; i++)
+        h = (h ^ (unsigned char)dev[i]) * 16777619u;
+    h = (h ^ '/') * 16777619u;
+    for (i = 0; i < MAXINDINAME - 1 && name[i]; i++)
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+
+    return (h);
+}
+
+/* return 1 if slot is in the given set of pi, else 0, including if no pi */
+static int propBit(PropIdx *pi, int set, int slot)
+{
+    if (!pi || slot >= nidxw * (int)IDXBITS)
+        return (0);
+    return ((pi->sets[set][slot / IDXBITS] >> (slot % IDXBITS)) & 1);
+}
+
+/* put slot in or out of the given set of pi */
+static void setPropBit(PropIdx *pi, int set, int slot, int on)
+{
+    unsigned long bit = 1UL << (slot % IDXBITS);
+
+    /* widen every bitset to make room for slot */
+    if (slot >= nidxw * (int)IDXBITS)
+    {
+        int nw = slot / IDXBITS + 1;
+        int i, j;
+
+        for (i = 0; i < npropidx; i++)
+        {
+            PropIdx *p;
+
+            for (p = propidx[i]; p; p = p->next)
+            {
+                for (j = 0; j < NPROPSETS; j++)
+                {
+                    p->sets[j] = (unsigned long *)realloc(p->sets[j], nw * sizeof(unsigned long));
+                    memset(p->sets[j] + nidxw, 0, (nw - nidxw) * sizeof(unsigned long));
+                }
+            }
+        }
+        nidxw = nw;
+    }
+
+    if (on)
+        pi->sets[set][slot / IDXBITS] |= bit;
+    else
+        pi->sets[set][slot / IDXBITS] &= ~bit;
+}
+
+/* add client cp's interest in pp to the index, or remove it if !on */
+static void idxClProp(ClInfo *cp, Property *pp, int on)
+{
+    PropIdx *pi = findPropIdx(pp->dev, pp->name, 1);
+    int slot    = cp - clinfo;
+
+    setPropBit(pi, PS_CLIENT, slot, on);
+    setPropBit(pi, PS_CLBLOB, slot, on && pp->blob != B_NEVER);
+}
+
+/* add driver dp's snooping of sp to the index, or remove it if !on */
+static void idxSProp(DvrInfo *dp, Property *sp, int on)
+{
+    PropIdx *pi = findPropIdx(sp->dev, sp->name, 1);
+    int slot    = dp - dvrinfo;
+
+    setPropBit(pi, PS_SNOOP, slot, on);
+    setPropBit(pi, PS_SNBLOB, slot, on && sp->blob != B_NEVER);
+    setPropBit(pi, PS_SNONLY, slot, on && sp->blob == B_ONLY);
+}
+
+/* record in the index that dp serves dev, or no longer does if !on */
+static void idxDvrDev(DvrInfo *dp, const char *dev, int on)
+{
+    setPropBit(findPropIdx(dev, "", 1), PS_OWNER, dp - dvrinfo, on);
 }
 
 /* block to accept a new client arriving on lsocket.
@@ -2083,6 +3441,9 @@ static int newClSocket()
         Bye();
     }
 
+    /* an event for a slot reused meanwhile must not block us */
+    fcntl(cli_fd, F_SETFL, fcntl(cli_fd, F_GETFL) | O_NONBLOCK);
+
     /* ok */
     return (cli_fd);
 }
@@ -2118,10 +3479,14 @@ static void crackBLOBHandling(const char *dev, const char *name, const char *ena
     {
         Property *pp = &cp->props[i];
         if (!name[0])
+        {
             crackBLOB(enableBLOB, &pp->blob);
+            idxClProp(cp, pp, 1);
+        }
         else if (!strcmp(pp->dev, dev) && (!strcmp(pp->name, name)))
         {
             crackBLOB(enableBLOB, &pp->blob);
+            idxClProp(cp, pp, 1);
             return;
         }
     }
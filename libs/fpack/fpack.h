@@ -161,6 +161,8 @@ int fp_info_hdu (fitsfile *infptr);
 int fp_preflight (int argc, char *argv[], int unpack, fpstate *fpptr);
 int fp_loop (int argc, char *argv[], int unpack, char *output_filename, fpstate fpvar);
 int fp_pack (char *infits, char *outfits, fpstate fpvar, int *islossless);
+int fp_pack_data_to_data (const void *inbuf, size_t inlen, void **outbuf,
+    size_t *outlen, fpstate fpvar, int *islossless);
 int fp_unpack (char *infits, char *outfits, fpstate fpvar);
 int fp_test (char *infits, char *outfits, char *outfits2, fpstate fpvar);
 int fp_pack_hdu (fitsfile *infptr, fitsfile *outfptr, fpstate fpvar, 
@@ -951,6 +951,95 @@ int fp_pack (char *infits, char *outfits, fpstate fpvar, int *islossless)
     return(0);
 }
 
+/*--------------------------------------------------------------------------*/
+/* fp_pack_data_to_data compresses the FITS file held in inbuf into a new
+ * memory file, without touching the disk.  On success *outbuf is a malloc'd
+ * buffer of *outlen bytes which the caller must free.  Unlike fp_pack, errors
+ * are returned as a CFITSIO status instead of aborting the process.
+ */
+int fp_pack_data_to_data (const void *inbuf, size_t inlen, void **outbuf,
+    size_t *outlen, fpstate fpvar, int *islossless)
+{
+    fitsfile *infptr, *outfptr;
+    void	*inptr = (void *) inbuf;
+    size_t	insize = inlen;
+    int	stat=0, cstat=0;
+
+    *outbuf = NULL;
+    *outlen = 0;
+
+    fits_open_memfile (&infptr, "fpack", READONLY, &inptr, &insize, 0, NULL, &stat);
+    if (stat) return(stat);
+
+    /* grow one FITS block at a time so the final size is the file size */
+    *outlen = 2880;
+    *outbuf = malloc (*outlen);
+    if (! *outbuf) {
+        fits_close_file (infptr, &cstat);
+        *outlen = 0;
+        return(MEMORY_ALLOCATION);
+    }
+
+    fits_create_memfile (&outfptr, outbuf, outlen, 2880, realloc, &stat);
+    if (stat) {
+        fits_close_file (infptr, &cstat);
+        free (*outbuf);
+        *outbuf = NULL;
+        *outlen = 0;
+        return(stat);
+    }
+
+    while (! stat) {
+
+        /*  LOOP OVER EACH HDU */
+
+        fits_set_lossy_int (outfptr, fpvar.int_to_float, &stat);
+        fits_set_compression_type (outfptr, fpvar.comptype, &stat);
+        fits_set_tile_dim (outfptr, 6, fpvar.ntile, &stat);
+
+        if (fpvar.no_dither)
+            fits_set_quantize_method(outfptr, -1, &stat);
+        else
+            fits_set_quantize_method(outfptr, fpvar.dither_method, &stat);
+
+        fits_set_quantize_level (outfptr, fpvar.quantize_level, &stat);
+        fits_set_dither_offset(outfptr, fpvar.dither_offset, &stat);
+        fits_set_hcomp_scale (outfptr, fpvar.scale, &stat);
+        fits_set_hcomp_smooth (outfptr, fpvar.smooth, &stat);
+
+        fp_pack_hdu (infptr, outfptr, fpvar, islossless, &stat);
+
+        if (fpvar.do_checksums) {
+            fits_write_chksum (outfptr, &stat);
+        }
+
+        fits_movrel_hdu (infptr, 1, NULL, &stat);
+    }
+
+    if (stat == END_OF_FILE) stat = 0;
+
+    /* set checksum for case of newly created primary HDU	 */
+
+    if (fpvar.do_checksums) {
+        fits_movabs_hdu (outfptr, 1, NULL, &stat);
+        fits_write_chksum (outfptr, &stat);
+    }
+
+    /* closing keeps the memory, which now belongs to the caller */
+    cstat = 0;
+    fits_close_file (outfptr, &cstat);
+    fits_close_file (infptr, &cstat);
+    if (! stat) stat = cstat;
+
+    if (stat) {
+        free (*outbuf);
+        *outbuf = NULL;
+        *outlen = 0;
+    }
+
+    return(stat);
+}
+
 /*--------------------------------------------------------------------------*/
 /* fp_unpack assumes the output file does not exist
  */
@@ -444,6 +444,8 @@ void INDI::BaseClient::listenINDI()
 
     clear();
     lillp = newLilXML();
+    // We ask for binary BLOBs in enableBLOB
+    setXMLMaxBinlen(lillp, MAXXMLBINLEN);
 
     /* read from server, exit if find all requested properties */
     while (sConnected)
@@ -1054,10 +1056,11 @@ void INDI::BaseClient::setBLOBMode(BLOBHandling blobH, const char *dev, const ch
         bMode->blobMode = blobH;
     }
 
+    // We take BLOBs as raw bytes from servers that offer it, others ignore binary and keep sending base64
     if (prop != nullptr)
-        snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s' name='%s'>", dev, prop);
+        snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s' name='%s' binary='On'>", dev, prop);
     else
-        snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s'>", dev);
+        snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s' binary='On'>", dev);
 
     switch (blobH)
     {
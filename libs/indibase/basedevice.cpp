@@ -23,6 +23,7 @@
 #include "indicom.h"
 #include "indistandardproperty.h"
 #include "locale_compat.h"
+#include "zchunk.h"
 
 #include <cerrno>
 #include <cstdlib>
@@ -1126,14 +1127,52 @@ int BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle *root, char *errmsg)
 
                 blobEL->size    = blobSize;
                 int bloblen     = pcdatalenXMLEle(ep);
-                int blobBufferSize = 3 * bloblen / 4;
-                if (blobBufferSize != blobEL->bloblen)
-                    blobEL->blob    = static_cast<unsigned char *>(realloc(blobEL->blob, blobBufferSize));
-                blobEL->bloblen = from64tobits_fast(static_cast<char *>(blobEL->blob), pcdataXMLEle(ep), bloblen);
+
+                if (findXMLAtt(ep, "binlen"))
+                {
+                    // Raw bytes, as sent by servers that know we take binary BLOBs
+                    if (bloblen != blobEL->bloblen)
+                        blobEL->blob = static_cast<unsigned char *>(realloc(blobEL->blob, bloblen));
+                    memcpy(blobEL->blob, pcdataXMLEle(ep), bloblen);
+                    blobEL->bloblen = bloblen;
+                }
+                else
+                {
+                    int blobBufferSize = 3 * bloblen / 4;
+                    if (blobBufferSize != blobEL->bloblen)
+                        blobEL->blob    = static_cast<unsigned char *>(realloc(blobEL->blob, blobBufferSize));
+                    blobEL->bloblen = from64tobits_fast(static_cast<char *>(blobEL->blob), pcdataXMLEle(ep), bloblen);
+                }
 
                 strncpy(blobEL->format, valuXMLAtt(fa), MAXINDIFORMAT);
 
-                if (strstr(blobEL->format, ".z"))
+                size_t formatlen = strlen(blobEL->format);
+                size_t suffixlen = strlen(ZChunk::Suffix);
+                if (formatlen > suffixlen && !strcmp(blobEL->format + formatlen - suffixlen, ZChunk::Suffix))
+                {
+                    // 0 unless the header matches the stream, so a corrupt BLOB can not ask for a huge buffer
+                    uint64_t dataSize = ZChunk::rawSize(blobEL->blob, blobEL->bloblen);
+                    uint8_t *dataBuffer = static_cast<uint8_t *>(malloc(dataSize ? dataSize : 1));
+
+                    if (dataBuffer == nullptr)
+                    {
+                        strncpy(errmsg, "Unable to allocate memory for data buffer", MAXRBUF);
+                        return (-1);
+                    }
+
+                    if (!ZChunk::uncompress(blobEL->blob, blobEL->bloblen, dataBuffer, dataSize))
+                    {
+                        snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s chunked compression error", blobEL->bvp->device,
+                                 blobEL->bvp->name, blobEL->name);
+                        free(dataBuffer);
+                        return -1;
+                    }
+                    blobEL->format[formatlen - suffixlen] = '\0';
+                    blobEL->size = dataSize;
+                    free(blobEL->blob);
+                    blobEL->blob = dataBuffer;
+                }
+                else if (strstr(blobEL->format, ".z"))
                 {
                     blobEL->format[strlen(blobEL->format) - 2] = '\0';
                     uLongf dataSize = blobEL->size * sizeof(uint8_t);
@@ -0,0 +1,230 @@
+/*******************************************************************************
+ Asynchronous command queue for serial and network devices
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "commandqueue.h"
+
+#include "indicom.h"
+#include "indidevapi.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Connection
+{
+// Longest reply read up to a terminator
+static const int MAX_REPLY_SIZE = 1024;
+
+CommandQueue::CommandQueue()
+{
+}
+
+CommandQueue::~CommandQueue()
+{
+    stop();
+}
+
+bool CommandQueue::start(int fd)
+{
+    if (isRunning() || fd < 0)
+        return false;
+
+    if (pipe(m_Notify) != 0)
+        return false;
+
+    // Neither end may block: the I/O thread must not wait on a full pipe, nor the event loop on an empty one
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(m_Notify[i], F_SETFL, fcntl(m_Notify[i], F_GETFL) | O_NONBLOCK);
+        fcntl(m_Notify[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    m_NotifyCallbackID = IEAddCallback(m_Notify[0], &CommandQueue::deliverHelper, this);
+    if (m_NotifyCallbackID < 0)
+    {
+        // Nobody would deliver the replies, better not start at all
+        close(m_Notify[0]);
+        close(m_Notify[1]);
+        m_Notify[0] = m_Notify[1] = -1;
+        return false;
+    }
+
+    m_PortFD = fd;
+    m_Stop   = false;
+    m_Thread = std::thread(&CommandQueue::run, this);
+    return true;
+}
+
+void CommandQueue::stop()
+{
+    if (!isRunning())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stop = true;
+    }
+    m_Wake.notify_one();
+    m_Thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (auto &queue : m_Queue)
+            queue.clear();
+        m_Completions.clear();
+        tty_set_port_timeout_ms(m_PortFD, 0);
+        m_PortFD = -1;
+    }
+
+    IERmCallback(m_NotifyCallbackID);
+    m_NotifyCallbackID = -1;
+    close(m_Notify[0]);
+    close(m_Notify[1]);
+    m_Notify[0] = m_Notify[1] = -1;
+}
+
+void CommandQueue::enqueue(const Command &command)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (m_PortFD < 0 || m_Stop)
+            return;
+        m_Queue[command.priority].push_back(command);
+    }
+    m_Wake.notify_one();
+}
+
+void CommandQueue::clear(Priority priority)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Queue[priority].clear();
+}
+
+size_t CommandQueue::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    size_t count = 0;
+    for (const auto &queue : m_Queue)
+        count += queue.size();
+    return count;
+}
+
+void CommandQueue::run()
+{
+    for (;;)
+    {
+        Command command;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Wake.wait(lock, [this]
+            {
+                if (m_Stop)
+                    return true;
+                for (const auto &queue : m_Queue)
+                    if (!queue.empty())
+                        return true;
+                return false;
+            });
+
+            if (m_Stop)
+                return;
+
+            for (auto &queue : m_Queue)
+            {
+                if (!queue.empty())
+                {
+                    command = std::move(queue.front());
+                    queue.pop_front();
+                    break;
+                }
+            }
+        }
+
+        std::string reply;
+        int rc = exchange(command, reply);
+
+        if (!command.callback)
+            continue;
+
+        std::lock_guard<std::mutex> lock(m_Lock);
+        bool wasEmpty = m_Completions.empty();
+        m_Completions.push_back({ std::move(command.callback), rc, std::move(reply) });
+        // One byte per batch, the event loop takes every completion queued by then. The write can only fail on a
+        // full pipe, in which case the event loop is due to run anyway.
+        if (wasEmpty)
+        {
+            ssize_t nbytes = write(m_Notify[1], "", 1);
+            INDI_UNUSED(nbytes);
+        }
+    }
+}
+
+int CommandQueue::exchange(const Command &command, std::string &reply)
+{
+    int nbytes_written = 0, nbytes_read = 0, rc = TTY_OK;
+    // Whole seconds for the platforms without millisecond timeouts
+    int timeout = (command.timeoutMs + 999) / 1000;
+
+    tty_set_port_timeout_ms(m_PortFD, command.timeoutMs);
+
+    if ((rc = tty_write(m_PortFD, command.request.data(), command.request.size(), &nbytes_written)) != TTY_OK)
+        return rc;
+
+    if (command.terminator)
+    {
+        char buffer[MAX_REPLY_SIZE];
+        rc = tty_nread_section(m_PortFD, buffer, sizeof(buffer), command.terminator, timeout, &nbytes_read);
+        reply.assign(buffer, nbytes_read > 0 ? nbytes_read : 0);
+    }
+    else if (command.replyLength > 0)
+    {
+        reply.resize(command.replyLength);
+        rc = tty_read(m_PortFD, &reply[0], command.replyLength, timeout, &nbytes_read);
+        reply.resize(nbytes_read > 0 ? nbytes_read : 0);
+    }
+
+    return rc;
+}
+
+void CommandQueue::deliver()
+{
+    char drain[64];
+    while (read(m_Notify[0], drain, sizeof(drain)) > 0)
+        ;
+
+    std::deque<Completion> completions;
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        completions.swap(m_Completions);
+    }
+
+    for (auto &completion : completions)
+    {
+        // A callback may have stopped the queue, e.g. to disconnect on error
+        if (!isRunning())
+            break;
+        completion.callback(completion.rc, completion.reply);
+    }
+}
+
+void CommandQueue::deliverHelper(int fd, void *context)
+{
+    INDI_UNUSED(fd);
+    static_cast<CommandQueue *>(context)->deliver();
+}
+
+}
@@ -0,0 +1,150 @@
+/*******************************************************************************
+ Asynchronous command queue for serial and network devices
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Connection
+{
+/**
+ * @brief The CommandQueue class runs request/reply exchanges with a device on its own I/O thread, so a slow or silent
+ * device never blocks the INDI event loop.
+ *
+ * Commands are queued with a priority and sent one at a time, most urgent first and in order within a priority.
+ * Once the reply arrives, or the exchange fails, the command callback is called <b>on the event loop thread</b>, where
+ * it may update properties like any other driver code.
+ *
+ * A typical driver starts the queue in its handshake and stops it in Disconnect():
+ * \code{.cpp}
+ * bool MyMount::Handshake()
+ * {
+ *     return commandQueue.start(PortFD);
+ * }
+ *
+ * bool MyMount::ReadScopeStatus()
+ * {
+ *     Connection::CommandQueue::Command cmd;
+ *     cmd.request = ":GR#";
+ *     cmd.callback = [this](int rc, const std::string &reply)
+ *     {
+ *         if (rc == TTY_OK)
+ *             parseRA(reply);
+ *     };
+ *     commandQueue.enqueue(cmd);
+ *     return true;
+ * }
+ * \endcode
+ */
+class CommandQueue
+{
+    public:
+        /** Commands of a lower priority are only sent when no command of a higher priority waits */
+        enum Priority
+        {
+            PRIORITY_GUIDE = 0, /** Guide pulses, timing matters most */
+            PRIORITY_MOTION,    /** Slew, sync, abort and other user requests */
+            PRIORITY_POLL,      /** Status polling */
+            PRIORITY_COUNT
+        };
+
+        /**
+         * @brief Completion callback.
+         * @param rc TTY_OK, or the TTY_ERROR of the write or read that failed.
+         * @param reply the bytes read, including the terminator. Partial if the read failed.
+         */
+        typedef std::function<void(int rc, const std::string &reply)> Callback;
+
+        struct Command
+        {
+            /** Bytes to write, may be binary */
+            std::string request;
+            /** The reply ends with this byte. Set to 0 to read replyLength bytes instead. */
+            char terminator { '#' };
+            /** Bytes to read when there is no terminator. No reply is read if both are 0. */
+            size_t replyLength { 0 };
+            /** Longest wait for the device, in milliseconds, before the exchange fails with TTY_TIME_OUT */
+            int timeoutMs { 1000 };
+            Priority priority { PRIORITY_POLL };
+            /** Optional */
+            Callback callback;
+        };
+
+        CommandQueue();
+        ~CommandQueue();
+
+        /**
+         * @brief start Start the I/O thread on \e fd. The queue takes over \e fd until stop(): the driver must not read
+         * or write it directly meanwhile.
+         * @return false if the queue is already running or the event loop notification could not be set up.
+         */
+        bool start(int fd);
+
+        /**
+         * @brief stop Stop the I/O thread, waiting for the exchange in flight, and drop every pending command and
+         * undelivered reply without calling their callbacks. Call it before closing the port.
+         */
+        void stop();
+
+        bool isRunning() const
+        {
+            return m_Thread.joinable();
+        }
+
+        /** @brief enqueue Queue \e command. It is dropped if the queue is not running. */
+        void enqueue(const Command &command);
+
+        /** @brief clear Drop the commands still waiting at \e priority, e.g. stale polls after an abort. */
+        void clear(Priority priority);
+
+        /** @return commands queued but not sent yet */
+        size_t pending() const;
+
+    private:
+        struct Completion
+        {
+            Callback callback;
+            int rc;
+            std::string reply;
+        };
+
+        void run();
+        int exchange(const Command &command, std::string &reply);
+        void deliver();
+        static void deliverHelper(int fd, void *context);
+
+        int m_PortFD { -1 };
+        std::thread m_Thread;
+        bool m_Stop { false };
+
+        mutable std::mutex m_Lock;
+        std::condition_variable m_Wake;
+        std::deque<Command> m_Queue[PRIORITY_COUNT];
+        std::deque<Completion> m_Completions;
+
+        // The I/O thread writes a byte on m_Notify[1] for each batch of completions, the event loop watches m_Notify[0]
+        int m_Notify[2] { -1, -1 };
+        int m_NotifyCallbackID { -1 };
+};
+}
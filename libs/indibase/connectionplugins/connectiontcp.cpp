@@ -18,6 +18,7 @@
 
 #include "connectiontcp.h"
 
+#include "indicom.h"
 #include "indilogger.h"
 #include "indistandardproperty.h"
 
@@ -161,6 +162,9 @@ bool TCP::Connect()
         // Set the socket receiving and sending timeouts
         setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&ts, sizeof(struct timeval));
         setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (char *)&ts, sizeof(struct timeval));
+
+        // The descriptor may be reused, do not hand its new owner the settings or input of an old connection
+        tty_reset_port(sockfd);
     }
 
     PortFD = sockfd;
@@ -184,6 +188,7 @@ bool TCP::Disconnect()
 {
     if (sockfd > 0)
     {
+        tty_reset_port(sockfd);
         close(sockfd);
         sockfd = PortFD = -1;
     }
@@ -28,6 +28,7 @@
 
 #include "ttybase.h"
 
+#include "indicom.h"
 #include "locale_compat.h"
 
 #include <errno.h>
@@ -130,6 +131,9 @@ TTYBase::TTY_RESPONSE TTYBase::write(const uint8_t *buffer, uint32_t nbytes, uin
     int bytes_w     = 0;
     *nbytes_written = 0;
 
+    // A new command starts a new exchange, drop what is left of the last reply
+    tty_clear_read_buffer(m_PortFD);
+
     while (nbytes > 0)
     {
         bytes_w = ::write(m_PortFD, buffer + (*nbytes_written), nbytes);
@@ -176,13 +180,19 @@ TTYBase::TTY_RESPONSE TTYBase::read(uint8_t *buffer, uint32_t nbytes, uint8_t ti
 
     while (numBytesToRead > 0)
     {
-        if ((timeoutResponse = checkTimeout(timeout)))
-            return timeoutResponse;
+        // Bytes a section read took past its stop byte come first
+        bytesRead = tty_buffered_bytes(m_PortFD, reinterpret_cast<char *>(buffer + (*nbytes_read)), numBytesToRead);
+
+        if (bytesRead == 0)
+        {
+            if ((timeoutResponse = checkTimeout(timeout)))
+                return timeoutResponse;
 
-        bytesRead = ::read(m_PortFD, buffer + (*nbytes_read), numBytesToRead);
+            bytesRead = ::read(m_PortFD, buffer + (*nbytes_read), numBytesToRead);
 
-        if (bytesRead < 0)
-            return TTY_READ_ERROR;
+            if (bytesRead < 0)
+                return TTY_READ_ERROR;
+        }
 
         DEBUGFDEVICE(m_DriverName, m_DebugChannel, "%d bytes read and %d bytes remaining...", bytesRead, numBytesToRead - bytesRead);
         for (uint32_t i = *nbytes_read; i < (*nbytes_read + bytesRead); i++)
@@ -207,34 +217,20 @@ TTYBase::TTY_RESPONSE TTYBase::readSection(uint8_t *buffer, uint32_t nsize, uint
         return TTY_ERRNO;
 
     int bytesRead = 0;
-    TTY_RESPONSE timeoutResponse = TTY_OK;
     *nbytes_read  = 0;
     memset(buffer, 0, nsize);
 
-    uint8_t *read_char = nullptr;
-
     DEBUGFDEVICE(m_DriverName, m_DebugChannel, "%s: Request to read until stop char '%#02X' with %d timeout for m_PortFD %d", __FUNCTION__, stop_byte, timeout, m_PortFD);
 
-    for (;;)
-    {
-        if ((timeoutResponse = checkTimeout(timeout)))
-            return timeoutResponse;
+    // Shares the read buffer of the fd with the indicom functions
+    TTY_RESPONSE response = static_cast<TTY_RESPONSE>(tty_buffered_read_section(m_PortFD, reinterpret_cast<char *>(buffer), nsize,
+                            static_cast<char>(stop_byte), timeout, 0, &bytesRead));
+    *nbytes_read = bytesRead;
 
-        read_char = reinterpret_cast<uint8_t*>(buffer + *nbytes_read);
-        bytesRead = ::read(m_PortFD, read_char, 1);
+    for (uint32_t i = 0; i < *nbytes_read; i++)
+        DEBUGFDEVICE(m_DriverName, m_DebugChannel, "%s: buffer[%d]=%#X (%c)", __FUNCTION__, i, buffer[i], buffer[i]);
 
-        if (bytesRead < 0)
-            return TTY_READ_ERROR;
-
-        DEBUGFDEVICE(m_DriverName, m_DebugChannel, "%s: buffer[%d]=%#X (%c)", __FUNCTION__, (*nbytes_read), *read_char, *read_char);
-
-        (*nbytes_read)++;
-
-        if (*read_char == stop_byte)
-            return TTY_OK;
-        else if (*nbytes_read >= nsize)
-            return TTY_OVERFLOW;
-    }
+    return response;
 
 #endif
 }
@@ -478,6 +474,7 @@ TTYBase::TTY_RESPONSE TTYBase::connect(const char *device, uint32_t bit_rate, ui
 #endif
 
     m_PortFD = t_fd;
+    tty_reset_port(m_PortFD);
     /* return success */
     return TTY_OK;
 
@@ -671,6 +668,7 @@ TTYBase::TTY_RESPONSE TTYBase::connect(const char *device, uint32_t bit_rate, ui
     }
 
     m_PortFD = t_fd;
+    tty_reset_port(m_PortFD);
     /* return success */
     return TTY_OK;
 #endif
@@ -688,6 +686,7 @@ TTYBase::TTY_RESPONSE TTYBase::disconnect()
     return TTY_ERRNO;
 #else
     tcflush(m_PortFD, TCIOFLUSH);
+    tty_reset_port(m_PortFD);
     int err = close(m_PortFD);
 
     if (err != 0)
@@ -32,6 +32,7 @@
 #include "fpack/fpack.h"
 #include "indicom.h"
 #include "stream/streammanager.h"
+#include "zchunk.h"
 #include "locale_compat.h"
 
 #include <fitsio.h>
@@ -56,6 +57,9 @@ const char * IMAGE_INFO_TAB     = "Image Info";
 const char * GUIDE_HEAD_TAB     = "Guider Head";
 //const char * RAPIDGUIDE_TAB     = "Rapid Guide";
 
+// 2880 byte blocks reserved for the FITS header when sizing the chip FITS buffer, room for 144 keywords
+static const size_t FITS_HEADER_BLOCKS = 4;
+
 #ifdef HAVE_WEBSOCKET
 uint16_t INDIWSServer::m_global_port = 11623;
 #endif
@@ -215,7 +219,8 @@ bool CCD::initProperties()
     // Primary CCD Compression Options
     IUFillSwitch(&PrimaryCCD.CompressS[0], "CCD_COMPRESS", "Compress", ISS_OFF);
     IUFillSwitch(&PrimaryCCD.CompressS[1], "CCD_RAW", "Raw", ISS_ON);
-    IUFillSwitchVector(&PrimaryCCD.CompressSP, PrimaryCCD.CompressS, 2, getDeviceName(), "CCD_COMPRESSION", "Image",
+    IUFillSwitch(&PrimaryCCD.CompressS[2], "CCD_COMPRESS_FAST", "Fast compress", ISS_OFF);
+    IUFillSwitchVector(&PrimaryCCD.CompressSP, PrimaryCCD.CompressS, 3, getDeviceName(), "CCD_COMPRESSION", "Image",
                        IMAGE_SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
     PrimaryCCD.SendCompressed = false;
 
@@ -304,7 +309,8 @@ bool CCD::initProperties()
 
     IUFillSwitch(&GuideCCD.CompressS[0], "GUIDER_COMPRESS", "Compress", ISS_OFF);
     IUFillSwitch(&GuideCCD.CompressS[1], "GUIDER_RAW", "Raw", ISS_ON);
-    IUFillSwitchVector(&GuideCCD.CompressSP, GuideCCD.CompressS, 2, getDeviceName(), "GUIDER_COMPRESSION", "Image",
+    IUFillSwitch(&GuideCCD.CompressS[2], "GUIDER_COMPRESS_FAST", "Fast compress", ISS_OFF);
+    IUFillSwitchVector(&GuideCCD.CompressSP, GuideCCD.CompressS, 3, getDeviceName(), "GUIDER_COMPRESSION", "Image",
                        GUIDE_HEAD_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
     GuideCCD.SendCompressed = false;
 
@@ -1413,14 +1419,9 @@ bool CCD::ISNewSwitch(const char * dev, const char * name, ISState * states, cha
             PrimaryCCD.CompressSP.s = IPS_OK;
             IDSetSwitch(&PrimaryCCD.CompressSP, nullptr);
 
-            if (PrimaryCCD.CompressS[0].s == ISS_ON)
-            {
-                PrimaryCCD.SendCompressed = true;
-            }
-            else
-            {
-                PrimaryCCD.SendCompressed = false;
-            }
+            // Fast compression is chunked zlib, which only newer clients can decode
+            PrimaryCCD.SendChunked    = (PrimaryCCD.CompressS[2].s == ISS_ON);
+            PrimaryCCD.SendCompressed = (PrimaryCCD.CompressS[0].s == ISS_ON || PrimaryCCD.SendChunked);
             return true;
         }
 
@@ -1431,14 +1432,9 @@ bool CCD::ISNewSwitch(const char * dev, const char * name, ISState * states, cha
             GuideCCD.CompressSP.s = IPS_OK;
             IDSetSwitch(&GuideCCD.CompressSP, nullptr);
 
-            if (GuideCCD.CompressS[0].s == ISS_ON)
-            {
-                GuideCCD.SendCompressed = true;
-            }
-            else
-            {
-                GuideCCD.SendCompressed = false;
-            }
+            // Fast compression is chunked zlib, which only newer clients can decode
+            GuideCCD.SendChunked    = (GuideCCD.CompressS[2].s == ISS_ON);
+            GuideCCD.SendCompressed = (GuideCCD.CompressS[0].s == ISS_ON || GuideCCD.SendChunked);
             return true;
         }
 
@@ -1937,10 +1933,18 @@ bool CCD::ExposureComplete(CCDChip * targetChip)
 bool CCD::ExposureCompletePrivate(CCDChip * targetChip)
 {
     if(HasDSP()) {
-        uint8_t* buf = static_cast<uint8_t*>(malloc(targetChip->getFrameBufferSize()));
-        memcpy(buf, targetChip->getFrameBuffer(), targetChip->getFrameBufferSize());
-        DSP->processBLOB(buf, 2, new int[2]{ targetChip->getSubW() / targetChip->getBinX(), targetChip->getSubH() / targetChip->getBinY() }, targetChip->getBPP());
-        free(buf);
+        std::unique_lock<std::mutex> guard(ccdBufferLock);
+        if (targetChip->DSPBufferSize < targetChip->getFrameBufferSize())
+        {
+            delete [] targetChip->DSPBuffer;
+            targetChip->DSPBuffer     = new uint8_t[targetChip->getFrameBufferSize()];
+            targetChip->DSPBufferSize = targetChip->getFrameBufferSize();
+        }
+        memcpy(targetChip->DSPBuffer, targetChip->getFrameBuffer(), targetChip->getFrameBufferSize());
+        // The plugins keep the sizes pointer, so it lives with the chip
+        targetChip->DSPSizes[0] = targetChip->getSubW() / targetChip->getBinX();
+        targetChip->DSPSizes[1] = targetChip->getSubH() / targetChip->getBinY();
+        DSP->processBLOB(targetChip->DSPBuffer, 2, targetChip->DSPSizes, targetChip->getBPP());
     }
 #ifdef WITH_EXPOSURE_LOOPING
     // If looping is on, let's immediately take another capture
@@ -2444,8 +2448,7 @@ bool CCD::ExposureCompletePrivate(CCDChip * targetChip)
     {
         if (!strcmp(targetChip->getImageExtension(), "fits"))
         {
-            void * memptr;
-            size_t memsize;
+            LONGLONG fitssize = 0;
             int img_type  = 0;
             int byte_type = 0;
             int status    = 0;
@@ -2498,22 +2501,28 @@ bool CCD::ExposureCompletePrivate(CCDChip * targetChip)
             std::unique_lock<std::mutex> guard(ccdBufferLock);
 
             //  Now we have to send fits format data to the client
-            memsize = 5760;
-            memptr  = malloc(memsize);
-            if (!memptr)
+            //  The chip keeps the buffer between exposures. Size it for the data plus a few header blocks up front so cfitsio
+            //  does not have to grow it 2880 bytes at a time.
+            size_t fitsneeded = ((static_cast<size_t>(nelements) * targetChip->getBPP() / 8 + 2879) / 2880 + FITS_HEADER_BLOCKS) * 2880;
+            if (targetChip->FITSBufferSize < fitsneeded)
             {
-                LOGF_ERROR("Error: failed to allocate memory: %lu", memsize);
-                return false;
+                void *buffer = realloc(targetChip->FITSBuffer, fitsneeded);
+                if (!buffer)
+                {
+                    LOGF_ERROR("Error: failed to allocate memory: %lu", fitsneeded);
+                    return false;
+                }
+                targetChip->FITSBuffer     = buffer;
+                targetChip->FITSBufferSize = fitsneeded;
             }
 
-            fits_create_memfile(&fptr, &memptr, &memsize, 2880, realloc, &status);
+            fits_create_memfile(&fptr, &targetChip->FITSBuffer, &targetChip->FITSBufferSize, 2880, realloc, &status);
 
             if (status)
             {
                 fits_report_error(stderr, status); /* print out any error messages */
                 fits_get_errstatus(status, error_status);
                 fits_close_file(fptr, &status);
-                free(memptr);
                 LOGF_ERROR("FITS Error: %s", error_status);
                 return false;
             }
@@ -2525,7 +2534,6 @@ bool CCD::ExposureCompletePrivate(CCDChip * targetChip)
                 fits_report_error(stderr, status); /* print out any error messages */
                 fits_get_errstatus(status, error_status);
                 fits_close_file(fptr, &status);
-                free(memptr);
                 LOGF_ERROR("FITS Error: %s", error_status);
                 return false;
             }
@@ -2534,21 +2542,21 @@ bool CCD::ExposureCompletePrivate(CCDChip * targetChip)
 
             fits_write_img(fptr, byte_type, 1, nelements, targetChip->getFrameBuffer(), &status);
 
+            // The buffer is usually larger than the file, the end of the data unit is where the file ends
+            fits_get_hduaddrll(fptr, nullptr, nullptr, &fitssize, &status);
+
             if (status)
             {
                 fits_report_error(stderr, status); /* print out any error messages */
                 fits_get_errstatus(status, error_status);
                 fits_close_file(fptr, &status);
-                free(memptr);
                 LOGF_ERROR("FITS Error: %s", error_status);
                 return false;
             }
 
             fits_close_file(fptr, &status);
 
-            bool rc = uploadFile(targetChip, memptr, memsize, sendImage, saveImage /*, useSolver*/);
-
-            free(memptr);
+            bool rc = uploadFile(targetChip, targetChip->FITSBuffer, fitssize, sendImage, saveImage /*, useSolver*/);
 
             guard.unlock();
 
@@ -2643,6 +2651,8 @@ bool CCD::uploadFile(CCDChip * targetChip, const void * fitsData, size_t totalBy
                      bool saveImage /*, bool useSolver*/)
 {
     uint8_t * compressedData = nullptr;
+    void * packedData = nullptr;
+    std::vector<uint8_t> chunkedData;
 
     DEBUGF(Logger::DBG_DEBUG, "Uploading file. Ext: %s, Size: %d, sendImage? %s, saveImage? %s",
            targetChip->getImageExtension(), totalBytes, sendImage ? "Yes" : "No", saveImage ? "Yes" : "No");
@@ -2710,77 +2720,38 @@ bool CCD::uploadFile(CCDChip * targetChip, const void * fitsData, size_t totalBy
 
     if (targetChip->SendCompressed)
     {
-        if (!strcmp(targetChip->getImageExtension(), "fits"))
+        if (targetChip->SendChunked)
         {
-            int  compressedBytes = 0;
-            char filename[MAXRBUF] = {0};
-            strncpy(filename, "/tmp/compressedfits.fits", MAXRBUF);
-
-            FILE * fp = fopen(filename, "w");
-            if (fp == nullptr)
+            if (!ZChunk::compress(fitsData, totalBytes, chunkedData, Z_BEST_SPEED))
             {
-                LOGF_ERROR("Unable to save temporary image file: %s", strerror(errno));
+                LOG_ERROR("Error: Failed to compress image");
                 return false;
             }
 
-            int n = 0;
-            for (int nr = 0; nr < static_cast<int>(totalBytes); nr += n)
-                n = fwrite(static_cast<const uint8_t *>(fitsData) + nr, 1, totalBytes - nr, fp);
-            fclose(fp);
-
-            fpstate	fpvar;
-            std::vector<std::string> arguments = {"fpack", filename};
-            std::vector<char *> arglist;
-            for (const auto &arg : arguments)
-                arglist.push_back(const_cast<char *>(arg.data()));
-            arglist.push_back(nullptr);
-
-            int argc = arglist.size() - 1;
-            char ** argv = arglist.data();
-
-            // TODO: Check for errors
-            fp_init (&fpvar);
-            fp_get_param (argc, argv, &fpvar);
-            fp_preflight (argc, argv, FPACK, &fpvar);
-            fp_loop (argc, argv, FPACK, filename, fpvar);
-
-            // Remove temporary file from disk
-            remove(filename);
-
-            // Add .fz
-            strncat(filename, ".fz", 3);
-
-            struct stat st;
-            stat(filename, &st);
-            compressedBytes = st.st_size;
-
-            compressedData = new uint8_t[compressedBytes];
-
-            if (compressedData == nullptr)
-            {
-                LOG_ERROR("Ran out of memory compressing image.");
-                return false;
-            }
+            targetChip->FitsB.blob    = chunkedData.data();
+            targetChip->FitsB.bloblen = chunkedData.size();
+            snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s%s", targetChip->getImageExtension(), ZChunk::Suffix);
+        }
+        else if (!strcmp(targetChip->getImageExtension(), "fits"))
+        {
+            // Tile compress the in-memory FITS straight into another memory file
+            fpstate fpvar;
+            int islossless = 1;
+            size_t packedBytes = 0;
+            fp_init(&fpvar);
 
-            fp = fopen(filename, "r");
-            if (fp == nullptr)
+            int status = fp_pack_data_to_data(fitsData, totalBytes, &packedData, &packedBytes, fpvar, &islossless);
+            if (status)
             {
-                LOGF_ERROR("Unable to open temporary image file: %s", strerror(errno));
-                delete [] compressedData;
+                char error_status[MAXRBUF];
+                fits_get_errstatus(status, error_status);
+                LOGF_ERROR("Error compressing image: %s", error_status);
                 return false;
             }
 
-            n = 0;
-            for (int nr = 0; nr < compressedBytes; nr += n)
-                n = fread(compressedData + nr, 1, compressedBytes - nr, fp);
-            fclose(fp);
-
-            // Remove compressed temporary file from disk
-            remove(filename);
-
-            targetChip->FitsB.blob    = compressedData;
-            targetChip->FitsB.bloblen = compressedBytes;
-            totalBytes = compressedBytes;
+            targetChip->FitsB.blob    = packedData;
+            targetChip->FitsB.bloblen = packedBytes;
+            totalBytes = packedBytes;
             snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s.fz", targetChip->getImageExtension());
         }
         else
@@ -2848,6 +2819,7 @@ bool CCD::uploadFile(CCDChip * targetChip, const void * fitsData, size_t totalBy
 
     if (compressedData)
         delete [] compressedData;
+    free(packedData);
 
     DEBUG(Logger::DBG_DEBUG, "Upload complete");
 
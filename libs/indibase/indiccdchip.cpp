@@ -19,6 +19,7 @@
 #include "indidevapi.h"
 #include "locale_compat.h"
 
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 
@@ -48,6 +49,9 @@ CCDChip::~CCDChip()
 {
     delete [] RawFrame;
     delete[] BinFrame;
+    delete [] DSPBuffer;
+    // Allocated by cfitsio through realloc
+    free(FITSBuffer);
 }
 
 void CCDChip::setFrameType(CCD_FRAME type)
@@ -21,6 +21,7 @@
 #include "indiapi.h"
 
 #include <sys/time.h>
+#include <stddef.h>
 #include <stdint.h>
 
 namespace INDI
@@ -409,7 +410,15 @@ class CCDChip
         uint8_t *RawFrame = nullptr;
         uint8_t *BinFrame = nullptr;
         int RawFrameSize = 0;
+        /// FITS image of the last exposure. Kept, and grown by cfitsio if needed, so exposure loops do not allocate.
+        void *FITSBuffer = nullptr;
+        size_t FITSBufferSize = 0;
+        /// Copy of the frame handed to the DSP plugins, kept between exposures like the FITS buffer
+        uint8_t *DSPBuffer = nullptr;
+        int DSPBufferSize = 0;
+        int DSPSizes[2] = { 0, 0 };
         bool SendCompressed = false;
+        bool SendChunked = false;
         CCD_FRAME FrameType;
         double exposureDuration;
         timeval startExposureTime;
@@ -436,7 +445,7 @@ class CCDChip
         ISwitch FrameTypeS[5];
         ISwitchVectorProperty FrameTypeSP;
 
-        ISwitch CompressS[2];
+        ISwitch CompressS[3];
         ISwitchVectorProperty CompressSP;
 
         IBLOB FitsB;
@@ -21,10 +21,16 @@
 #include "indilogger.h"
 
 #include <dirent.h>
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <thread>
 #include <sys/stat.h>
 
 namespace INDI
@@ -65,6 +71,83 @@ std::string Logger::logFile_;
 unsigned int Logger::nDevices    = 0;
 unsigned int Logger::customLevel = 4;
 
+/*
+ * Lines on their way to the log file. A bounded multi producer queue after D. Vyukov: the sequence of each slot tells
+ * whether it is free for the producer at that position or filled for the writer, so threads logging at the same time
+ * never wait on each other nor on the disk. A full queue drops the line and counts it.
+ */
+struct Logger::FileQueue
+{
+    static const size_t capacity = 1024;
+    static const size_t lineSize = 512;
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        size_t length;
+        char text[lineSize];
+    };
+
+    Slot slots[capacity];
+    std::atomic<size_t> head { 0 }; // next slot to fill
+    std::atomic<size_t> tail { 0 }; // next slot to write, only moved by writeQueuedLines()
+    std::atomic<uint64_t> dropped { 0 };
+    std::atomic<bool> wakeRequested { false }; // so a busy writer is not woken again for every line
+    uint64_t reported { 0 }; // drops already noted in the file
+    std::string batch;
+
+    std::mutex lock; // held while writing out_
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    std::thread writer;
+    bool stop { false };
+    bool parked { false }; // file logging is off, nothing to write until it is on again
+    std::atomic<uint64_t> rounds { 0 };
+
+    FileQueue()
+    {
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Wake the writer thread before its next round
+    void requestWake()
+    {
+        if (!wakeRequested.load(std::memory_order_relaxed) && !wakeRequested.exchange(true))
+            wake.notify_one();
+    }
+
+    // Claim the next slot, nullptr if the queue is full
+    Slot *reserve(size_t &pos)
+    {
+        pos = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot *slot    = &slots[pos % capacity];
+            intptr_t diff = static_cast<intptr_t>(slot->sequence.load(std::memory_order_acquire)) -
+                            static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return slot;
+            }
+            else if (diff < 0)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Hand the slot claimed at pos over to the writer
+    void commit(Slot *slot, size_t pos)
+    {
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+};
+
 // Create dir recursively
 static int _mkdir(const char *dir, mode_t mode)
 {
@@ -301,17 +384,156 @@ Logger::Logger() : configured_(false)
     gettimeofday(&initialTime_, nullptr);
 }
 
+void Logger::startFileWriter()
+{
+    if (fileQueue_ != nullptr)
+        return;
+
+    fileQueue_         = new FileQueue;
+    fileQueue_->writer = std::thread(&Logger::fileWriter, this);
+    atexit(&Logger::flushAtExit);
+}
+
+void Logger::fileWriter()
+{
+    std::unique_lock<std::mutex> wakeLock(fileQueue_->wakeLock);
+    while (!fileQueue_->stop)
+    {
+        if (fileQueue_->parked)
+        {
+            fileQueue_->wake.wait(wakeLock);
+            continue;
+        }
+
+        fileQueue_->wake.wait_for(wakeLock, std::chrono::milliseconds(100));
+        fileQueue_->wakeRequested = false;
+        fileQueue_->rounds++;
+
+        std::lock_guard<std::mutex> lock(fileQueue_->lock);
+        writeQueuedLines();
+    }
+}
+
+void Logger::writeQueuedLines()
+{
+    FileQueue *queue = fileQueue_;
+    size_t tail      = queue->tail.load(std::memory_order_relaxed);
+
+    queue->batch.clear();
+    for (;;)
+    {
+        FileQueue::Slot &slot = queue->slots[tail % FileQueue::capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+            break;
+
+        queue->batch.append(slot.text, slot.length);
+        slot.sequence.store(tail + FileQueue::capacity, std::memory_order_release);
+        tail++;
+    }
+    queue->tail.store(tail, std::memory_order_relaxed);
+
+    uint64_t dropped = queue->dropped.load(std::memory_order_relaxed);
+    if (dropped != queue->reported)
+    {
+        queue->batch += std::string(Tags[rank(DBG_WARNING)]) + "\t: " + std::to_string(dropped - queue->reported) +
+                        " messages dropped, the log file could not keep up\n";
+        queue->reported = dropped;
+    }
+
+    // One write and one flush per batch, instead of one per line
+    if (!queue->batch.empty() && out_.is_open())
+    {
+        out_.write(queue->batch.data(), queue->batch.size());
+        out_.flush();
+    }
+}
+
+void Logger::flush()
+{
+    if (fileQueue_ == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(fileQueue_->lock);
+    writeQueuedLines();
+}
+
+void Logger::stopFileWriter()
+{
+    if (fileQueue_ == nullptr || !fileQueue_->writer.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> wakeLock(fileQueue_->wakeLock);
+        fileQueue_->stop = true;
+    }
+    fileQueue_->wake.notify_one();
+    fileQueue_->writer.join();
+}
+
+void Logger::parkFileWriter(bool park)
+{
+    {
+        std::lock_guard<std::mutex> wakeLock(fileQueue_->wakeLock);
+        fileQueue_->parked = park;
+    }
+    fileQueue_->wake.notify_one();
+}
+
+// The writer thread must be gone before the process is, or it could be writing while the stream is destroyed
+void Logger::flushAtExit()
+{
+    if (m_ != nullptr)
+    {
+        m_->stopFileWriter();
+        m_->flush();
+    }
+}
+
+std::unique_lock<std::mutex> Logger::holdFileWriter()
+{
+    if (fileQueue_ == nullptr)
+        return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(fileQueue_->lock);
+}
+
+uint64_t Logger::fileWriterRounds() const
+{
+    return fileQueue_ ? fileQueue_->rounds.load() : 0;
+}
+
+uint64_t Logger::droppedMessages() const
+{
+    return fileQueue_ ? fileQueue_->dropped.load(std::memory_order_relaxed) : 0;
+}
+
 void Logger::configure(const std::string &outputFile, const loggerConf configuration, const int fileVerbosityLevel,
                        const int screenVerbosityLevel)
 {
     Logger::lock();
 
+    if (configuration & file_on)
+        startFileWriter();
+
+    // The writer sleeps for good while file logging is off. Not under the file queue lock, the writer takes it
+    // while holding its wake lock.
+    if (fileQueue_ != nullptr)
+        parkFileWriter(!(configuration & file_on));
+
+    // The writer thread must not touch the stream while it is reopened
+    std::unique_lock<std::mutex> fileLock;
+    if (fileQueue_ != nullptr)
+        fileLock = std::unique_lock<std::mutex>(fileQueue_->lock);
+
     fileVerbosityLevel_   = fileVerbosityLevel;
     screenVerbosityLevel_ = screenVerbosityLevel;
     rememberscreenlevel_  = screenVerbosityLevel_;
-    // Close the old stream, if needed
+    // Close the old stream, if needed, after writing what was queued for it
     if (configuration_ & file_on)
+    {
+        if (fileQueue_ != nullptr)
+            writeQueuedLines();
         out_.close();
+    }
 
     // Compute a new file name, if needed
     if (outputFile != logFile_)
@@ -349,6 +571,14 @@ void Logger::configure(const std::string &outputFile, const loggerConf configura
 
 Logger::~Logger()
 {
+    if (fileQueue_ != nullptr)
+    {
+        stopFileWriter();
+        flush();
+        delete fileQueue_;
+        fileQueue_ = nullptr;
+    }
+
     Logger::lock();
     if (configuration_ & file_on)
         out_.close();
@@ -400,12 +630,15 @@ void Logger::print(const char *devicename, const unsigned int verbosityLevel, co
 
     INDI_UNUSED(file);
     INDI_UNUSED(line);
-    bool filelog   = (verbosityLevel & fileVerbosityLevel_) != 0;
-    bool screenlog = (verbosityLevel & screenVerbosityLevel_) != 0;
+    bool filelog   = (configuration_ & file_on) && (verbosityLevel & fileVerbosityLevel_) != 0 && fileQueue_ != nullptr;
+    bool screenlog = (configuration_ & screen_on) && (verbosityLevel & screenVerbosityLevel_) != 0;
+
+    // Nobody wants it, do not even format it
+    if (configured_ && !filelog && !screenlog)
+        return;
 
     va_list ap;
     char msg[257];
-    char usec[7];
 
     msg[256] = '\0';
     va_start(ap, message);
@@ -418,30 +651,40 @@ void Logger::print(const char *devicename, const unsigned int verbosityLevel, co
         std::cerr << msg << std::endl;
         return;
     }
-    struct timeval currentTime, resTime;
-    usec[6] = '\0';
-    gettimeofday(&currentTime, nullptr);
-    timersub(&currentTime, &initialTime_, &resTime);
-#if defined(__APPLE__)
-    snprintf(usec, 7, "%06d", resTime.tv_usec);
-#else
-    snprintf(usec, 7, "%06ld", resTime.tv_usec);
-#endif
-    Logger::lock();
 
-    if ((configuration_ & file_on) && filelog)
+    if (filelog)
     {
-        if (nDevices == 1)
-            out_ << Tags[rank(verbosityLevel)] << "\t" << (resTime.tv_sec) << "." << (usec) << " sec"
-                 << "\t: " << msg << std::endl;
-        else
-            out_ << Tags[rank(verbosityLevel)] << "\t" << (resTime.tv_sec) << "." << (usec) << " sec"
-                 << "\t: [" << devicename << "] " << msg << std::endl;
+        struct timeval currentTime, resTime;
+        gettimeofday(&currentTime, nullptr);
+        timersub(&currentTime, &initialTime_, &resTime);
+
+        size_t pos;
+        FileQueue::Slot *slot = fileQueue_->reserve(pos);
+        if (slot != nullptr)
+        {
+            int length;
+            if (nDevices == 1)
+                length = snprintf(slot->text, FileQueue::lineSize, "%s\t%ld.%06ld sec\t: %s\n",
+                                  Tags[rank(verbosityLevel)], static_cast<long>(resTime.tv_sec),
+                                  static_cast<long>(resTime.tv_usec), msg);
+            else
+                length = snprintf(slot->text, FileQueue::lineSize, "%s\t%ld.%06ld sec\t: [%s] %s\n",
+                                  Tags[rank(verbosityLevel)], static_cast<long>(resTime.tv_sec),
+                                  static_cast<long>(resTime.tv_usec), devicename, msg);
+            slot->length = std::min(static_cast<size_t>(std::max(length, 0)), FileQueue::lineSize - 1);
+            // A truncated line still ends the line
+            if (slot->length == FileQueue::lineSize - 1)
+                slot->text[slot->length - 1] = '\n';
+            fileQueue_->commit(slot, pos);
+
+            // Wake the writer early for errors and when the queue fills up, otherwise it comes by every 100 ms
+            if (verbosityLevel == DBG_ERROR ||
+                    pos + 1 - fileQueue_->tail.load(std::memory_order_relaxed) >= FileQueue::capacity / 2)
+                fileQueue_->requestWake();
+        }
     }
 
-    if ((configuration_ & screen_on) && screenlog)
+    if (screenlog)
         IDMessage(devicename, "[%s] %s", Tags[rank(verbosityLevel)], msg);
-
-    Logger::unlock();
 }
 }
@@ -24,7 +24,9 @@
 #include "defaultdevice.h"
 
 #include <stdarg.h>
+#include <cstdint>
 #include <fstream>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <sstream>
@@ -107,6 +109,10 @@ namespace INDI
  *
  * The default \e active debug levels are Error, Warning, and Session. Driver Debug can be enabled by the client.
  *
+ * Messages no output wants are dropped before they are formatted. Messages to the log file are queued and written
+ * in batches by a background thread, so logging costs the calling thread no disk I/O. If the queue is full the message
+ * is dropped and counted, see droppedMessages().
+ *
  * To add a new debug level, call addDebugLevel(). You can add an additional 4 custom debug/logging levels.
  *
  * Check INDI Tutorial two for an example simple implementation.
@@ -151,8 +157,11 @@ class Logger
      */
     static loggerConf_ configuration_;
 
-    /// Stream used when logging on a file
+    /// Stream used when logging on a file, only written with the file queue lock held
     std::ofstream out_;
+    /// Lines waiting to be written to out_, see indilogger.cpp
+    struct FileQueue;
+    FileQueue *fileQueue_ { nullptr };
     /// Initial time (used to print relative times)
     struct timeval initialTime_;
     /// Verbosity threshold for files
@@ -183,6 +192,23 @@ class Logger
     /** Method to unlock in case of multithreading */
     inline static void unlock();
 
+    /** Start the file writer thread, if not running yet */
+    void startFileWriter();
+    /** Body of the file writer thread */
+    void fileWriter();
+    /** Write the queued lines to out_. The file queue lock must be held. */
+    void writeQueuedLines();
+    /** Stop and join the file writer thread, if running. Queued lines stay queued. */
+    void stopFileWriter();
+    /** Let the file writer thread sleep until unparked, or wake it up again */
+    void parkFileWriter(bool park);
+    static void flushAtExit();
+    /** Keep the file writer thread from writing anything while the lock is held, for tests */
+    std::unique_lock<std::mutex> holdFileWriter();
+    /** Number of times the file writer thread looked for lines, for tests */
+    uint64_t fileWriterRounds() const;
+    friend class LoggerTest;
+
     static INDI::DefaultDevice *parentDevice;
 
   public:
@@ -249,6 +275,15 @@ class Logger
                //const std::string& 	message,
                const char *message, ...);
 
+    /**
+     * @brief flush Write the messages still queued for the log file now. The file writer thread does it on its own
+     * every 100 milliseconds, when the queue fills up, for errors, and when the process exits.
+     */
+    void flush();
+
+    /** @return messages dropped so far because the log file queue was full */
+    uint64_t droppedMessages() const;
+
     /**
      * @brief Method to configure the logger. Called by the DEBUG_CONF() macro. To make implementation
      * easier, the old stream is always closed.
@@ -0,0 +1,208 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "zchunk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <zlib.h>
+
+namespace INDI
+{
+namespace ZChunk
+{
+
+const char *Suffix = ".zc";
+
+static const char Magic[4] = { 'I', 'Z', 'C', '1' };
+static const size_t HeaderSize = 20;
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// Run job(0..n-1) on up to one thread per core, each thread taking the next free index
+template <typename Job>
+static void parallelFor(uint32_t n, Job job)
+{
+    std::atomic<uint32_t> next(0);
+    auto worker = [&]()
+    {
+        for (uint32_t i; (i = next++) < n;)
+            job(i);
+    };
+
+    uint32_t nthreads = std::min<uint32_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < nthreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+bool compress(const void *data, size_t size, std::vector<uint8_t> &out, int level, size_t chunkSize)
+{
+    if (chunkSize == 0 || chunkSize > UINT32_MAX)
+        return false;
+
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+    uint64_t n64 = (size + chunkSize - 1) / chunkSize;
+    if (n64 > UINT32_MAX)
+        return false;
+    uint32_t nchunks = static_cast<uint32_t>(n64);
+
+    // Each chunk deflates into its own worst case slot, then the slots are packed together
+    size_t slot = compressBound(chunkSize);
+    size_t base = HeaderSize + 4 * static_cast<size_t>(nchunks);
+    std::vector<uLongf> lengths(nchunks);
+    std::atomic<bool> ok(true);
+
+    out.resize(base + slot * nchunks);
+
+    parallelFor(nchunks, [&](uint32_t i)
+    {
+        size_t len = std::min(chunkSize, size - i * chunkSize);
+        lengths[i] = slot;
+        if (compress2(out.data() + base + i * slot, &lengths[i], in + i * chunkSize, len, level) != Z_OK)
+            ok = false;
+    });
+
+    if (!ok)
+        return false;
+
+    memcpy(out.data(), Magic, 4);
+    put32(out.data() + 4, static_cast<uint32_t>(chunkSize));
+    put64(out.data() + 8, size);
+    put32(out.data() + 16, nchunks);
+
+    size_t pos = base;
+    for (uint32_t i = 0; i < nchunks; i++)
+    {
+        put32(out.data() + HeaderSize + 4 * i, static_cast<uint32_t>(lengths[i]));
+        memmove(out.data() + pos, out.data() + base + i * slot, lengths[i]);
+        pos += lengths[i];
+    }
+    out.resize(pos);
+
+    return true;
+}
+
+// Deflate can not do better than this, anything claiming more is corrupt
+static const uint64_t MaxRatio = 1032;
+
+struct Header
+{
+    uint64_t chunkSize;
+    uint64_t total;
+    uint32_t nchunks;
+    // Where every chunk starts, and where the last one ends
+    std::vector<size_t> offsets;
+};
+
+// Check every field of the header against the stream before anything is sized after it
+static bool readHeader(const uint8_t *in, size_t size, Header &header)
+{
+    if (size < HeaderSize || memcmp(in, Magic, 4))
+        return false;
+
+    header.chunkSize = get32(in + 4);
+    header.total     = get64(in + 8);
+    header.nchunks   = get32(in + 16);
+
+    if (header.chunkSize == 0 || header.total > UINT64_MAX - header.chunkSize ||
+            (header.total + header.chunkSize - 1) / header.chunkSize != header.nchunks ||
+            (size - HeaderSize) / 4 < header.nchunks)
+        return false;
+
+    header.offsets.resize(header.nchunks + 1);
+    header.offsets[0] = HeaderSize + 4 * static_cast<size_t>(header.nchunks);
+    for (uint32_t i = 0; i < header.nchunks; i++)
+    {
+        uint32_t len = get32(in + HeaderSize + 4 * i);
+        uint64_t raw = std::min(header.chunkSize, header.total - i * header.chunkSize);
+        if (len > size - header.offsets[i] || raw > len * MaxRatio)
+            return false;
+        header.offsets[i + 1] = header.offsets[i] + len;
+    }
+
+    return true;
+}
+
+uint64_t rawSize(const void *data, size_t size)
+{
+    Header header;
+
+    if (!readHeader(static_cast<const uint8_t *>(data), size, header))
+        return 0;
+
+    return header.total;
+}
+
+bool uncompress(const void *data, size_t size, void *out, size_t outSize)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+    Header header;
+
+    if (!readHeader(in, size, header) || header.total > outSize)
+        return false;
+
+    uint64_t chunkSize = header.chunkSize;
+    uint64_t total     = header.total;
+    const std::vector<size_t> &offsets = header.offsets;
+    std::atomic<bool> ok(true);
+    uint8_t *dst = static_cast<uint8_t *>(out);
+
+    parallelFor(header.nchunks, [&](uint32_t i)
+    {
+        uLongf len = std::min<uint64_t>(chunkSize, total - i * chunkSize);
+        uLongf want = len;
+        if (::uncompress(dst + i * chunkSize, &len, in + offsets[i], offsets[i + 1] - offsets[i]) != Z_OK ||
+                len != want)
+            ok = false;
+    });
+
+    return ok;
+}
+
+}
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace INDI
+{
+
+/**
+ * @namespace INDI::ZChunk
+ * @brief Chunked zlib format for BLOBs, marked by a ".zc" format suffix.
+ *
+ * The data is cut into fixed size chunks which are deflated independently,
+ * so both ends can spread the work over all cores. Layout, little endian:
+ *
+ * @code
+ *   char     magic[4]       "IZC1"
+ *   uint32_t chunkSize      raw bytes per chunk, the last one may be shorter
+ *   uint64_t rawSize        total raw bytes
+ *   uint32_t nChunks
+ *   uint32_t length[nChunks] deflated bytes of each chunk
+ *   ...                     the deflated chunks, back to back
+ * @endcode
+ */
+namespace ZChunk
+{
+
+/** Format suffix appended to the image extension, e.g. ".bin.zc" */
+extern const char *Suffix;
+
+/**
+ * @brief compress Deflate data in chunks on as many threads as there are cores.
+ * @param data raw data.
+ * @param size raw size in bytes.
+ * @param out receives the complete chunked stream.
+ * @param level zlib level, Z_BEST_SPEED is best when the link is fast and the CPU is not.
+ * @param chunkSize raw bytes per chunk.
+ * @return true on success.
+ */
+bool compress(const void *data, size_t size, std::vector<uint8_t> &out, int level, size_t chunkSize = 1 << 20);
+
+/**
+ * @brief rawSize Read the uncompressed size from a chunked stream header.
+ * @return raw size, or 0 if the header is not valid or does not match the stream, so the result is safe to allocate.
+ */
+uint64_t rawSize(const void *data, size_t size);
+
+/**
+ * @brief uncompress Inflate all chunks of a stream in parallel.
+ * @param data chunked stream.
+ * @param size stream size in bytes.
+ * @param out buffer of at least rawSize() bytes.
+ * @param outSize size of out.
+ * @return true if every chunk inflated to its expected length.
+ */
+bool uncompress(const void *data, size_t size, void *out, size_t outSize);
+
+}
+}
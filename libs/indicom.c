@@ -39,6 +39,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -66,6 +67,7 @@
 #endif
 
 #ifndef _WIN32
+#include <pthread.h>
 #include <unistd.h>
 #include <termios.h>
 #include <sys/param.h>
@@ -86,7 +88,6 @@
 int tty_debug = 0;
 int ttyGeminiUdpFormat = 0;
 int ttySkyWatcherUdpFormat = 0;
-int sequenceNumber = 1;
 int ttyClrTrailingLF = 0;
 
 #if defined(HAVE_LIBNOVA)
@@ -348,30 +349,22 @@ void tty_clr_trailing_read_lf(int enabled)
     ttyClrTrailingLF = enabled;
 }
 
-int tty_timeout(int fd, int timeout)
+#ifndef _WIN32
+static int tty_timeout_tv(int fd, struct timeval *tv)
 {
-#if defined(_WIN32) || defined(ANDROID)
+#ifdef ANDROID
     INDI_UNUSED(fd);
-    INDI_UNUSED(timeout);
+    INDI_UNUSED(tv);
     return TTY_ERRNO;
 #else
-
-    if (fd == -1)
-        return TTY_ERRNO;
-
-    struct timeval tv;
     fd_set readout;
     int retval;
 
     FD_ZERO(&readout);
     FD_SET(fd, &readout);
 
-    /* wait for 'timeout' seconds */
-    tv.tv_sec  = timeout;
-    tv.tv_usec = 0;
-
     /* Wait till we have a change in the fd status */
-    retval = select(fd + 1, &readout, NULL, NULL, &tv);
+    retval = select(fd + 1, &readout, NULL, NULL, tv);
 
     /* Return 0 on successful fd change */
     if (retval > 0)
@@ -382,10 +375,309 @@ int tty_timeout(int fd, int timeout)
     /* Return -2 if time expires before anything interesting happens */
     else
         return TTY_TIME_OUT;
+#endif
+}
+#endif
+
+int tty_timeout(int fd, int timeout)
+{
+#if defined(_WIN32) || defined(ANDROID)
+    INDI_UNUSED(fd);
+    INDI_UNUSED(timeout);
+    return TTY_ERRNO;
+#else
+
+    if (fd == -1)
+        return TTY_ERRNO;
+
+    struct timeval tv;
+
+    /* wait for 'timeout' seconds */
+    tv.tv_sec  = timeout;
+    tv.tv_usec = 0;
+
+    return tty_timeout_tv(fd, &tv);
 
 #endif
 }
 
+#ifndef _WIN32
+#define TTY_READ_BUFFER_SIZE 1024
+
+/* Everything kept about one port. Settings at -1 follow the process wide tty_set_* defaults. */
+typedef struct
+{
+    int framing;
+    int clear_lf;
+    int debug;
+    /* Overrides the timeout of read calls when positive */
+    int timeout_ms;
+    /* Gemini UDP sequence number of the last command */
+    int sequence;
+    /* Bytes read from the port but not yet returned to the caller */
+    int start;
+    int end;
+    char data[TTY_READ_BUFFER_SIZE];
+} tty_context;
+
+/* Indexed by fd, entries are allocated on first use and never move, so each port can be used from its own thread */
+static tty_context **ttyContexts = NULL;
+static int ttyContextsCount = 0;
+static pthread_mutex_t ttyContextsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void tty_init_context(tty_context *ctx)
+{
+    ctx->framing    = -1;
+    ctx->clear_lf   = -1;
+    ctx->debug      = -1;
+    ctx->timeout_ms = 0;
+    ctx->sequence   = 1;
+    ctx->start = ctx->end = 0;
+}
+
+static tty_context *tty_get_context(int fd, int create)
+{
+    tty_context *ctx = NULL;
+
+    if (fd < 0)
+        return NULL;
+
+    pthread_mutex_lock(&ttyContextsLock);
+
+    if (fd >= ttyContextsCount && create)
+    {
+        int count = fd + 16;
+        tty_context **table = (tty_context **)realloc(ttyContexts, count * sizeof(tty_context *));
+        if (table)
+        {
+            memset(table + ttyContextsCount, 0, (count - ttyContextsCount) * sizeof(tty_context *));
+            ttyContexts      = table;
+            ttyContextsCount = count;
+        }
+    }
+
+    if (fd < ttyContextsCount)
+    {
+        ctx = ttyContexts[fd];
+        if (ctx == NULL && create)
+        {
+            ctx = ttyContexts[fd] = (tty_context *)malloc(sizeof(tty_context));
+            if (ctx)
+                tty_init_context(ctx);
+        }
+    }
+
+    pthread_mutex_unlock(&ttyContextsLock);
+
+    return ctx;
+}
+
+static int tty_context_framing(const tty_context *ctx)
+{
+    if (ctx && ctx->framing >= 0)
+        return ctx->framing;
+
+    if (ttyGeminiUdpFormat)
+        return TTY_FRAMING_GEMINI_UDP;
+    else if (ttySkyWatcherUdpFormat)
+        return TTY_FRAMING_SKYWATCHER_UDP;
+
+    return TTY_FRAMING_STREAM;
+}
+
+static int tty_context_clear_lf(const tty_context *ctx)
+{
+    return (ctx && ctx->clear_lf >= 0) ? ctx->clear_lf : ttyClrTrailingLF;
+}
+
+static int tty_context_debug(const tty_context *ctx)
+{
+    return (ctx && ctx->debug >= 0) ? ctx->debug : tty_debug;
+}
+
+/* tty_timeout, unless the port has a timeout of its own */
+static int tty_context_wait(int fd, const tty_context *ctx, int timeout)
+{
+    struct timeval tv;
+
+    if (ctx && ctx->timeout_ms > 0)
+    {
+        tv.tv_sec  = ctx->timeout_ms / 1000;
+        tv.tv_usec = (ctx->timeout_ms % 1000) * 1000;
+    }
+    else
+    {
+        tv.tv_sec  = timeout;
+        tv.tv_usec = 0;
+    }
+
+    return tty_timeout_tv(fd, &tv);
+}
+
+/* Wait for the port and read all it has, up to the free space of the buffer */
+static int tty_fill_read_buffer(int fd, tty_context *ctx, int timeout)
+{
+    int err       = TTY_OK;
+    int bytesRead = 0;
+
+    if (ctx->start == ctx->end)
+        ctx->start = ctx->end = 0;
+    else if (ctx->end == TTY_READ_BUFFER_SIZE)
+    {
+        memmove(ctx->data, ctx->data + ctx->start, ctx->end - ctx->start);
+        ctx->end -= ctx->start;
+        ctx->start = 0;
+    }
+
+    if ((err = tty_context_wait(fd, ctx, timeout)))
+        return err;
+
+    bytesRead = read(fd, ctx->data + ctx->end, TTY_READ_BUFFER_SIZE - ctx->end);
+
+    /* select() said readable, so nothing at all means the other end hung up */
+    if (bytesRead <= 0)
+        return TTY_READ_ERROR;
+
+    ctx->end += bytesRead;
+
+    return TTY_OK;
+}
+
+static int tty_context_bytes(tty_context *ctx, char *buf, int nbytes)
+{
+    int count = 0;
+
+    if (ctx == NULL || nbytes <= 0)
+        return 0;
+
+    count = ctx->end - ctx->start;
+    if (count > nbytes)
+        count = nbytes;
+
+    memcpy(buf, ctx->data + ctx->start, count);
+    ctx->start += count;
+
+    return count;
+}
+#endif
+
+void tty_set_port_framing(int fd, int framing)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 1);
+    if (ctx)
+        ctx->framing = framing;
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(framing);
+#endif
+}
+
+void tty_set_port_clr_trailing_lf(int fd, int enabled)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 1);
+    if (ctx)
+        ctx->clear_lf = enabled;
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(enabled);
+#endif
+}
+
+void tty_set_port_debug(int fd, int debug)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 1);
+    if (ctx)
+        ctx->debug = debug;
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(debug);
+#endif
+}
+
+void tty_set_port_timeout_ms(int fd, int timeout_ms)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 1);
+    if (ctx)
+        ctx->timeout_ms = timeout_ms;
+#else
+    INDI_UNUSED(fd);
+    INDI_UNUSED(timeout_ms);
+#endif
+}
+
+void tty_reset_port(int fd)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 0);
+    if (ctx)
+        tty_init_context(ctx);
+#else
+    INDI_UNUSED(fd);
+#endif
+}
+
+int tty_buffered_read_section(int fd, char *buf, int nsize, char stop_char, int timeout, int clear_lf, int *nbytes_read)
+{
+#ifdef _WIN32
+    return TTY_ERRNO;
+#else
+    int err = TTY_OK;
+    tty_context *ctx;
+
+    *nbytes_read = 0;
+
+    if ((ctx = tty_get_context(fd, 1)) == NULL)
+        return TTY_ERRNO;
+
+    for (;;)
+    {
+        while (ctx->start < ctx->end)
+        {
+            char c = ctx->data[ctx->start++];
+
+            if (!(clear_lf && c == 0x0A && *nbytes_read == 0))
+                buf[(*nbytes_read)++] = c;
+
+            if (c == stop_char)
+                return TTY_OK;
+            else if (*nbytes_read >= nsize)
+                return TTY_OVERFLOW;
+        }
+
+        if ((err = tty_fill_read_buffer(fd, ctx, timeout)))
+            return err;
+    }
+#endif
+}
+
+int tty_buffered_bytes(int fd, char *buf, int nbytes)
+{
+#ifdef _WIN32
+    INDI_UNUSED(fd);
+    INDI_UNUSED(buf);
+    INDI_UNUSED(nbytes);
+    return 0;
+#else
+    return tty_context_bytes(tty_get_context(fd, 0), buf, nbytes);
+#endif
+}
+
+void tty_clear_read_buffer(int fd)
+{
+#ifndef _WIN32
+    tty_context *ctx = tty_get_context(fd, 0);
+
+    if (ctx)
+        ctx->start = ctx->end = 0;
+#else
+    INDI_UNUSED(fd);
+#endif
+}
+
 int tty_write(int fd, const char *buf, int nbytes, int *nbytes_written)
 {
 #ifdef _WIN32
@@ -394,23 +686,31 @@ int tty_write(int fd, const char *buf, int nbytes, int *nbytes_written)
     int geminiBuffer[66]={0};
     char *buffer = (char *)buf;
 
-    if (ttyGeminiUdpFormat)
+    if (fd == -1)
+        return TTY_ERRNO;
+
+    tty_context *ctx = tty_get_context(fd, 1);
+    int framing      = tty_context_framing(ctx);
+    int debug        = tty_context_debug(ctx);
+
+    if (framing == TTY_FRAMING_GEMINI_UDP)
     {
         buffer = (char*)geminiBuffer;
-        geminiBuffer[0] = ++sequenceNumber;
+        geminiBuffer[0] = ctx ? ++ctx->sequence : 1;
         geminiBuffer[1] = 0;
         memcpy((char *)&geminiBuffer[2], buf, nbytes);
         // Add on the 8 bytes for the header and 1 byte for the null terminator
         nbytes += 9;
     }
 
-    if (fd == -1)
-        return TTY_ERRNO;
-
     int bytes_w     = 0;
     *nbytes_written = 0;
 
-    if (tty_debug)
+    // A new command starts a new exchange. Whatever is left of the last reply would have been flushed or misread.
+    if (ctx)
+        ctx->start = ctx->end = 0;
+
+    if (debug)
     {
         int i = 0;
         for (i = 0; i < nbytes; i++)
@@ -428,7 +728,7 @@ int tty_write(int fd, const char *buf, int nbytes, int *nbytes_written)
         nbytes -= bytes_w;
     }
 
-    if (ttyGeminiUdpFormat)
+    if (framing == TTY_FRAMING_GEMINI_UDP)
         *nbytes_written -= 9;
 
     return TTY_OK;
@@ -461,13 +761,18 @@ int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read)
     if (nbytes <= 0)
         return TTY_PARAM_ERROR;
 
-    if (tty_debug)
+    tty_context *ctx = tty_get_context(fd, 1);
+    int framing      = tty_context_framing(ctx);
+    int debug        = tty_context_debug(ctx);
+    int clear_lf     = tty_context_clear_lf(ctx);
+
+    if (debug)
         IDLog("%s: Request to read %d bytes with %d timeout for fd %d\n", __FUNCTION__, nbytes, timeout, fd);
 
     char geminiBuffer[257]={0};
     char* buffer = buf;
 
-    if (ttyGeminiUdpFormat)
+    if (framing == TTY_FRAMING_GEMINI_UDP)
     {
         numBytesToRead = nbytes + 8;
         buffer = geminiBuffer;
@@ -475,15 +780,21 @@ int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read)
 
     while (numBytesToRead > 0)
     {
-        if ((err = tty_timeout(fd, timeout)))
-            return err;
+        // Bytes a section read took past its stop char come first
+        bytesRead = tty_context_bytes(ctx, buffer + (*nbytes_read), numBytesToRead);
 
-        bytesRead = read(fd, buffer + (*nbytes_read), ((uint32_t)numBytesToRead));
+        if (bytesRead == 0)
+        {
+            if ((err = tty_context_wait(fd, ctx, timeout)))
+                return err;
 
-        if (bytesRead < 0)
-            return TTY_READ_ERROR;
+            bytesRead = read(fd, buffer + (*nbytes_read), ((uint32_t)numBytesToRead));
 
-        if (tty_debug)
+            if (bytesRead < 0)
+                return TTY_READ_ERROR;
+        }
+
+        if (debug)
         {
             IDLog("%d bytes read and %d bytes remaining...\n", bytesRead, numBytesToRead - bytesRead);
             int i = 0;
@@ -491,9 +802,9 @@ int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read)
                 IDLog("%s: buffer[%d]=%#X (%c)\n", __FUNCTION__, i, (unsigned char)buf[i], buf[i]);
         }
 
-        if (*nbytes_read == 0 && ttyClrTrailingLF && *buffer == 0x0A)
+        if (*nbytes_read == 0 && clear_lf && *buffer == 0x0A)
         {
-            if (tty_debug)
+            if (debug)
                 IDLog("%s: Cleared LF char left in buf\n", __FUNCTION__);
 
             memcpy(buffer, buffer+1,bytesRead);
@@ -505,10 +816,10 @@ int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read)
     }
 
 
-    if (ttyGeminiUdpFormat)
+    if (framing == TTY_FRAMING_GEMINI_UDP)
     {
         int *intSizedBuffer = (int *)geminiBuffer;
-        if (intSizedBuffer[0] != sequenceNumber)
+        if (ctx && intSizedBuffer[0] != ctx->sequence)
         {
             // Not the right reply just do the read again.
             return tty_read(fd, buf, nbytes, timeout, nbytes_read);
@@ -538,12 +849,14 @@ int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes
     int err       = TTY_OK;
     *nbytes_read  = 0;
 
-    uint8_t *read_char = 0;
+    tty_context *ctx = tty_get_context(fd, 1);
+    int framing      = tty_context_framing(ctx);
+    int debug        = tty_context_debug(ctx);
 
-    if (tty_debug)
+    if (debug)
         IDLog("%s: Request to read until stop char '%#02X' with %d timeout for fd %d\n", __FUNCTION__, stop_char, timeout, fd);
 
-    if (ttyGeminiUdpFormat)
+    if (framing == TTY_FRAMING_GEMINI_UDP)
     {
         bytesRead = read(fd, readBuffer, 255);
 
@@ -551,7 +864,7 @@ int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes
             return TTY_READ_ERROR;
 
         int *intSizedBuffer = (int *)readBuffer;
-        if (intSizedBuffer[0] != sequenceNumber)
+        if (ctx && intSizedBuffer[0] != ctx->sequence)
         {
             // Not the right reply just do the read again.
             return tty_read_section(fd, buf, stop_char, timeout, nbytes_read);
@@ -568,7 +881,7 @@ int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes
             }
         }
     }
-    else if (ttySkyWatcherUdpFormat)
+    else if (framing == TTY_FRAMING_SKYWATCHER_UDP)
     {
         bytesRead = read(fd, readBuffer, 255);
         if (bytesRead < 0)
@@ -586,31 +899,16 @@ int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes
     }
     else
     {
-        for (;;)
-        {
-            if ((err = tty_timeout(fd, timeout)))
-                return err;
-
-            read_char = (uint8_t*)(buf + *nbytes_read);
-            bytesRead = read(fd, read_char, 1);
-
-            if (bytesRead < 0)
-                return TTY_READ_ERROR;
-
-            if (tty_debug)
-                IDLog("%s: buffer[%d]=%#X (%c)\n", __FUNCTION__, (*nbytes_read), *read_char, *read_char);
-
-            if (!(ttyClrTrailingLF && *read_char == 0X0A && *nbytes_read == 0))
-                (*nbytes_read)++;
-            else {
-                if (tty_debug)
-                    IDLog("%s: Cleared LF char left in buf\n", __FUNCTION__);
-            }
+        err = tty_buffered_read_section(fd, buf, INT_MAX, stop_char, timeout, tty_context_clear_lf(ctx), nbytes_read);
 
-            if (*read_char == stop_char) {
-                return TTY_OK;
-            }
+        if (debug)
+        {
+            int i = 0;
+            for (i = 0; i < *nbytes_read; i++)
+                IDLog("%s: buffer[%d]=%#X (%c)\n", __FUNCTION__, i, (unsigned char)buf[i], buf[i]);
         }
+
+        return err;
     }
 
     return TTY_TIME_OUT;
@@ -627,47 +925,30 @@ int tty_nread_section(int fd, char *buf, int nsize, char stop_char, int timeout,
     if (fd == -1)
         return TTY_ERRNO;
 
+    tty_context *ctx = tty_get_context(fd, 1);
+    int debug        = tty_context_debug(ctx);
+
     // For Gemini
-    if (ttyGeminiUdpFormat)
+    if (tty_context_framing(ctx) == TTY_FRAMING_GEMINI_UDP)
         return tty_read_section(fd, buf, stop_char, timeout, nbytes_read);
 
-    int bytesRead = 0;
     int err       = TTY_OK;
     *nbytes_read  = 0;
-    uint8_t *read_char = 0;
     memset(buf, 0, nsize);
 
-    if (tty_debug)
+    if (debug)
         IDLog("%s: Request to read until stop char '%#02X' with %d timeout for fd %d\n", __FUNCTION__, stop_char, timeout, fd);
 
-    for (;;)
-    {
-        if ((err = tty_timeout(fd, timeout)))
-            return err;
-
-        read_char = (uint8_t*)(buf + *nbytes_read);
-        bytesRead = read(fd, read_char, 1);
-
-        if (bytesRead < 0)
-            return TTY_READ_ERROR;
-
-        if (tty_debug)
-            IDLog("%s: buffer[%d]=%#X (%c)\n", __FUNCTION__, (*nbytes_read), *read_char, *read_char);
-
-        if (!(ttyClrTrailingLF && *read_char == 0X0A && *nbytes_read == 0))
-            (*nbytes_read)++;
-        else {
-            if (tty_debug)
-                IDLog("%s: Cleared LF char left in buf\n", __FUNCTION__);
-        }
+    err = tty_buffered_read_section(fd, buf, nsize, stop_char, timeout, tty_context_clear_lf(ctx), nbytes_read);
 
-        if (*read_char == stop_char)
-            return TTY_OK;
-        else if (*nbytes_read >= nsize)
-            return TTY_OVERFLOW;
+    if (debug)
+    {
+        int i = 0;
+        for (i = 0; i < *nbytes_read; i++)
+            IDLog("%s: buffer[%d]=%#X (%c)\n", __FUNCTION__, i, (unsigned char)buf[i], buf[i]);
     }
 
-    return TTY_TIME_OUT;
+    return err;
 
 #endif
 }
@@ -927,6 +1208,7 @@ int tty_connect(const char *device, int bit_rate, int word_size, int parity, int
 #endif
 
     *fd = t_fd;
+    tty_reset_port(t_fd);
     /* return success */
     return TTY_OK;
 
@@ -1175,6 +1457,7 @@ int tty_connect(const char *device, int bit_rate, int word_size, int parity, int
     }
 
     *fd = t_fd;
+    tty_reset_port(t_fd);
     /* return success */
     return TTY_OK;
 #endif
@@ -1193,6 +1476,7 @@ int tty_disconnect(int fd)
 #else
     int err;
     tcflush(fd, TCIOFLUSH);
+    tty_reset_port(fd);
     err = close(fd);
 
     if (err != 0)
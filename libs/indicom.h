@@ -90,6 +90,14 @@ enum TTY_ERROR
     TTY_PORT_BUSY    = -9,
 };
 
+/* How commands and replies are framed on a port */
+enum TTY_FRAMING
+{
+    TTY_FRAMING_STREAM         = 0, /* Plain byte stream, serial or TCP */
+    TTY_FRAMING_GEMINI_UDP     = 1, /* Losmandy Gemini UDP, each datagram starts with a sequence number */
+    TTY_FRAMING_SKYWATCHER_UDP = 2, /* One reply per datagram */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -179,13 +187,71 @@ void tty_error_msg(int err_code, char *err_msg, int err_msg_len);
 /**
  * @brief tty_set_debug Enable or disable debug which prints verbose information.
  * @param debug 1 to enable, 0 to disable
+ * @note This and the three functions below set process wide defaults, for every port not configured with the tty_set_port_*
+ * functions. Drivers talking to several ports should prefer those.
  */
 void tty_set_debug(int debug);
 void tty_set_gemini_udp_format(int enabled);
 void tty_set_skywatcher_udp_format(int enabled);
 void tty_clr_trailing_read_lf(int enabled);
 
+/**
+ * @brief tty_set_port_framing Set the framing of \e fd alone.
+ * @param framing one of TTY_FRAMING, or -1 to follow tty_set_gemini_udp_format and tty_set_skywatcher_udp_format again.
+ */
+void tty_set_port_framing(int fd, int framing);
+
+/**
+ * @brief tty_set_port_clr_trailing_lf Drop a line feed left at the start of each reply on \e fd alone.
+ * @param enabled 1 or 0, or -1 to follow tty_clr_trailing_read_lf again.
+ */
+void tty_set_port_clr_trailing_lf(int fd, int enabled);
+
+/**
+ * @brief tty_set_port_debug Log the traffic of \e fd alone.
+ * @param debug 1 or 0, or -1 to follow tty_set_debug again.
+ */
+void tty_set_port_debug(int fd, int debug);
+
+/**
+ * @brief tty_set_port_timeout_ms Wait \e timeout_ms milliseconds for data on \e fd, instead of the seconds passed to each read.
+ * @param timeout_ms timeout in milliseconds, 0 to use the timeout of each read again.
+ */
+void tty_set_port_timeout_ms(int fd, int timeout_ms);
+
+/**
+ * @brief tty_reset_port Forget the settings, Gemini sequence number and buffered input of \e fd. tty_connect and tty_disconnect
+ * do it, so settings made with the tty_set_port_* functions last as long as the connection.
+ */
+void tty_reset_port(int fd);
+
 int tty_timeout(int fd, int timeout);
+
+/** \brief read from terminal until a delimiter, through the read buffer of \e fd.
+    Whatever the port has available is read at once and scanned for \e stop_char in memory. Bytes past the delimiter are kept
+    for the next read on the same fd. tty_read_section and tty_nread_section use it, and so does TTYBase.
+    \param fd file descriptor
+    \param buf pointer to store data. Must be initilized and big enough to hold data.
+    \param nsize size of buf. If stop character is not encountered before nsize, the function aborts.
+    \param stop_char if the function encounters \e stop_char then it stops reading and returns the buffer.
+    \param timeout number of seconds to wait for terminal before a timeout error is issued.
+    \param clear_lf 1 to drop a line feed left at the start of the section by the previous reply.
+    \param nbytes_read the number of bytes read.
+    \return On success, it returns TTY_OK, otherwise, a TTY_ERROR code.
+*/
+int tty_buffered_read_section(int fd, char *buf, int nsize, char stop_char, int timeout, int clear_lf, int *nbytes_read);
+
+/** \brief Take up to \e nbytes already in the read buffer of \e fd without touching the port.
+    \return the number of bytes copied to \e buf
+*/
+int tty_buffered_bytes(int fd, char *buf, int nbytes);
+
+/** \brief Drop whatever the read buffer of \e fd holds. tty_write does it already.
+    tcflush() alone no longer discards all pending input: bytes the tty_read functions already took from the port stay in
+    the read buffer and are returned by the next read. Code that writes to the port with write() instead of tty_write must
+    call this along with tcflush().
+*/
+void tty_clear_read_buffer(int fd);
 /*@}*/
 
 /**
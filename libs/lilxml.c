@@ -26,11 +26,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  * only handles elements, attributes and pcdata content.
  * <! ... > and <? ... > are silently ignored.
  * pcdata is collected into one string, sans leading whitespace first line.
+ * when given a chunk, the content of oneBLOB elements is taken in bulk up to
+ * the next '<' or '&' rather than one char at a time. line numbers reported
+ * in errors do not count lines within such content.
  *
  * #define MAIN_TST to create standalone test program
  */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,6 +59,9 @@ typedef struct
 
 static int oneXMLchar(LilXML *lp, int c, char ynot[]);
 static void initParser(LilXML *lp);
+static int isBlobEle(XMLEle *ep);
+static int startContent(LilXML *lp, char ynot[]);
+static int takeBlob(LilXML *lp, const char *data, int len, char ynot[]);
 static void pushXMLEle(LilXML *lp);
 static void popXMLEle(LilXML *lp);
 static void resetEndTag(LilXML *lp);
@@ -63,6 +70,7 @@ static XMLEle *growEle(XMLEle *pe);
 static void freeAtt(XMLAtt *a);
 static int isTokenChar(int start, int c);
 static void growString(String *sp, int c);
+static int appendBytes(String *sp, const char *bytes, int n);
 static void appendString(String *sp, const char *str);
 static void freeString(String *sp);
 static void newString(String *sp);
@@ -83,7 +91,9 @@ typedef enum {
     ENTINCON,       /* in entity in pcdata */
     SAWLTINCON,     /* saw < in content */
     LOOK4CLOSETAG,  /* looking for closing tag after < */
-    INCLOSETAG      /* reading closing tag */
+    INCLOSETAG,     /* reading closing tag */
+    INRAW,          /* reading binary content of known length */
+    AFTERRAW        /* past binary content, only the closing tag may follow */
 } State;            /* parsing states */
 
 /* maintain state while parsing */
@@ -98,6 +108,14 @@ struct LilXML_
     int lastc;     /* last char (just used wiht skipping)*/
     int skipping;  /* in comment or declaration */
     int inblob;    /* in oneBLOB element */
+    int blobcon;   /* reading content of a oneBLOB element */
+    int rawleft;   /* bytes of binary content still to come */
+    int blobkeep;  /* blobhandler wants the content of this oneBLOB */
+
+    /* set by caller, survive initParser() */
+    XMLBlobHandler *blobhandler; /* takes oneBLOB content if set */
+    void *blobaux;               /* passed to blobhandler */
+    int binlimit;                /* largest binlen accepted, 0 if none is */
 };
 
 /* internal representation of a (possibly nested) XML element */
@@ -152,6 +170,21 @@ LilXML *newLilXML()
     return (lp);
 }
 
+/* pass oneBLOB content to handler instead of collecting it in pcdata, or
+ * collect it again if handler is NULL.
+ */
+void setXMLBlobHandler(LilXML *lp, XMLBlobHandler *handler, void *aux)
+{
+    lp->blobhandler = handler;
+    lp->blobaux     = aux;
+}
+
+/* accept binary oneBLOB content of up to maxlen bytes, none if 0 */
+void setXMLMaxBinlen(LilXML *lp, int maxlen)
+{
+    lp->binlimit = maxlen < 0 ? 0 : maxlen > MAXXMLBINLEN ? MAXXMLBINLEN : maxlen;
+}
+
 /* discard */
 void delLilXML(LilXML *lp)
 {
@@ -208,8 +241,13 @@ void delXMLEle(XMLEle *ep)
     (*myfree)(ep);
 }
 
-//#define WITH_MEMCHR
 XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char ynot[])
+{
+    return parseXMLChunkEnds(lp, buf, size, NULL, ynot);
+}
+
+//#define WITH_MEMCHR
+XMLEle **parseXMLChunkEnds(LilXML *lp, char *buf, int size, int **ends, char ynot[])
 {
     XMLEle **nodes = (XMLEle **)malloc(sizeof(XMLEle *));
     int nnodes     = 1;
@@ -218,7 +256,14 @@ XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char ynot[])
     int s;
     ynot[0] = '\0';
 
-    if (lp->inblob)
+    if (ends)
+        *ends = (int *)malloc(sizeof(int));
+
+    if (lp->blobhandler)
+    {
+        /* content never lands in pcdata */
+    }
+    else if (lp->inblob)
     {
 #ifdef WITH_ENCLEN
         if (size < lp->ce->pcdata.sm - lp->ce->pcdata.sl)
@@ -294,6 +339,30 @@ XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char ynot[])
     while (curr - buf < size)
     {
         char newc = *curr;
+
+        /* binary content may hold anything, take it all as is */
+        if (lp->cs == INRAW)
+        {
+            int n = size - (curr - buf);
+
+            if (n > lp->rawleft)
+                n = lp->rawleft;
+            if (takeBlob(lp, curr, n, ynot) < 0)
+            {
+                initParser(lp);
+                curr += n;
+                continue;
+            }
+            lp->rawleft -= n;
+            if (lp->rawleft == 0)
+            {
+                lp->blobcon = 0;
+                lp->cs      = AFTERRAW;
+            }
+            curr += n;
+            continue;
+        }
+
         /* EOF? */
         if (newc == 0)
         {
@@ -303,6 +372,25 @@ XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char ynot[])
             continue;
         }
 
+        /* take as much BLOB content as possible in one go */
+        if (lp->blobcon && lp->cs == INCON && !lp->skipping && lp->lastc != '<' && newc != '<' && newc != '&')
+        {
+            int left  = size - (curr - buf);
+            char *end = memchr(curr, '<', left);
+            char *amp = memchr(curr, '&', end ? end - curr : left);
+            int n;
+
+            if (amp)
+                end = amp;
+            n = (end ? end - curr : left);
+            if (takeBlob(lp, curr, n, ynot) < 0)
+                initParser(lp);
+            else
+                lp->lastc = curr[n - 1];
+            curr += n;
+            continue;
+        }
+
         /* new line? */
         if (newc == '\n')
             lp->ln++;
@@ -363,6 +451,11 @@ XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char ynot[])
         nodes[nnodes - 1] = lp->ce;
         nodes             = (XMLEle **)realloc(nodes, (nnodes + 1) * sizeof(XMLEle *));
         nodes[nnodes]     = NULL;
+        if (ends)
+        {
+            (*ends)[nnodes - 1] = curr - buf + 1;
+            *ends               = (int *)realloc(*ends, (nnodes + 1) * sizeof(int));
+        }
         nnodes += 1;
         lp->ce = NULL;
         initParser(lp);
@@ -388,6 +481,14 @@ XMLEle *readXMLEle(LilXML *lp, int newc, char ynot[])
     /* start optimistic */
     ynot[0] = '\0';
 
+    /* binary content may hold anything, take it as is */
+    if (lp->cs == INRAW)
+    {
+        if (oneXMLchar(lp, newc, ynot) < 0)
+            initParser(lp);
+        return (NULL);
+    }
+
     /* EOF? */
     if (newc == 0)
     {
@@ -930,7 +1031,7 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
             if (isTokenChar(0, c))
                 growString(&lp->ce->tag, c);
             else if (c == '>')
-                lp->cs = LOOK4CON;
+                return (startContent(lp, ynot));
             else if (c == '/')
                 lp->cs = SAWSLASH;
             else
@@ -939,7 +1040,7 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
 
         case LOOK4ATTRN: /* looking for attr name, > or / */
             if (c == '>')
-                lp->cs = LOOK4CON;
+                return (startContent(lp, ynot));
             else if (c == '/')
                 lp->cs = SAWSLASH;
             else if (isTokenChar(1, c))
@@ -1026,16 +1127,32 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
 
         case LOOK4CON: /* skipping leading content whitespace*/
             if (c == '<')
-                lp->cs = SAWLTINCON;
+            {
+                lp->blobcon = 0;
+                lp->cs      = SAWLTINCON;
+            }
             else if (!isspace(c))
             {
-                growString(&lp->ce->pcdata, c);
+                if (lp->blobcon && lp->blobhandler)
+                {
+                    char cc = c;
+                    if (takeBlob(lp, &cc, 1, ynot) < 0)
+                        return (-1);
+                }
+                else
+                    growString(&lp->ce->pcdata, c);
                 lp->cs = INCON;
             }
             break;
 
         case INCON: /* reading content */
-            if (c == '&')
+            if (lp->blobcon && lp->blobhandler && c != '<')
+            {
+                char cc = c;
+                if (takeBlob(lp, &cc, 1, ynot) < 0)
+                    return (-1);
+            }
+            else if (c == '&')
             {
                 newString(&lp->entity);
                 growString(&lp->entity, c);
@@ -1046,7 +1163,8 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
                 /* chomp trailing whitespace */
                 while (lp->ce->pcdata.sl > 0 && isspace(lp->ce->pcdata.s[lp->ce->pcdata.sl - 1]))
                     lp->ce->pcdata.s[--(lp->ce->pcdata.sl)] = '\0';
-                lp->cs = SAWLTINCON;
+                lp->blobcon = 0;
+                lp->cs      = SAWLTINCON;
             }
             else
             {
@@ -1133,6 +1251,29 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
                 return (-1);
             }
             break;
+
+        case INRAW: /* reading binary content */
+        {
+            char cc = c;
+            if (takeBlob(lp, &cc, 1, ynot) < 0)
+                return (-1);
+            if (--lp->rawleft == 0)
+            {
+                lp->blobcon = 0;
+                lp->cs      = AFTERRAW;
+            }
+        }
+        break;
+
+        case AFTERRAW: /* past binary content */
+            if (c == '<')
+                lp->cs = SAWLTINCON;
+            else if (!isspace(c))
+            {
+                sprintf(ynot, "Line %d: Bogus char %c after binary content", lp->ln, c);
+                return (-1);
+            }
+            break;
     }
 
     return (0);
@@ -1141,12 +1282,76 @@ static int oneXMLchar(LilXML *lp, int c, char ynot[])
 /* set up for a fresh start again */
 static void initParser(LilXML *lp)
 {
+    XMLBlobHandler *blobhandler = lp->blobhandler;
+    void *blobaux               = lp->blobaux;
+    int binlimit                = lp->binlimit;
+
     delXMLEle(lp->ce);
     freeString(&lp->endtag);
     memset(lp, 0, sizeof(*lp));
     newString(&lp->endtag);
-    lp->cs = LOOK4START;
-    lp->ln = 1;
+    lp->cs          = LOOK4START;
+    lp->ln          = 1;
+    lp->blobhandler = blobhandler;
+    lp->blobaux     = blobaux;
+    lp->binlimit    = binlimit;
+}
+
+/* 1 if ep is a oneBLOB element, whose content gets special treatment */
+static int isBlobEle(XMLEle *ep)
+{
+    return (ep->tag.sl == 7 && !strcmp(ep->tag.s, "oneBLOB"));
+}
+
+/* the opening tag of ce is complete, get ready for its content.
+ * a oneBLOB with binlen is followed by exactly that many raw bytes, which
+ * only peers that agreed to send binary may do and only up to binlimit.
+ * the content is collected as it arrives, never sized by what the peer says.
+ * return 0 if ok, else -1 with reason in ynot[].
+ */
+static int startContent(LilXML *lp, char ynot[])
+{
+    XMLAtt *ap;
+
+    lp->blobcon = isBlobEle(lp->ce);
+    lp->rawleft = 0;
+    lp->cs      = LOOK4CON;
+
+    if (lp->blobcon && (ap = findXMLAtt(lp->ce, "binlen")) != NULL)
+    {
+        char *end;
+        long n = strtol(ap->valu.s, &end, 10);
+
+        if (end == ap->valu.s || *end || n < 0 || n > lp->binlimit || !lp->binlimit)
+        {
+            sprintf(ynot, "Line %d: binlen='%.32s' not accepted", lp->ln, ap->valu.s);
+            return (-1);
+        }
+        if (n > 0)
+        {
+            lp->rawleft = n;
+            lp->cs      = INRAW;
+        }
+    }
+
+    lp->blobkeep = lp->blobcon && lp->blobhandler && (*lp->blobhandler)(lp->ce, NULL, 0, lp->blobaux);
+    return (0);
+}
+
+/* pass len bytes of oneBLOB content to the handler, if any and it wants them, else add them to pcdata.
+ * return 0 if ok, else -1 with reason in ynot[].
+ */
+static int takeBlob(LilXML *lp, const char *data, int len, char ynot[])
+{
+    if (!lp->blobhandler || (lp->blobkeep && (*lp->blobhandler)(lp->ce, data, len, lp->blobaux)))
+    {
+        if (appendBytes(&lp->ce->pcdata, data, len) < 0)
+        {
+            sprintf(ynot, "Line %d: no memory for %d more bytes of oneBLOB content", lp->ln, len);
+            return (-1);
+        }
+    }
+    return (0);
 }
 
 /* start a new XMLEle.
@@ -1246,6 +1451,36 @@ static void growString(String *sp, int c)
     sp->sl++;
 }
 
+/* append n bytes to the String storage at *sp.
+ * return 0 if ok, -1 if out of memory with *sp unchanged.
+ */
+static int appendBytes(String *sp, const char *bytes, int n)
+{
+    int l;
+
+    if (n > INT_MAX - 1 - sp->sl)
+        return (-1);
+    l = sp->sl + n + 1; /* need room for '\0' */
+
+    if (l > sp->sm)
+    {
+        int sm = sp->sm > 0 ? sp->sm : MINMEM;
+        char *s;
+
+        while (l > sm)
+            sm = sm > INT_MAX / 2 ? l : 2 * sm;
+        s = (char *)moremem(sp->s, sm);
+        if (!s)
+            return (-1);
+        sp->s  = s;
+        sp->sm = sm;
+    }
+    memcpy(&sp->s[sp->sl], bytes, n);
+    sp->sl += n;
+    sp->s[sp->sl] = '\0';
+    return (0);
+}
+
 /* append str to the String storage at *sp */
 static void appendString(String *sp, const char *str)
 {
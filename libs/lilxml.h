@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110 - 1301  USA
 
     It only handles elements, attributes and pcdata content. <! ... > and <? ... > are silently ignored. pcdata is collected into one string, sans leading whitespace first line. \n
 
+    A oneBLOB element with a binlen attribute carries exactly that many raw bytes right after its opening tag, followed by its closing tag. They are taken verbatim, with no entities or whitespace trimming, so its pcdata may hold any byte including NUL; use pcdatalenXMLEle() for its length. Parsers reject binlen unless allowed with setXMLMaxBinlen(). \n
+
     The following is an example of a cannonical usage for the lilxml library. Initialize a lil xml context and read an XML file in a root element.
 
     \code
@@ -106,6 +108,44 @@ extern void delXMLEle(XMLEle *e);
  */
 extern XMLEle **parseXMLChunk(LilXML *lp, char *buf, int size, char errmsg[]);
 
+/** \brief Process an XML chunk and report where each parsed element ends within it.
+    \param lp a pointer to a lilxml parser.
+    \param buf buffer to process.
+    \param size size of buf
+    \param ends if not NULL, set to a malloced array parallel to the returned array holding, for each parsed element, the offset in buf just past its closing '>'. It is up to the caller to free it.
+    \param errmsg a buffer to store error messages if an error in parsing is encountered.
+    \return same as parseXMLChunk().
+    \note Together with the offsets of previous chunks this lets callers pass the original bytes of an element along without printing it again.
+ */
+extern XMLEle **parseXMLChunkEnds(LilXML *lp, char *buf, int size, int **ends, char errmsg[]);
+
+/** \brief Handler for the content of oneBLOB elements, see setXMLBlobHandler().
+    \param ep the oneBLOB element being parsed. Its attributes are complete.
+    \param data next piece of content, including any whitespace. NULL for the first call, made once the opening tag of ep is complete.
+    \param len number of bytes in data, 0 for the first call.
+    \param aux as passed to setXMLBlobHandler().
+    \return non-zero to also add data to the pcdata of ep, 0 to drop it. If the first call returns 0 all content of ep is dropped without calling the handler again.
+ */
+typedef int(XMLBlobHandler)(XMLEle *ep, const char *data, int len, void *aux);
+
+/** \brief Pass the content of oneBLOB elements to a handler as it is parsed instead of collecting it into their pcdata.
+    \param lp a pointer to a lilxml parser.
+    \param handler called with each piece of oneBLOB content. When parsing with parseXMLChunk() the pieces point straight into the given buffer and are as large as the buffer allows. Pass NULL to collect content into pcdata again.
+    \param aux passed along to handler.
+    \note oneBLOB elements parsed while a handler is set only have the pcdata the handler asked to keep. Pass a handler that always returns 0 to route BLOBs by their attributes alone at a cost independent of their size.
+ */
+extern void setXMLBlobHandler(LilXML *lp, XMLBlobHandler *handler, void *aux);
+
+/** Largest binlen setXMLMaxBinlen() allows */
+#define MAXXMLBINLEN (1 << 30)
+
+/** \brief Accept oneBLOB elements with binary content from the peer lp reads from.
+    \param lp a pointer to a lilxml parser.
+    \param maxlen largest binlen accepted, at most MAXXMLBINLEN.
+    \note By default, or with maxlen 0, a binlen attribute is a parse error. Only allow it on connections where binary BLOBs were asked for. The content is collected as it arrives, so memory follows the bytes actually received rather than the binlen announced.
+ */
+extern void setXMLMaxBinlen(LilXML *lp, int maxlen);
+
 /** \brief Process an XML one char at a time.
   \param lp a pointer to a lilxml parser.
   \param c one character to process.
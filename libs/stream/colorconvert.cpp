@@ -0,0 +1,615 @@
+/*
+    Bayer demosaic and RGB to YUV conversion for streaming and recording
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "colorconvert.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLORCONVERT_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define COLORCONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+namespace INDI
+{
+
+// Frames smaller than this are converted on the calling thread
+static const size_t PARALLEL_PIXELS = 1 << 20;
+
+// One output row of a Bayer frame. Rows outside the frame are mirrored, which keeps the colour of every neighbour right.
+template <typename T>
+struct BayerRow
+{
+    const T *up, *mid, *down;
+    // The other row of the 2x2 cell, for DEMOSAIC_NEAREST
+    const T *partner;
+    // The row holds red sites, otherwise blue
+    bool redRow;
+    // Even columns are green
+    bool greenFirst;
+    bool nearest;
+};
+
+// Each kernel converts from column x (even, at least 1) as far as suits its width and returns where it stopped, the caller
+// finishes the row. All kernels average with rounding, (a + b + 1) >> 1, like the scalar loop, so every path gives the same frame.
+typedef size_t (demosaic8_kernel)(const BayerRow<uint8_t> &row, uint8_t *dst, size_t x, size_t width);
+typedef size_t (demosaic16_kernel)(const BayerRow<uint16_t> &row, uint16_t *dst, size_t x, size_t width);
+// Converts a pair of rows into two luma rows and one chroma row
+typedef size_t (yuv_kernel)(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                            size_t width, bool bgr);
+
+template <typename T>
+static inline T average(T a, T b)
+{
+    return static_cast<T>((a + b + 1) >> 1);
+}
+
+template <typename T>
+static void demosaicScalar(const BayerRow<T> &row, T *dst, size_t x, size_t end, size_t width)
+{
+    for (; x < end; x++)
+    {
+        size_t l = (x > 0) ? x - 1 : 1;
+        size_t r = (x + 1 < width) ? x + 1 : x - 1;
+        T s = row.mid[x], h, v, c, d;
+
+        if (row.nearest)
+        {
+            h = (x & 1) ? row.mid[l] : row.mid[r];
+            v = row.partner[x];
+            c = h;
+            d = (x & 1) ? row.partner[l] : row.partner[r];
+        }
+        else
+        {
+            h = average(row.mid[l], row.mid[r]);
+            v = average(row.up[x], row.down[x]);
+            c = average(h, v);
+            d = average(average(row.up[l], row.up[r]), average(row.down[l], row.down[r]));
+        }
+
+        // On a red or blue site the row colour is sampled, green comes from the cross and the other colour from the diagonal.
+        // On a green site the row colour is left and right, the other colour above and below.
+        bool site = ((x & 1) != 0) == row.greenFirst;
+        T p = site ? s : h;
+        T g = site ? c : s;
+        T q = site ? d : v;
+
+        T *out = dst + 3 * x;
+        out[0] = row.redRow ? p : q;
+        out[1] = g;
+        out[2] = row.redRow ? q : p;
+    }
+}
+
+static size_t demosaic8None(const BayerRow<uint8_t> &, uint8_t *, size_t x, size_t)
+{
+    return x;
+}
+
+static size_t demosaic16None(const BayerRow<uint16_t> &, uint16_t *, size_t x, size_t)
+{
+    return x;
+}
+
+static inline int lumaOf(int r, int g, int b)
+{
+    return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+static inline int blueDifferenceOf(int r, int g, int b)
+{
+    return (-43 * r - 85 * g + 128 * b) >> 8;
+}
+
+static inline int redDifferenceOf(int r, int g, int b)
+{
+    return (128 * r - 107 * g - 21 * b) >> 8;
+}
+
+static void yuvScalar(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                      size_t x, size_t width, bool bgr)
+{
+    const int ri = bgr ? 2 : 0, bi = bgr ? 0 : 2;
+
+    for (; x + 2 <= width; x += 2)
+    {
+        int us = 0, vs = 0;
+        for (size_t i = x; i < x + 2; i++)
+        {
+            const uint8_t *p0 = row0 + 3 * i, *p1 = row1 + 3 * i;
+            y0[i] = static_cast<uint8_t>(lumaOf(p0[ri], p0[1], p0[bi]));
+            y1[i] = static_cast<uint8_t>(lumaOf(p1[ri], p1[1], p1[bi]));
+            us += blueDifferenceOf(p0[ri], p0[1], p0[bi]) + blueDifferenceOf(p1[ri], p1[1], p1[bi]);
+            vs += redDifferenceOf(p0[ri], p0[1], p0[bi]) + redDifferenceOf(p1[ri], p1[1], p1[bi]);
+        }
+        u[x / 2] = static_cast<uint8_t>((us >> 2) + 128);
+        v[x / 2] = static_cast<uint8_t>((vs >> 2) + 128);
+    }
+}
+
+static size_t yuvNone(const uint8_t *, const uint8_t *, uint8_t *, uint8_t *, uint8_t *, uint8_t *, size_t, bool)
+{
+    return 0;
+}
+
+#ifdef COLORCONVERT_X86
+__attribute__((target("ssse3"))) static inline __m128i select128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__attribute__((target("ssse3"))) static size_t demosaic8SSSE3(const BayerRow<uint8_t> &row, uint8_t *dst, size_t x, size_t width)
+{
+    const __m128i odd  = _mm_set1_epi16(static_cast<short>(0xFF00));
+    const __m128i site = row.greenFirst ? odd : _mm_xor_si128(odd, _mm_set1_epi8(-1));
+
+    // Byte shuffles spreading 16 R, G and B values over 48 bytes of RGB
+    const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    // Reads columns x - 1 to x + 16
+    for (; x + 17 <= width; x += 16)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x));
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x - 1));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x + 1));
+        __m128i h, v, c, d;
+
+        if (row.nearest)
+        {
+            h = select128(odd, l, r);
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x));
+            c = h;
+            d = select128(odd, _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x - 1)),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x + 1)));
+        }
+        else
+        {
+            __m128i u  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x));
+            __m128i dn = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x));
+            __m128i ul = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x - 1));
+            __m128i ur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x + 1));
+            __m128i dl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x - 1));
+            __m128i dr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x + 1));
+            h = _mm_avg_epu8(l, r);
+            v = _mm_avg_epu8(u, dn);
+            c = _mm_avg_epu8(h, v);
+            d = _mm_avg_epu8(_mm_avg_epu8(ul, ur), _mm_avg_epu8(dl, dr));
+        }
+
+        __m128i p = select128(site, s, h);
+        __m128i g = select128(site, c, s);
+        __m128i q = select128(site, d, v);
+        __m128i red  = row.redRow ? p : q;
+        __m128i blue = row.redRow ? q : p;
+
+        __m128i *out = reinterpret_cast<__m128i *>(dst + 3 * x);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r0), _mm_shuffle_epi8(g, g0)),
+                                           _mm_shuffle_epi8(blue, b0)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r1), _mm_shuffle_epi8(g, g1)),
+                                               _mm_shuffle_epi8(blue, b1)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r2), _mm_shuffle_epi8(g, g2)),
+                                               _mm_shuffle_epi8(blue, b2)));
+    }
+
+    return x;
+}
+
+__attribute__((target("ssse3"))) static size_t demosaic16SSSE3(const BayerRow<uint16_t> &row, uint16_t *dst, size_t x, size_t width)
+{
+    const __m128i odd  = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+    const __m128i site = row.greenFirst ? odd : _mm_xor_si128(odd, _mm_set1_epi8(-1));
+
+    // Byte shuffles spreading 8 R, G and B words over 48 bytes of RGB
+    const __m128i r0 = _mm_setr_epi8(0, 1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1, 4, 5, -1, -1);
+    const __m128i g0 = _mm_setr_epi8(-1, -1, 0, 1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1, 4, 5);
+    const __m128i b0 = _mm_setr_epi8(-1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, 6, 7, -1, -1, -1, -1, 8, 9, -1, -1, -1, -1, 10, 11);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, 6, 7, -1, -1, -1, -1, 8, 9, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(4, 5, -1, -1, -1, -1, 6, 7, -1, -1, -1, -1, 8, 9, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(10, 11, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, 10, 11, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15);
+
+    // Reads columns x - 1 to x + 8
+    for (; x + 9 <= width; x += 8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x));
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x - 1));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.mid + x + 1));
+        __m128i h, v, c, d;
+
+        if (row.nearest)
+        {
+            h = select128(odd, l, r);
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x));
+            c = h;
+            d = select128(odd, _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x - 1)),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.partner + x + 1)));
+        }
+        else
+        {
+            __m128i u  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x));
+            __m128i dn = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x));
+            __m128i ul = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x - 1));
+            __m128i ur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.up + x + 1));
+            __m128i dl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x - 1));
+            __m128i dr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row.down + x + 1));
+            h = _mm_avg_epu16(l, r);
+            v = _mm_avg_epu16(u, dn);
+            c = _mm_avg_epu16(h, v);
+            d = _mm_avg_epu16(_mm_avg_epu16(ul, ur), _mm_avg_epu16(dl, dr));
+        }
+
+        __m128i p = select128(site, s, h);
+        __m128i g = select128(site, c, s);
+        __m128i q = select128(site, d, v);
+        __m128i red  = row.redRow ? p : q;
+        __m128i blue = row.redRow ? q : p;
+
+        __m128i *out = reinterpret_cast<__m128i *>(dst + 3 * x);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r0), _mm_shuffle_epi8(g, g0)),
+                                           _mm_shuffle_epi8(blue, b0)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r1), _mm_shuffle_epi8(g, g1)),
+                                               _mm_shuffle_epi8(blue, b1)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red, r2), _mm_shuffle_epi8(g, g2)),
+                                               _mm_shuffle_epi8(blue, b2)));
+    }
+
+    return x;
+}
+
+// Split 16 packed RGB pixels into their three channels
+__attribute__((target("ssse3"))) static inline void deinterleave128(const uint8_t *src, __m128i *c0, __m128i *c1, __m128i *c2)
+{
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+
+    *c0 = _mm_or_si128(_mm_or_si128(
+                           _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                           _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+                       _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    *c1 = _mm_or_si128(_mm_or_si128(
+                           _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                           _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+                       _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    *c2 = _mm_or_si128(_mm_or_si128(
+                           _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                           _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+                       _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// Luma of 16 pixels, and the blue and red differences summed over horizontal pairs into 8 words
+__attribute__((target("ssse3"))) static inline __m128i yuvRow128(const uint8_t *src, bool bgr, __m128i *us, __m128i *vs)
+{
+    __m128i r, g, b;
+    deinterleave128(src, &r, &g, &b);
+    if (bgr)
+        std::swap(r, b);
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rl = _mm_unpacklo_epi8(r, zero), rh = _mm_unpackhi_epi8(r, zero);
+    __m128i gl = _mm_unpacklo_epi8(g, zero), gh = _mm_unpackhi_epi8(g, zero);
+    __m128i bl = _mm_unpacklo_epi8(b, zero), bh = _mm_unpackhi_epi8(b, zero);
+
+    // At most 255 * 256, so luma fits unsigned words and the differences signed words
+    const __m128i ky0 = _mm_set1_epi16(77), ky1 = _mm_set1_epi16(150), ky2 = _mm_set1_epi16(29);
+    __m128i yl = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rl, ky0), _mm_mullo_epi16(gl, ky1)),
+                                              _mm_mullo_epi16(bl, ky2)), 8);
+    __m128i yh = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rh, ky0), _mm_mullo_epi16(gh, ky1)),
+                                              _mm_mullo_epi16(bh, ky2)), 8);
+
+    const __m128i ku0 = _mm_set1_epi16(-43), ku1 = _mm_set1_epi16(-85), ku2 = _mm_set1_epi16(128);
+    __m128i ul = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rl, ku0), _mm_mullo_epi16(gl, ku1)),
+                                              _mm_mullo_epi16(bl, ku2)), 8);
+    __m128i uh = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rh, ku0), _mm_mullo_epi16(gh, ku1)),
+                                              _mm_mullo_epi16(bh, ku2)), 8);
+
+    const __m128i kv0 = _mm_set1_epi16(128), kv1 = _mm_set1_epi16(-107), kv2 = _mm_set1_epi16(-21);
+    __m128i vl = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rl, kv0), _mm_mullo_epi16(gl, kv1)),
+                                              _mm_mullo_epi16(bl, kv2)), 8);
+    __m128i vh = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rh, kv0), _mm_mullo_epi16(gh, kv1)),
+                                              _mm_mullo_epi16(bh, kv2)), 8);
+
+    *us = _mm_add_epi16(*us, _mm_hadd_epi16(ul, uh));
+    *vs = _mm_add_epi16(*vs, _mm_hadd_epi16(vl, vh));
+    return _mm_packus_epi16(yl, yh);
+}
+
+__attribute__((target("ssse3"))) static size_t yuvSSSE3(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                                                        uint8_t *u, uint8_t *v, size_t width, bool bgr)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i us = _mm_setzero_si128(), vs = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x), yuvRow128(row0 + 3 * x, bgr, &us, &vs));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x), yuvRow128(row1 + 3 * x, bgr, &us, &vs));
+
+        us = _mm_add_epi16(_mm_srai_epi16(us, 2), bias);
+        vs = _mm_add_epi16(_mm_srai_epi16(vs, 2), bias);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm_packus_epi16(us, us));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_packus_epi16(vs, vs));
+    }
+
+    return x;
+}
+#endif
+
+#ifdef COLORCONVERT_NEON
+static size_t demosaic8NEON(const BayerRow<uint8_t> &row, uint8_t *dst, size_t x, size_t width)
+{
+    const uint8x16_t odd  = vreinterpretq_u8_u16(vdupq_n_u16(0xFF00));
+    const uint8x16_t site = row.greenFirst ? odd : vmvnq_u8(odd);
+
+    for (; x + 17 <= width; x += 16)
+    {
+        uint8x16_t s = vld1q_u8(row.mid + x), l = vld1q_u8(row.mid + x - 1), r = vld1q_u8(row.mid + x + 1);
+        uint8x16_t h, v, c, d;
+
+        if (row.nearest)
+        {
+            h = vbslq_u8(odd, l, r);
+            v = vld1q_u8(row.partner + x);
+            c = h;
+            d = vbslq_u8(odd, vld1q_u8(row.partner + x - 1), vld1q_u8(row.partner + x + 1));
+        }
+        else
+        {
+            h = vrhaddq_u8(l, r);
+            v = vrhaddq_u8(vld1q_u8(row.up + x), vld1q_u8(row.down + x));
+            c = vrhaddq_u8(h, v);
+            d = vrhaddq_u8(vrhaddq_u8(vld1q_u8(row.up + x - 1), vld1q_u8(row.up + x + 1)),
+                           vrhaddq_u8(vld1q_u8(row.down + x - 1), vld1q_u8(row.down + x + 1)));
+        }
+
+        uint8x16_t p = vbslq_u8(site, s, h);
+        uint8x16_t q = vbslq_u8(site, d, v);
+        uint8x16x3_t out;
+        out.val[0] = row.redRow ? p : q;
+        out.val[1] = vbslq_u8(site, c, s);
+        out.val[2] = row.redRow ? q : p;
+        vst3q_u8(dst + 3 * x, out);
+    }
+
+    return x;
+}
+
+static size_t demosaic16NEON(const BayerRow<uint16_t> &row, uint16_t *dst, size_t x, size_t width)
+{
+    const uint16x8_t odd  = vreinterpretq_u16_u32(vdupq_n_u32(0xFFFF0000));
+    const uint16x8_t site = row.greenFirst ? odd : vmvnq_u16(odd);
+
+    for (; x + 9 <= width; x += 8)
+    {
+        uint16x8_t s = vld1q_u16(row.mid + x), l = vld1q_u16(row.mid + x - 1), r = vld1q_u16(row.mid + x + 1);
+        uint16x8_t h, v, c, d;
+
+        if (row.nearest)
+        {
+            h = vbslq_u16(odd, l, r);
+            v = vld1q_u16(row.partner + x);
+            c = h;
+            d = vbslq_u16(odd, vld1q_u16(row.partner + x - 1), vld1q_u16(row.partner + x + 1));
+        }
+        else
+        {
+            h = vrhaddq_u16(l, r);
+            v = vrhaddq_u16(vld1q_u16(row.up + x), vld1q_u16(row.down + x));
+            c = vrhaddq_u16(h, v);
+            d = vrhaddq_u16(vrhaddq_u16(vld1q_u16(row.up + x - 1), vld1q_u16(row.up + x + 1)),
+                            vrhaddq_u16(vld1q_u16(row.down + x - 1), vld1q_u16(row.down + x + 1)));
+        }
+
+        uint16x8_t p = vbslq_u16(site, s, h);
+        uint16x8_t q = vbslq_u16(site, d, v);
+        uint16x8x3_t out;
+        out.val[0] = row.redRow ? p : q;
+        out.val[1] = vbslq_u16(site, c, s);
+        out.val[2] = row.redRow ? q : p;
+        vst3q_u16(dst + 3 * x, out);
+    }
+
+    return x;
+}
+
+static inline int16x8_t yuvProduct(uint16x8_t r, uint16x8_t g, uint16x8_t b, int16_t k0, int16_t k1, int16_t k2)
+{
+    int16x8_t sum = vmulq_n_s16(vreinterpretq_s16_u16(r), k0);
+    sum = vmlaq_n_s16(sum, vreinterpretq_s16_u16(g), k1);
+    sum = vmlaq_n_s16(sum, vreinterpretq_s16_u16(b), k2);
+    return vshrq_n_s16(sum, 8);
+}
+
+// Luma of 16 pixels, and the blue and red differences summed over horizontal pairs into 8 words
+static inline uint8x16_t yuvRowNEON(const uint8_t *src, bool bgr, int16x8_t *us, int16x8_t *vs)
+{
+    uint8x16x3_t rgb = vld3q_u8(src);
+    uint8x16_t r = bgr ? rgb.val[2] : rgb.val[0], g = rgb.val[1], b = bgr ? rgb.val[0] : rgb.val[2];
+
+    uint16x8_t rl = vmovl_u8(vget_low_u8(r)), rh = vmovl_u8(vget_high_u8(r));
+    uint16x8_t gl = vmovl_u8(vget_low_u8(g)), gh = vmovl_u8(vget_high_u8(g));
+    uint16x8_t bl = vmovl_u8(vget_low_u8(b)), bh = vmovl_u8(vget_high_u8(b));
+
+    uint16x8_t yl = vmulq_n_u16(rl, 77), yh = vmulq_n_u16(rh, 77);
+    yl = vmlaq_n_u16(vmlaq_n_u16(yl, gl, 150), bl, 29);
+    yh = vmlaq_n_u16(vmlaq_n_u16(yh, gh, 150), bh, 29);
+
+    *us = vaddq_s16(*us, vpaddq_s16(yuvProduct(rl, gl, bl, -43, -85, 128), yuvProduct(rh, gh, bh, -43, -85, 128)));
+    *vs = vaddq_s16(*vs, vpaddq_s16(yuvProduct(rl, gl, bl, 128, -107, -21), yuvProduct(rh, gh, bh, 128, -107, -21)));
+    return vcombine_u8(vshrn_n_u16(yl, 8), vshrn_n_u16(yh, 8));
+}
+
+static size_t yuvNEON(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                      size_t width, bool bgr)
+{
+    const int16x8_t bias = vdupq_n_s16(128);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        int16x8_t us = vdupq_n_s16(0), vs = vdupq_n_s16(0);
+        vst1q_u8(y0 + x, yuvRowNEON(row0 + 3 * x, bgr, &us, &vs));
+        vst1q_u8(y1 + x, yuvRowNEON(row1 + 3 * x, bgr, &us, &vs));
+
+        vst1_u8(u + x / 2, vqmovun_s16(vaddq_s16(vshrq_n_s16(us, 2), bias)));
+        vst1_u8(v + x / 2, vqmovun_s16(vaddq_s16(vshrq_n_s16(vs, 2), bias)));
+    }
+
+    return x;
+}
+#endif
+
+struct Kernels
+{
+    demosaic8_kernel *demosaic8;
+    demosaic16_kernel *demosaic16;
+    yuv_kernel *yuv;
+};
+
+// pick the widest kernels this cpu can run, once
+static Kernels pickKernels()
+{
+    Kernels k = { demosaic8None, demosaic16None, yuvNone };
+
+#if defined(COLORCONVERT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        k = { demosaic8SSSE3, demosaic16SSSE3, yuvSSSE3 };
+#elif defined(COLORCONVERT_NEON)
+    k = { demosaic8NEON, demosaic16NEON, yuvNEON };
+#endif
+
+    return k;
+}
+
+static const Kernels &kernels()
+{
+    static const Kernels k = pickKernels();
+    return k;
+}
+
+// Split rows [0, height) into one band per core and run job(begin, end) on each. Bands start on even rows.
+template <typename Job>
+static void parallelRows(size_t height, size_t width, Job job)
+{
+    size_t nbands = 1;
+    if (width * height >= PARALLEL_PIXELS)
+        nbands = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t step = ((height / nbands + 1) / 2) * 2;
+    step = std::max<size_t>(step, 2);
+    std::vector<std::thread> threads;
+    for (size_t b = 1; b < nbands && b * step < height; b++)
+        threads.emplace_back(job, b * step, std::min(height, (b + 1) * step));
+    job(0, std::min(height, step));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+template <typename T>
+static void demosaic(const T *src, T *dst, size_t width, size_t height, BayerPattern pattern, DemosaicMethod method,
+                     size_t (*kernel)(const BayerRow<T> &, T *, size_t, size_t))
+{
+    if (width < 2 || height < 2)
+    {
+        for (size_t i = 0; i < width * height; i++)
+            dst[3 * i] = dst[3 * i + 1] = dst[3 * i + 2] = src[i];
+        return;
+    }
+
+    // Column and row of the red site in the first 2x2 cell
+    const size_t redX = (pattern == BAYER_GRBG || pattern == BAYER_BGGR) ? 1 : 0;
+    const size_t redY = (pattern == BAYER_GBRG || pattern == BAYER_BGGR) ? 1 : 0;
+
+    parallelRows(height, width, [&](size_t begin, size_t end)
+    {
+        for (size_t y = begin; y < end; y++)
+        {
+            BayerRow<T> row;
+            row.mid     = src + y * width;
+            row.up      = src + ((y > 0) ? y - 1 : 1) * width;
+            row.down    = src + ((y + 1 < height) ? y + 1 : y - 1) * width;
+            row.partner = (y & 1) ? row.up : row.down;
+            row.redRow  = (y & 1) == redY;
+            // Red sites sit in column redX, blue sites in the other one
+            row.greenFirst = row.redRow ? (redX == 1) : (redX == 0);
+            row.nearest = (method == DEMOSAIC_NEAREST);
+
+            T *out = dst + 3 * y * width;
+            demosaicScalar(row, out, 0, 2, width);
+            size_t x = kernel(row, out, 2, width);
+            demosaicScalar(row, out, x, width, width);
+        }
+    });
+}
+
+void demosaic8(const uint8_t *src, uint8_t *dst, size_t width, size_t height, BayerPattern pattern, DemosaicMethod method)
+{
+    demosaic(src, dst, width, height, pattern, method, kernels().demosaic8);
+}
+
+void demosaic16(const uint16_t *src, uint16_t *dst, size_t width, size_t height, BayerPattern pattern, DemosaicMethod method)
+{
+    demosaic(src, dst, width, height, pattern, method, kernels().demosaic16);
+}
+
+bool rgb24ToYUV420p(const uint8_t *src, size_t width, size_t height, uint8_t *y, uint8_t *u, uint8_t *v, bool bgr,
+                    bool bottomUp)
+{
+    if ((width % 2) || (height % 2))
+        return false;
+
+    parallelRows(height, width, [&](size_t begin, size_t end)
+    {
+        for (size_t j = begin; j < end; j += 2)
+        {
+            size_t out = bottomUp ? height - 2 - j : j;
+            const uint8_t *row0 = src + 3 * j * width, *row1 = row0 + 3 * width;
+            // Bottom up, the second row of the pair comes first
+            uint8_t *y0 = y + (bottomUp ? out + 1 : out) * width;
+            uint8_t *y1 = y + (bottomUp ? out : out + 1) * width;
+            uint8_t *uc = u + (out / 2) * (width / 2);
+            uint8_t *vc = v + (out / 2) * (width / 2);
+
+            size_t x = kernels().yuv(row0, row1, y0, y1, uc, vc, width, bgr);
+            yuvScalar(row0, row1, y0, y1, uc, vc, x, width, bgr);
+        }
+    });
+
+    return true;
+}
+
+}
@@ -0,0 +1,69 @@
+/*
+    Bayer demosaic and RGB to YUV conversion for streaming and recording
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace INDI
+{
+
+/** Colour of the first two pixels of the first two rows */
+enum BayerPattern
+{
+    BAYER_RGGB,
+    BAYER_GRBG,
+    BAYER_GBRG,
+    BAYER_BGGR
+};
+
+enum DemosaicMethod
+{
+    /** Average the nearest two or four samples of each missing colour */
+    DEMOSAIC_BILINEAR,
+    /** Take each missing colour from the same 2x2 cell, fewer reads at half the colour resolution */
+    DEMOSAIC_NEAREST
+};
+
+/**
+ * @brief demosaic8 Interpolate an 8 bit Bayer frame into packed RGB, 3 bytes per pixel.
+ * Edges are interpolated as if the frame were mirrored around its first and last rows and columns.
+ * Frames narrower or shorter than 2 pixels are copied into all three channels.
+ */
+void demosaic8(const uint8_t *src, uint8_t *dst, size_t width, size_t height, BayerPattern pattern,
+               DemosaicMethod method = DEMOSAIC_BILINEAR);
+
+/**
+ * @brief demosaic16 Interpolate a 16 bit Bayer frame into packed RGB, 3 words per pixel.
+ */
+void demosaic16(const uint16_t *src, uint16_t *dst, size_t width, size_t height, BayerPattern pattern,
+                DemosaicMethod method = DEMOSAIC_BILINEAR);
+
+/**
+ * @brief rgb24ToYUV420p Convert packed 24 bit RGB to 4:2:0 planar YUV with the BT.601 full range coefficients of RGB2YUV.
+ * Chroma is the average of each 2x2 cell.
+ * @param bgr true if the first byte of each pixel is blue
+ * @param bottomUp true to write the rows in reverse order, as RGB2YUV and BGR2YUV do unless asked to flip
+ * @return false if width or height is odd
+ */
+bool rgb24ToYUV420p(const uint8_t *src, size_t width, size_t height, uint8_t *y, uint8_t *u, uint8_t *v,
+                    bool bgr = false, bool bottomUp = false);
+
+}
@@ -0,0 +1,403 @@
+/*
+    16 to 8 bit frame conversion for streaming and recording
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "downscale16.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOWNSCALE_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define DOWNSCALE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace INDI
+{
+
+// Frames smaller than this are converted on the calling thread
+static const size_t PARALLEL_PIXELS = 1 << 21;
+
+// Each kernel converts as many pixels as suits its width and returns how many it did, the caller finishes the tail.
+// The stretch kernels compute ((clamp(v, lo, hi) - lo) * k) >> 16 with k = (255 << 16) / (hi - lo), exactly like the scalar loop.
+typedef size_t (minmax_kernel)(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi);
+typedef size_t (stretch_kernel)(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo, uint16_t hi, uint32_t k);
+
+static size_t minMaxNone(const uint16_t *, size_t, uint16_t *, uint16_t *)
+{
+    return 0;
+}
+
+static size_t stretchNone(const uint16_t *, uint8_t *, size_t, uint16_t, uint16_t, uint32_t)
+{
+    return 0;
+}
+
+#ifdef DOWNSCALE_X86
+__attribute__((target("sse4.1"))) static void minMaxReduce128(__m128i vlo, __m128i vhi, uint16_t *lo, uint16_t *hi)
+{
+    // minpos finds the smallest of eight words, the largest is the smallest of the complement
+    uint16_t l = _mm_extract_epi16(_mm_minpos_epu16(vlo), 0);
+    uint16_t h = 0xFFFF - _mm_extract_epi16(_mm_minpos_epu16(_mm_xor_si128(vhi, _mm_set1_epi16(-1))), 0);
+    *lo = std::min(*lo, l);
+    *hi = std::max(*hi, h);
+}
+
+__attribute__((target("sse4.1"))) static size_t minMaxSSE41(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi)
+{
+    __m128i vlo = _mm_set1_epi16(-1), vhi = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        vlo = _mm_min_epu16(vlo, v);
+        vhi = _mm_max_epu16(vhi, v);
+    }
+
+    minMaxReduce128(vlo, vhi, lo, hi);
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t minMaxAVX2(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi)
+{
+    __m256i vlo = _mm256_set1_epi16(-1), vhi = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        vlo = _mm256_min_epu16(vlo, v);
+        vhi = _mm256_max_epu16(vhi, v);
+    }
+
+    minMaxReduce128(_mm_min_epu16(_mm256_castsi256_si128(vlo), _mm256_extracti128_si256(vlo, 1)),
+                    _mm_max_epu16(_mm256_castsi256_si128(vhi), _mm256_extracti128_si256(vhi, 1)), lo, hi);
+    return i;
+}
+
+// Scale eight clamped and offset words to eight dwords >> 16, packed back to words
+__attribute__((target("sse4.1"))) static inline __m128i stretch8(__m128i v, __m128i vk)
+{
+    __m128i a = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(v), vk), 16);
+    __m128i b = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8)), vk), 16);
+    return _mm_packus_epi32(a, b);
+}
+
+__attribute__((target("sse4.1"))) static size_t stretchSSE41(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo,
+        uint16_t hi, uint32_t k)
+{
+    const __m128i vlo = _mm_set1_epi16(static_cast<short>(lo));
+    const __m128i vhi = _mm_set1_epi16(static_cast<short>(hi));
+    const __m128i vk  = _mm_set1_epi32(static_cast<int>(k));
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        v0 = _mm_sub_epi16(_mm_min_epu16(_mm_max_epu16(v0, vlo), vhi), vlo);
+        v1 = _mm_sub_epi16(_mm_min_epu16(_mm_max_epu16(v1, vlo), vhi), vlo);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(stretch8(v0, vk), stretch8(v1, vk)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i stretch16(__m256i v, __m256i vk)
+{
+    __m256i a = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), vk), 16);
+    __m256i b = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), vk), 16);
+    // packs work per 128 bit lane, put the quarters back in order
+    return _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+}
+
+__attribute__((target("avx2"))) static size_t stretchAVX2(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo,
+        uint16_t hi, uint32_t k)
+{
+    const __m256i vlo = _mm256_set1_epi16(static_cast<short>(lo));
+    const __m256i vhi = _mm256_set1_epi16(static_cast<short>(hi));
+    const __m256i vk  = _mm256_set1_epi32(static_cast<int>(k));
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+        v0 = _mm256_sub_epi16(_mm256_min_epu16(_mm256_max_epu16(v0, vlo), vhi), vlo);
+        v1 = _mm256_sub_epi16(_mm256_min_epu16(_mm256_max_epu16(v1, vlo), vhi), vlo);
+        __m256i out = _mm256_permute4x64_epi64(_mm256_packus_epi16(stretch16(v0, vk), stretch16(v1, vk)), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), out);
+    }
+
+    return i;
+}
+#endif
+
+#ifdef DOWNSCALE_NEON
+static size_t minMaxNEON(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi)
+{
+    uint16x8_t vlo = vdupq_n_u16(0xFFFF), vhi = vdupq_n_u16(0);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t v = vld1q_u16(src + i);
+        vlo = vminq_u16(vlo, v);
+        vhi = vmaxq_u16(vhi, v);
+    }
+
+    *lo = std::min(*lo, vminvq_u16(vlo));
+    *hi = std::max(*hi, vmaxvq_u16(vhi));
+    return i;
+}
+
+static size_t stretchNEON(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo, uint16_t hi, uint32_t k)
+{
+    const uint16x8_t vlo = vdupq_n_u16(lo);
+    const uint16x8_t vhi = vdupq_n_u16(hi);
+    const uint32x4_t vk  = vdupq_n_u32(k);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t v = vsubq_u16(vminq_u16(vmaxq_u16(vld1q_u16(src + i), vlo), vhi), vlo);
+        uint16x4_t a = vshrn_n_u32(vmulq_u32(vmovl_u16(vget_low_u16(v)), vk), 16);
+        uint16x4_t b = vshrn_n_u32(vmulq_u32(vmovl_u16(vget_high_u16(v)), vk), 16);
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(a, b)));
+    }
+
+    return i;
+}
+#endif
+
+struct Kernels
+{
+    minmax_kernel *minMax;
+    stretch_kernel *stretch;
+};
+
+// pick the widest kernels this cpu can run, once
+static Kernels pickKernels()
+{
+    Kernels k = { minMaxNone, stretchNone };
+
+#if defined(DOWNSCALE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        k = { minMaxAVX2, stretchAVX2 };
+    else if (__builtin_cpu_supports("sse4.1"))
+        k = { minMaxSSE41, stretchSSE41 };
+#elif defined(DOWNSCALE_NEON)
+    k = { minMaxNEON, stretchNEON };
+#endif
+
+    return k;
+}
+
+static Kernels &kernels()
+{
+    static Kernels k = pickKernels();
+    return k;
+}
+
+bool useDownscaleKernels(const char *name)
+{
+    Kernels k;
+
+    if (!strcmp(name, "auto"))
+        k = pickKernels();
+    else if (!strcmp(name, "none"))
+        k = { minMaxNone, stretchNone };
+#if defined(DOWNSCALE_X86)
+    else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+        k = { minMaxAVX2, stretchAVX2 };
+    else if (!strcmp(name, "sse4.1") && __builtin_cpu_supports("sse4.1"))
+        k = { minMaxSSE41, stretchSSE41 };
+#elif defined(DOWNSCALE_NEON)
+    else if (!strcmp(name, "neon"))
+        k = { minMaxNEON, stretchNEON };
+#endif
+    else
+        return false;
+
+    kernels() = k;
+    return true;
+}
+
+// One helper thread per extra core, started on the first large frame and kept for the life of the process
+class BandPool
+{
+    public:
+        static BandPool &instance()
+        {
+            // Never destroyed, the helpers may still wait on it at exit
+            static BandPool *pool = new BandPool();
+            return *pool;
+        }
+
+        size_t size() const
+        {
+            return m_Helpers.size() + 1;
+        }
+
+        // Run job(0) on the calling thread and job(1) .. job(size() - 1) on the helpers.
+        // Returns false without running anything if another frame is using the helpers.
+        bool run(const std::function<void(size_t)> &job)
+        {
+            std::unique_lock<std::mutex> busy(m_Busy, std::try_to_lock);
+            if (!busy.owns_lock())
+                return false;
+
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Job     = &job;
+                m_Pending = m_Helpers.size();
+                m_Generation++;
+            }
+            m_Go.notify_all();
+
+            job(0);
+
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Done.wait(lock, [this] { return m_Pending == 0; });
+            m_Job = nullptr;
+            return true;
+        }
+
+    private:
+        BandPool()
+        {
+            size_t n = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t band = 1; band < n; band++)
+                m_Helpers.emplace_back(&BandPool::helper, this, band);
+        }
+
+        void helper(size_t band)
+        {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(m_Lock);
+            for (;;)
+            {
+                m_Go.wait(lock, [&] { return m_Generation != seen; });
+                seen = m_Generation;
+                const std::function<void(size_t)> *job = m_Job;
+
+                lock.unlock();
+                (*job)(band);
+                lock.lock();
+
+                if (--m_Pending == 0)
+                    m_Done.notify_one();
+            }
+        }
+
+        std::mutex m_Busy;
+        std::mutex m_Lock;
+        std::condition_variable m_Go, m_Done;
+        const std::function<void(size_t)> *m_Job { nullptr };
+        size_t m_Pending { 0 };
+        uint64_t m_Generation { 0 };
+        std::vector<std::thread> m_Helpers;
+};
+
+// Number of bands parallelBands() splits n pixels into
+static size_t bandCount(size_t n)
+{
+    return n >= PARALLEL_PIXELS ? BandPool::instance().size() : 1;
+}
+
+// Split [0, n) into bandCount(n) contiguous bands and run job(begin, end, band) on each
+template <typename Job>
+static void parallelBands(size_t n, Job job)
+{
+    size_t nbands = bandCount(n);
+
+    // Keep band edges on 64 pixel boundaries so every band starts aligned for the kernels
+    size_t step = ((n / nbands + 63) / 64) * 64;
+    std::function<void(size_t)> band = [&](size_t b)
+    {
+        if (b * step < n)
+            job(b * step, std::min(n, (b + 1) * step), b);
+    };
+
+    // The stream and record stages may both convert a frame, the second one does it alone
+    if (nbands == 1 || !BandPool::instance().run(band))
+        for (size_t b = 0; b < nbands; b++)
+            band(b);
+}
+
+static void minMaxBand(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi)
+{
+    size_t i = kernels().minMax(src, n, lo, hi);
+    for (; i < n; i++)
+    {
+        *lo = std::min(*lo, src[i]);
+        *hi = std::max(*hi, src[i]);
+    }
+}
+
+void minMax16(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi)
+{
+    size_t nbands = bandCount(n);
+    std::vector<uint16_t> los(nbands, 0xFFFF), his(nbands, 0);
+
+    parallelBands(n, [&](size_t begin, size_t end, size_t band)
+    {
+        minMaxBand(src + begin, end - begin, &los[band], &his[band]);
+    });
+
+    *lo = *std::min_element(los.begin(), los.end());
+    *hi = *std::max_element(his.begin(), his.end());
+}
+
+void stretch16to8(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo, uint16_t hi)
+{
+    if (hi < lo)
+        std::swap(lo, hi);
+
+    // a flat frame maps to black
+    uint32_t k = (hi > lo) ? (255u << 16) / (hi - lo) : 0;
+
+    parallelBands(n, [&](size_t begin, size_t end, size_t)
+    {
+        size_t i = begin + kernels().stretch(src + begin, dst + begin, end - begin, lo, hi, k);
+        for (; i < end; i++)
+            dst[i] = static_cast<uint8_t>(((std::min(std::max(src[i], lo), hi) - lo) * k) >> 16);
+    });
+}
+
+void lut16to8(const uint16_t *src, uint8_t *dst, size_t n, const uint8_t *lut)
+{
+    // A table lookup does not vectorize well, so this one only gains from more cores
+    parallelBands(n, [&](size_t begin, size_t end, size_t)
+    {
+        for (size_t i = begin; i < end; i++)
+            dst[i] = lut[src[i]];
+    });
+}
+
+}
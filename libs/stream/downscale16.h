@@ -0,0 +1,54 @@
+/*
+    16 to 8 bit frame conversion for streaming and recording
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace INDI
+{
+
+/**
+ * @brief minMax16 Find the smallest and largest value in a 16 bit frame.
+ * @param src pixels
+ * @param n number of pixels
+ * @param lo receives the minimum, 65535 if n is 0
+ * @param hi receives the maximum, 0 if n is 0
+ */
+void minMax16(const uint16_t *src, size_t n, uint16_t *lo, uint16_t *hi);
+
+/**
+ * @brief stretch16to8 Map [lo, hi] linearly onto [0, 255], clamping values outside the range.
+ */
+void stretch16to8(const uint16_t *src, uint8_t *dst, size_t n, uint16_t lo, uint16_t hi);
+
+/**
+ * @brief lut16to8 Map each pixel through a 65536 entry table.
+ */
+void lut16to8(const uint16_t *src, uint8_t *dst, size_t n, const uint8_t *lut);
+
+/**
+ * @brief useDownscaleKernels Force the vector kernels used by minMax16 and stretch16to8, for tests.
+ * @param name "avx2", "sse4.1", "neon", "none" for the scalar loops or "auto" for the best this cpu can run
+ * @return false if the kernels are not compiled in or this cpu can not run them, the current ones are kept then.
+ */
+bool useDownscaleKernels(const char *name);
+
+}
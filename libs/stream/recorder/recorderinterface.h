@@ -69,12 +69,19 @@ class RecorderInterface
     virtual bool setFPS(float FPS) { m_FPS = FPS; return true; }
     virtual bool open(const char *filename, char *errmsg)                          = 0;
     virtual bool close()                                                           = 0;
-    // when frame is in known encoding format
-    virtual bool writeFrame(const uint8_t *frame, uint32_t nbytes) = 0;
+    // when frame is in known encoding format. timestamp is the capture time in microseconds
+    // since the Unix epoch (UTC), or 0 when unknown, in which case the recorder uses the current time
+    virtual bool writeFrame(const uint8_t *frame, uint32_t nbytes, uint64_t timestamp) = 0;
     // If streaming is enabled, then any subframing is already done by the stream recorder
     // and no need to do any further subframing operations. Otherwise, subframing must be done.
     // This is to reduce process time and save memory for a dedicated subframe buffer
     virtual void setStreamEnabled(bool enable) = 0;
+    // Recorders writing from a background thread report their sustained write rate in MB/s
+    // and the number of frames lost since open()
+    virtual double getWriteRate() { return 0; }
+    virtual uint32_t getDroppedFrames() { return 0; }
+    // Bypass the page cache when the recorder and the file system support it
+    virtual void setDirectWrite(bool enable) { INDI_UNUSED(enable); }
 
   protected:
     const char *name;
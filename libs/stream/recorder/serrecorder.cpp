@@ -28,9 +28,13 @@
 #include "serrecorder.h"
 #include "jpegutils.h"
 
+#include <algorithm>
 #include <ctime>
 #include <cerrno>
 #include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 
@@ -54,13 +58,13 @@ SER_Recorder::SER_Recorder()
     else
         serh.LittleEndian = SER_BIG_ENDIAN;
     isRecordingActive = false;
-    f                 = nullptr;
 
     jpegBuffer = static_cast<uint8_t*>(malloc(1));
 }
 
 SER_Recorder::~SER_Recorder()
 {
+    close();
     free(jpegBuffer);
 }
 
@@ -71,49 +75,36 @@ bool SER_Recorder::is_little_endian()
     return black_magic == 0x01;
 }
 
-void SER_Recorder::write_int_le(uint32_t *i)
+uint8_t *SER_Recorder::write_int_le(uint8_t *p, uint32_t i)
 {
-    if (is_little_endian())
-        fwrite((const void *)(i), sizeof(uint32_t), 1, f);
-    else
-    {
-        unsigned char *c = (unsigned char *)i;
-        fwrite((const void *)(c + 3), sizeof(char), 1, f);
-        fwrite((const void *)(c + 2), sizeof(char), 1, f);
-        fwrite((const void *)(c + 1), sizeof(char), 1, f);
-        fwrite((const void *)(c), sizeof(char), 1, f);
-    }
+    p[0] = i & 0xFF;
+    p[1] = (i >> 8) & 0xFF;
+    p[2] = (i >> 16) & 0xFF;
+    p[3] = (i >> 24) & 0xFF;
+    return p + 4;
 }
 
-void SER_Recorder::write_long_int_le(uint64_t *i)
+uint8_t *SER_Recorder::write_long_int_le(uint8_t *p, uint64_t i)
 {
-    if (is_little_endian())
-    {
-        fwrite((const void *)((uint32_t *)i), sizeof(int), 1, f);
-        fwrite((const void *)((uint32_t *)(i) + 1), sizeof(int), 1, f);
-    }
-    else
-    {
-        write_int_le((uint32_t *)(i) + 1);
-        write_int_le((uint32_t *)(i));
-    }
+    p = write_int_le(p, static_cast<uint32_t>(i));
+    return write_int_le(p, static_cast<uint32_t>(i >> 32));
 }
 
-void SER_Recorder::write_header(ser_header *s)
+void SER_Recorder::write_header(const ser_header *s, uint8_t *p)
 {
-    fwrite((const void *)(s->FileID), sizeof(char), 14, f);
-    write_int_le(&(s->LuID));
-    write_int_le(&(s->ColorID));
-    write_int_le(&(s->LittleEndian));
-    write_int_le(&(s->ImageWidth));
-    write_int_le(&(s->ImageHeight));
-    write_int_le(&(s->PixelDepth));
-    write_int_le(&(s->FrameCount));
-    fwrite((const void *)(s->Observer), sizeof(char), 40, f);
-    fwrite((const void *)(s->Instrume), sizeof(char), 40, f);
-    fwrite((const void *)(s->Telescope), sizeof(char), 40, f);
-    write_long_int_le(&(s->DateTime));
-    write_long_int_le(&(s->DateTime_UTC));
+    memcpy(p, s->FileID, 14);
+    p = write_int_le(p + 14, s->LuID);
+    p = write_int_le(p, s->ColorID);
+    p = write_int_le(p, s->LittleEndian);
+    p = write_int_le(p, s->ImageWidth);
+    p = write_int_le(p, s->ImageHeight);
+    p = write_int_le(p, s->PixelDepth);
+    p = write_int_le(p, s->FrameCount);
+    memcpy(p, s->Observer, 40);
+    memcpy(p + 40, s->Instrume, 40);
+    memcpy(p + 80, s->Telescope, 40);
+    p = write_long_int_le(p + 120, s->DateTime);
+    write_long_int_le(p, s->DateTime_UTC);
 }
 
 bool SER_Recorder::setPixelFormat(INDI_PIXEL_FORMAT pixelFormat, uint8_t pixelDepth)
@@ -173,18 +164,58 @@ bool SER_Recorder::setSize(uint16_t width, uint16_t height)
 
 bool SER_Recorder::open(const char *filename, char *errmsg)
 {
+    std::lock_guard<std::mutex> guard(m_RecordLock);
+
     if (isRecordingActive)
         return false;
     serh.FrameCount = 0;
-    if ((f = fopen(filename, "w")) == nullptr)
+
+    int flags      = O_WRONLY | O_CREAT | O_TRUNC;
+    m_DirectActive = false;
+#ifdef O_DIRECT
+    // File systems without O_DIRECT support (tmpfs, some network mounts) refuse the flag, use the page cache there
+    if (m_DirectWrite && (fd = ::open(filename, flags | O_DIRECT, 0666)) >= 0)
+        m_DirectActive = true;
+#endif
+    if (fd < 0 && (fd = ::open(filename, flags, 0666)) < 0)
     {
         snprintf(errmsg, ERRMSGSIZ, "recorder open error %d, %s\n", errno, strerror(errno));
         return false;
     }
 
+    for (size_t i = 0; i < BATCH_COUNT; i++)
+    {
+        void *batch = nullptr;
+        if (posix_memalign(&batch, BATCH_ALIGN, BATCH_SIZE) != 0)
+        {
+            snprintf(errmsg, ERRMSGSIZ, "recorder cannot allocate %zu bytes of write buffers\n", BATCH_COUNT * BATCH_SIZE);
+            for (auto oneBatch : m_FreeBatches)
+                free(oneBatch);
+            m_FreeBatches.clear();
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        m_FreeBatches.push_back(static_cast<uint8_t *>(batch));
+    }
+
+    m_CurrentBatch = { m_FreeBatches.back(), 0, 0 };
+    m_FreeBatches.pop_back();
+    m_WriteOffset   = 0;
+    m_Allocated     = 0;
+    m_WriteError    = false;
+    m_BytesWritten  = 0;
+    m_DroppedFrames = 0;
+    m_WriterExit    = false;
+    m_OpenTime      = std::chrono::steady_clock::now();
+    m_Writer        = std::thread(&SER_Recorder::writerThread, this);
+
+    // The final header is written again on close, once the frame count is known
+    uint8_t header[SER_HEADER_SIZE];
     serh.DateTime     = getLocalTimeStamp();
     serh.DateTime_UTC = getUTCTimeStamp();
-    write_header(&serh);
+    write_header(&serh, header);
+    append(header, SER_HEADER_SIZE, false);
     frame_size        = serh.ImageWidth * serh.ImageHeight * (serh.PixelDepth <= 8 ? 1 : 2) * number_of_planes;
     isRecordingActive = true;
 
@@ -195,27 +226,194 @@ bool SER_Recorder::open(const char *filename, char *errmsg)
 
 bool SER_Recorder::close()
 {
-    if (f)
+    std::lock_guard<std::mutex> guard(m_RecordLock);
+
+    if (fd >= 0)
     {
         // Write all timestamps
+        uint8_t stamp[8];
         for (auto value : frameStamps)
-            write_long_int_le(&value);
+        {
+            write_long_int_le(stamp, value);
+            append(stamp, sizeof(stamp), false);
+        }
 
         frameStamps.clear();
 
-        fseek(f, 0L, SEEK_SET);
-        write_header(&serh);
-        fclose(f);
-        f = nullptr;
+        stopWriter();
+
+        // The tail of the file is not a multiple of the block size, so finish it through the page cache
+#ifdef O_DIRECT
+        if (m_DirectActive)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        m_DirectActive = false;
+#endif
+        if (!m_WriteError && !writeAll(m_CurrentBatch.data, m_CurrentBatch.length))
+            m_WriteError = true;
+        if (m_WriteError)
+            m_DroppedFrames += m_CurrentBatch.frames;
+
+        // Drop whatever was preallocated past the last timestamp
+        if (ftruncate(fd, m_WriteOffset) != 0)
+            m_WriteError = true;
+
+        uint8_t header[SER_HEADER_SIZE];
+        write_header(&serh, header);
+        if (pwrite(fd, header, SER_HEADER_SIZE, 0) != static_cast<ssize_t>(SER_HEADER_SIZE))
+            m_WriteError = true;
+        ::close(fd);
+        fd = -1;
+
+        free(m_CurrentBatch.data);
+        m_CurrentBatch = { nullptr, 0, 0 };
+        for (auto batch : m_FreeBatches)
+            free(batch);
+        m_FreeBatches.clear();
     }
 
     isRecordingActive = false;
+    return !m_WriteError;
+}
+
+double SER_Recorder::getWriteRate()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_OpenTime;
+    if (elapsed.count() <= 0)
+        return 0;
+    return m_BytesWritten / elapsed.count() / (1024.0 * 1024.0);
+}
+
+bool SER_Recorder::append(const uint8_t *data, size_t size, bool frameEnd)
+{
+    while (size > 0)
+    {
+        size_t n = std::min(size, BATCH_SIZE - m_CurrentBatch.length);
+        memcpy(m_CurrentBatch.data + m_CurrentBatch.length, data, n);
+        m_CurrentBatch.length += n;
+        data += n;
+        size -= n;
+
+        if (size == 0 && frameEnd)
+            m_CurrentBatch.frames++;
+
+        if (m_CurrentBatch.length == BATCH_SIZE && !submitBatch())
+            return false;
+    }
+
+    return !m_WriteError;
+}
+
+bool SER_Recorder::submitBatch()
+{
+    std::unique_lock<std::mutex> lock(m_WriteLock);
+
+    m_FullBatches.push_back(m_CurrentBatch);
+    m_BatchReady.notify_one();
+
+    // Only blocks when the disk is BATCH_COUNT batches behind the camera
+    m_BatchFree.wait(lock, [this]() { return !m_FreeBatches.empty(); });
+    m_CurrentBatch = { m_FreeBatches.back(), 0, 0 };
+    m_FreeBatches.pop_back();
+
+    return !m_WriteError;
+}
+
+bool SER_Recorder::writeAll(const uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, m_WriteOffset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+#ifdef O_DIRECT
+            // Some file systems accept O_DIRECT on open but need a larger alignment than ours
+            if (errno == EINVAL && m_DirectActive)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                m_DirectActive = false;
+                continue;
+            }
+#endif
+            return false;
+        }
+
+        data += n;
+        size -= n;
+        m_WriteOffset += n;
+        m_BytesWritten += n;
+    }
+
     return true;
 }
 
-bool SER_Recorder::writeFrame(const uint8_t *frame, uint32_t nbytes)
+void SER_Recorder::preallocate(off_t end)
+{
+#ifdef __linux__
+    if (end <= m_Allocated)
+        return;
+
+    // Allocate well ahead of the writer so extents stay contiguous and writes need no block allocation.
+    // The file is truncated back to its real size on close.
+    off_t length = std::max(static_cast<off_t>(PREALLOCATE_SIZE), end - m_Allocated);
+    if (fallocate(fd, 0, m_Allocated, length) == 0)
+        m_Allocated += length;
+    else
+        m_Allocated = std::numeric_limits<off_t>::max();
+#else
+    INDI_UNUSED(end);
+#endif
+}
+
+void SER_Recorder::writerThread()
+{
+    for (;;)
+    {
+        WriteBatch batch;
+        {
+            std::unique_lock<std::mutex> lock(m_WriteLock);
+            m_BatchReady.wait(lock, [this]() { return m_WriterExit || !m_FullBatches.empty(); });
+            if (m_FullBatches.empty())
+                break;
+            batch = m_FullBatches.front();
+            m_FullBatches.pop_front();
+        }
+
+        // After a write error the remaining batches are discarded so the recording thread never blocks
+        if (!m_WriteError)
+        {
+            preallocate(m_WriteOffset + batch.length);
+            if (!writeAll(batch.data, batch.length))
+                m_WriteError = true;
+        }
+        if (m_WriteError)
+            m_DroppedFrames += batch.frames;
+
+        {
+            std::lock_guard<std::mutex> lock(m_WriteLock);
+            m_FreeBatches.push_back(batch.data);
+        }
+        m_BatchFree.notify_one();
+    }
+}
+
+void SER_Recorder::stopWriter()
 {
-    if (!isRecordingActive)
+    {
+        std::lock_guard<std::mutex> lock(m_WriteLock);
+        m_WriterExit = true;
+    }
+    m_BatchReady.notify_one();
+    if (m_Writer.joinable())
+        m_Writer.join();
+}
+
+bool SER_Recorder::writeFrame(const uint8_t *frame, uint32_t nbytes, uint64_t timestamp)
+{
+    std::lock_guard<std::mutex> guard(m_RecordLock);
+
+    if (!isRecordingActive || m_WriteError)
         return false;
 
 #if 0
@@ -254,7 +452,7 @@ bool SER_Recorder::writeFrame(const uint8_t *frame, uint32_t nbytes)
    }
 #endif
 
-    frameStamps.push_back(getUTCTimeStamp());
+    uint64_t serTimestamp = (timestamp > 0) ? utcTo64BitTS(timestamp) : getUTCTimeStamp();
 
     // Not technically pixel format, but let's use this for now.
     if (m_PixelFormat == INDI_JPG)
@@ -267,10 +465,12 @@ bool SER_Recorder::writeFrame(const uint8_t *frame, uint32_t nbytes)
         serh.ImageWidth = w;
         serh.ImageHeight = h;
         serh.ColorID = (naxis == 3) ? SER_RGB : SER_MONO;
-        fwrite(jpegBuffer, memsize, 1, f);
+        if (!append(jpegBuffer, memsize, true))
+            return false;
     }
-    else
-        fwrite(frame, nbytes, 1, f);
+    else if (!append(frame, nbytes, true))
+        return false;
+    frameStamps.push_back(serTimestamp);
     serh.FrameCount += 1;
     return true;
 }
@@ -305,6 +505,12 @@ bool SER_Recorder::is_leap_year(uint32_t year)
     }
 }
 
+uint64_t SER_Recorder::utcTo64BitTS(uint64_t timestamp)
+{
+    // Same epoch as dateTo64BitTS (0001-01-01), without walking the calendar for every frame
+    return m_septaseconds_unix_epoch + timestamp * m_sepaseconds_per_microsecond;
+}
+
 uint64_t SER_Recorder::getUTCTimeStamp()
 {
     uint64_t utcTS;
@@ -23,8 +23,15 @@
 
 #include "recorderinterface.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <mutex>
 #include <stdio.h>
+#include <sys/types.h>
+#include <thread>
 
 typedef struct ser_header
 {
@@ -66,6 +73,10 @@ namespace INDI
 
 /**
  * @brief The SER_Recorder class implements recording of video streams in SER format.
+ *
+ * Frames are copied into large page aligned batches which a dedicated writer thread appends to
+ * the file, so the recording thread never waits on the disk unless all batches are in flight.
+ * The file is preallocated ahead of the writer and can optionally be opened with O_DIRECT.
  */
 class SER_Recorder : public RecorderInterface
 {
@@ -78,21 +89,27 @@ class SER_Recorder : public RecorderInterface
     virtual bool setSize(uint16_t width, uint16_t height);    
     virtual bool open(const char *filename, char *errmsg);
     virtual bool close();
-    virtual bool writeFrame(const uint8_t *frame, uint32_t nbytes);
+    virtual bool writeFrame(const uint8_t *frame, uint32_t nbytes, uint64_t timestamp);
     virtual void setStreamEnabled(bool enable) { isStreamingActive = enable; }
+    virtual double getWriteRate();
+    virtual uint32_t getDroppedFrames() { return m_DroppedFrames; }
+    virtual void setDirectWrite(bool enable) { m_DirectWrite = enable; }
 
     // Public constants
     static const uint64_t C_SEPASECONDS_PER_SECOND = 10000000;
 
   protected:
-    uint64_t utcTo64BitTS();
+    // Microseconds since the Unix epoch (UTC) to SER timestamp
+    uint64_t utcTo64BitTS(uint64_t timestamp);
     bool is_little_endian();
-    void write_int_le(uint32_t *i);
-    void write_long_int_le(uint64_t *i);
-    void write_header(ser_header *s);
+    uint8_t *write_int_le(uint8_t *p, uint32_t i);
+    uint8_t *write_long_int_le(uint8_t *p, uint64_t i);
+    // Serialise the header into SER_HEADER_SIZE bytes
+    void write_header(const ser_header *s, uint8_t *p);
+    static const size_t SER_HEADER_SIZE = 178;
     ser_header serh;
     bool isRecordingActive = false, isStreamingActive = false;
-    FILE *f;
+    int fd = -1;
     uint32_t frame_size;
     uint32_t number_of_planes;
     uint16_t rawWidth = 0, rawHeight = 0;
@@ -121,8 +138,51 @@ class SER_Recorder : public RecorderInterface
     static const uint64_t m_septaseconds_per_day         = m_septaseconds_per_hour * 24;
     static const uint32_t m_days_in_400_years            = 303 * 365 + 97 * 366;
     static const uint64_t m_septaseconds_per_400_years   = m_days_in_400_years * m_septaseconds_per_day;
+    static const uint64_t m_septaseconds_unix_epoch      = 621355968000000000ULL;
 
     uint8_t *jpegBuffer=nullptr;
     INDI_PIXEL_FORMAT m_PixelFormat;
+
+    // Background writer
+    struct WriteBatch
+    {
+        uint8_t *data;
+        size_t length;
+        uint32_t frames;    // frames that end inside this batch
+    };
+
+    bool append(const uint8_t *data, size_t size, bool frameEnd);
+    bool submitBatch();
+    bool writeAll(const uint8_t *data, size_t size);
+    void preallocate(off_t end);
+    void writerThread();
+    void stopWriter();
+
+    // Serialises open(), close() and writeFrame() which may run on different threads
+    std::mutex m_RecordLock;
+
+    std::mutex m_WriteLock;
+    std::condition_variable m_BatchReady, m_BatchFree;
+    std::deque<WriteBatch> m_FullBatches;
+    std::vector<uint8_t *> m_FreeBatches;
+    WriteBatch m_CurrentBatch { nullptr, 0, 0 };
+    bool m_WriterExit { false };
+    std::thread m_Writer;
+
+    off_t m_WriteOffset { 0 };
+    off_t m_Allocated { 0 };
+    bool m_DirectWrite { false };
+    bool m_DirectActive { false };
+
+    std::atomic<bool> m_WriteError { false };
+    std::atomic<uint64_t> m_BytesWritten { 0 };
+    std::atomic<uint32_t> m_DroppedFrames { 0 };
+    std::chrono::steady_clock::time_point m_OpenTime;
+
+    // Batches are a multiple of the page size so O_DIRECT writes stay aligned
+    static const size_t BATCH_SIZE  = 8 * 1024 * 1024;
+    static const size_t BATCH_COUNT = 4;
+    static const size_t BATCH_ALIGN = 4096;
+    static const off_t PREALLOCATE_SIZE = 256 * 1024 * 1024;
 };
 }
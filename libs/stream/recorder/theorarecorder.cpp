@@ -22,6 +22,7 @@
 #include "theorarecorder.h"
 #include "jpegutils.h"
 #include "ccvt.h"
+#include "colorconvert.h"
 
 #define _FILE_OFFSET_BITS 64
 
@@ -414,8 +415,11 @@ bool TheoraRecorder::close()
     return true;
 }
 
-bool TheoraRecorder::writeFrame(const uint8_t *frame, uint32_t nbytes)
+bool TheoraRecorder::writeFrame(const uint8_t *frame, uint32_t nbytes, uint64_t timestamp)
 {
+    // Ogg pages are timed from the frame rate
+    INDI_UNUSED(timestamp);
+
     if (!isRecordingActive)
         return false;
 
@@ -428,7 +432,7 @@ bool TheoraRecorder::writeFrame(const uint8_t *frame, uint32_t nbytes)
     }
     else if (m_PixelFormat == INDI_RGB)
     {
-        BGR2YUV(rawWidth, rawHeight, const_cast<uint8_t*>(frame), ycbcr[0].data, ycbcr[1].data, ycbcr[2].data, 0);
+        INDI::rgb24ToYUV420p(frame, rawWidth, rawHeight, ycbcr[0].data, ycbcr[1].data, ycbcr[2].data, false, true);
     }
     else if (m_PixelFormat == INDI_JPG)
     {
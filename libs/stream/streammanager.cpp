@@ -23,12 +23,15 @@
 #include <config.h>
 
 #include "streammanager.h"
+#include "downscale16.h"
 #include "indiccd.h"
 #include "indisensorinterface.h"
 #include "indilogger.h"
 
 #include <cerrno>
-#include <signal.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <cmath>
 
@@ -46,22 +49,6 @@ StreamManager::StreamManager(DefaultDevice *mainDevice)
 
     prepareGammaLUT();
 
-    // Timer
-    // now use BSD setimer to avoi librt dependency
-    //sevp.sigev_notify=SIGEV_NONE;
-    //timer_create(CLOCK_MONOTONIC, &sevp, &fpstimer);
-    //fpssettings.it_interval.tv_sec=24*3600;
-    //fpssettings.it_interval.tv_nsec=0;
-    //fpssettings.it_value=fpssettings.it_interval;
-    //timer_settime(fpstimer, 0, &fpssettings, nullptr);
-
-    struct itimerval fpssettings;
-    fpssettings.it_interval.tv_sec  = 24 * 3600;
-    fpssettings.it_interval.tv_usec = 0;
-    fpssettings.it_value            = fpssettings.it_interval;
-    signal(SIGALRM, SIG_IGN); //portable
-    setitimer(ITIMER_REAL, &fpssettings, nullptr);
-
     recorderManager = new RecorderManager();
     recorder    = recorderManager->getDefaultRecorder();
     direct_record = false;
@@ -74,10 +61,36 @@ StreamManager::StreamManager(DefaultDevice *mainDevice)
     encoder->init(currentDevice);
 
     LOGF_DEBUG("Using default encoder (%s)", encoder->getName());
+
+    // Halts of the record stage are handled on the event loop
+    if (pipe(m_HaltNotify) == 0)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            fcntl(m_HaltNotify[i], F_SETFL, fcntl(m_HaltNotify[i], F_GETFL) | O_NONBLOCK);
+            fcntl(m_HaltNotify[i], F_SETFD, FD_CLOEXEC);
+        }
+        m_HaltCallbackID = IEAddCallback(m_HaltNotify[0], &StreamManager::handleRecordHaltHelper, this);
+    }
+    if (m_HaltCallbackID < 0)
+        LOG_ERROR("Cannot watch the record stage, recording must be stopped by hand.");
+
+    // The preview may skip frames, the recording may not
+    startStage(m_StreamStage, STREAM_STAGE_DEPTH, true, &StreamManager::streamFrame);
+    startStage(m_RecordStage, RECORD_STAGE_DEPTH, false, &StreamManager::recordFrame);
 }
 
 StreamManager::~StreamManager()
 {
+    stopStage(m_StreamStage);
+    stopStage(m_RecordStage);
+
+    if (m_HaltCallbackID >= 0)
+        IERmCallback(m_HaltCallbackID);
+    for (int i = 0; i < 2; i++)
+        if (m_HaltNotify[i] >= 0)
+            ::close(m_HaltNotify[i]);
+
     delete (recorderManager);
     delete (encoderManager);
     delete [] downscaleBuffer;
@@ -109,6 +122,13 @@ bool StreamManager::initProperties()
     IUFillNumber(&FpsN[FPS_AVERAGE], "AVG_FPS", "Average (1 sec.)", "%3.2f", 0.0, 999.0, 0.0, 30);
     IUFillNumberVector(&FpsNP, FpsN, NARRAY(FpsN), getDeviceName(), "FPS", "FPS", STREAM_TAB, IP_RO, 60, IPS_IDLE);
 
+    /* Frame pipeline counters */
+    IUFillNumber(&FramesN[FRAMES_ENCODED], "FRAMES_ENCODED", "Encoded", "%.f", 0, 0, 0, 0);
+    IUFillNumber(&FramesN[FRAMES_DROPPED], "FRAMES_DROPPED", "Dropped", "%.f", 0, 0, 0, 0);
+    IUFillNumber(&FramesN[FRAMES_RECORDED], "FRAMES_RECORDED", "Recorded", "%.f", 0, 0, 0, 0);
+    IUFillNumber(&FramesN[FRAMES_LATENCY], "FRAMES_LATENCY", "Latency (ms)", "%.1f", 0, 0, 0, 0);
+    IUFillNumberVector(&FramesNP, FramesN, NARRAY(FramesN), getDeviceName(), "STREAM_FRAMES", "Frames", STREAM_TAB, IP_RO, 60, IPS_IDLE);
+
     /* Record Frames */
     /* File */
     std::string defaultDirectory = std::string(getenv("HOME")) + std::string("/indi__D_");
@@ -123,6 +143,18 @@ bool StreamManager::initProperties()
     IUFillNumberVector(&RecordOptionsNP, RecordOptionsN, NARRAY(RecordOptionsN), getDeviceName(), "RECORD_OPTIONS",
                        "Record Options", STREAM_TAB, IP_RW, 60, IPS_IDLE);
 
+    /* Record write statistics */
+    IUFillNumber(&RecordStatsN[RECORD_RATE], "RECORD_RATE", "Write (MB/s)", "%.1f", 0, 0, 0, 0);
+    IUFillNumber(&RecordStatsN[RECORD_DROPPED], "RECORD_DROPPED", "Dropped", "%.f", 0, 0, 0, 0);
+    IUFillNumberVector(&RecordStatsNP, RecordStatsN, NARRAY(RecordStatsN), getDeviceName(), "RECORD_STATS",
+                       "Record Stats", STREAM_TAB, IP_RO, 60, IPS_IDLE);
+
+    /* Record write mode */
+    IUFillSwitch(&RecordWriteS[RECORD_WRITE_BUFFERED], "RECORD_WRITE_BUFFERED", "Buffered", ISS_ON);
+    IUFillSwitch(&RecordWriteS[RECORD_WRITE_DIRECT], "RECORD_WRITE_DIRECT", "Direct", ISS_OFF);
+    IUFillSwitchVector(&RecordWriteSP, RecordWriteS, NARRAY(RecordWriteS), getDeviceName(), "RECORD_WRITE_MODE",
+                       "Record Write", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
     /* Record Switch */
     IUFillSwitch(&RecordStreamS[0], "RECORD_ON", "Record On", ISS_OFF);
     IUFillSwitch(&RecordStreamS[1], "RECORD_DURATION_ON", "Record (Duration)", ISS_OFF);
@@ -157,6 +189,14 @@ bool StreamManager::initProperties()
         IUFillSwitchVector(&RecorderSP, RecorderS, NARRAY(RecorderS), getDeviceName(), "SENSOR_STREAM_RECORDER", "Recorder", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
     else
         IUFillSwitchVector(&RecorderSP, RecorderS, NARRAY(RecorderS), getDeviceName(), "CCD_STREAM_RECORDER", "Recorder", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+    // 16 to 8 bit conversion for streaming and non-SER recorders
+    IUFillSwitch(&DownscaleS[DOWNSCALE_GAMMA], "GAMMA", "Gamma", ISS_ON);
+    IUFillSwitch(&DownscaleS[DOWNSCALE_STRETCH], "STRETCH", "Auto stretch", ISS_OFF);
+    if(currentDevice->getDriverInterface() & INDI::DefaultDevice::SENSOR_INTERFACE)
+        IUFillSwitchVector(&DownscaleSP, DownscaleS, NARRAY(DownscaleS), getDeviceName(), "SENSOR_STREAM_DOWNSCALE", "16 to 8 bit", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+    else
+        IUFillSwitchVector(&DownscaleSP, DownscaleS, NARRAY(DownscaleS), getDeviceName(), "CCD_STREAM_DOWNSCALE", "16 to 8 bit", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
     // If we do not have theora installed, let's just define SER default recorder
 #ifndef HAVE_THEORA
     RecorderSP.nsp = 1;
@@ -176,12 +216,16 @@ void StreamManager::ISGetProperties(const char * dev)
         if (m_hasStreamingExposure)
             currentDevice->defineNumber(&StreamExposureNP);
         currentDevice->defineNumber(&FpsNP);
+        currentDevice->defineNumber(&FramesNP);
         currentDevice->defineSwitch(&RecordStreamSP);
         currentDevice->defineText(&RecordFileTP);
         currentDevice->defineNumber(&RecordOptionsNP);
+        currentDevice->defineNumber(&RecordStatsNP);
+        currentDevice->defineSwitch(&RecordWriteSP);
         currentDevice->defineNumber(&StreamFrameNP);
         currentDevice->defineSwitch(&EncoderSP);
         currentDevice->defineSwitch(&RecorderSP);
+        currentDevice->defineSwitch(&DownscaleSP);
     }
 }
 
@@ -203,12 +247,16 @@ bool StreamManager::updateProperties()
         if (m_hasStreamingExposure)
             currentDevice->defineNumber(&StreamExposureNP);
         currentDevice->defineNumber(&FpsNP);
+        currentDevice->defineNumber(&FramesNP);
         currentDevice->defineSwitch(&RecordStreamSP);
         currentDevice->defineText(&RecordFileTP);
         currentDevice->defineNumber(&RecordOptionsNP);
+        currentDevice->defineNumber(&RecordStatsNP);
+        currentDevice->defineSwitch(&RecordWriteSP);
         currentDevice->defineNumber(&StreamFrameNP);
         currentDevice->defineSwitch(&EncoderSP);
         currentDevice->defineSwitch(&RecorderSP);
+        currentDevice->defineSwitch(&DownscaleSP);
     }
     else
     {
@@ -216,12 +264,16 @@ bool StreamManager::updateProperties()
         if (m_hasStreamingExposure)
             currentDevice->deleteProperty(StreamExposureNP.name);
         currentDevice->deleteProperty(FpsNP.name);
+        currentDevice->deleteProperty(FramesNP.name);
         currentDevice->deleteProperty(RecordFileTP.name);
         currentDevice->deleteProperty(RecordStreamSP.name);
         currentDevice->deleteProperty(RecordOptionsNP.name);
+        currentDevice->deleteProperty(RecordStatsNP.name);
+        currentDevice->deleteProperty(RecordWriteSP.name);
         currentDevice->deleteProperty(StreamFrameNP.name);
         currentDevice->deleteProperty(EncoderSP.name);
         currentDevice->deleteProperty(RecorderSP.name);
+        currentDevice->deleteProperty(DownscaleSP.name);
     }
 
     return true;
@@ -232,31 +284,67 @@ bool StreamManager::updateProperties()
  * Subframing for streaming/recording is done in the stream manager.
  * Therefore nbytes is expected to be SubW/BinX * SubH/BinY * Bytes_Per_Pixels * Number_Color_Components
  * Binned frame must be sent from the camera driver for this to work consistentaly for all drivers.*/
-void StreamManager::newFrame(const uint8_t * buffer, uint32_t nbytes)
+uint64_t StreamManager::getMonotonicTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// CLOCK_REALTIME in microseconds since the Unix epoch
+static int64_t getRealtimeTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void StreamManager::newFrame(const uint8_t * buffer, uint32_t nbytes, uint64_t timestamp)
 {
     m_FrameCounterPerSecond += 1;
     if (StreamExposureN[STREAM_DIVISOR].value > 1 && (m_FrameCounterPerSecond % static_cast<int>(StreamExposureN[STREAM_DIVISOR].value)) == 0)
         return;
 
-    double ms1, ms2, deltams;
-    // Measure FPS
-    getitimer(ITIMER_REAL, &tframe2);
-    ms1 = (1000.0 * tframe1.it_value.tv_sec) + (tframe1.it_value.tv_usec / 1000.0);
-    ms2 = (1000.0 * tframe2.it_value.tv_sec) + (tframe2.it_value.tv_usec / 1000.0);
-    if (ms2 > ms1)
-        deltams = ms2 - ms1;
-    else
-        deltams = ms1 - ms2;
+    if (timestamp == 0)
+        timestamp = getMonotonicTime();
 
-    tframe1 = tframe2;
+    // Measure FPS between capture times. A driver switching clocks or reordering frames must not produce negative intervals.
+    double deltams = 0;
+    if (timestamp > m_LastFrameTime)
+        deltams = (timestamp - m_LastFrameTime) / 1000.0;
+    m_LastFrameTime = timestamp;
     mssum += deltams;
 
-    double newFPS = 1000.0 / deltams;
+    double newFPS = (deltams > 0) ? 1000.0 / deltams : FpsN[FPS_INSTANT].value;
     if (mssum >= 1000.0)
     {
         FpsN[1].value = (m_FrameCounterPerSecond * 1000.0) / mssum;
         mssum         = 0;
         m_FrameCounterPerSecond = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_StreamStage.lock);
+            FramesN[FRAMES_ENCODED].value = m_StreamStage.done;
+            FramesN[FRAMES_DROPPED].value = m_StreamStage.dropped;
+            if (m_StreamStage.latencyCount > 0)
+                FramesN[FRAMES_LATENCY].value = m_StreamStage.latency / m_StreamStage.latencyCount;
+            m_StreamStage.latency      = 0;
+            m_StreamStage.latencyCount = 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_RecordStage.lock);
+            FramesN[FRAMES_RECORDED].value = m_RecordStage.done;
+        }
+        FramesNP.s = (FramesN[FRAMES_DROPPED].value > 0) ? IPS_BUSY : IPS_OK;
+        IDSetNumber(&FramesNP, nullptr);
+
+        if (m_isRecording)
+        {
+            RecordStatsN[RECORD_RATE].value    = recorder->getWriteRate();
+            RecordStatsN[RECORD_DROPPED].value = recorder->getDroppedFrames();
+            RecordStatsNP.s = (RecordStatsN[RECORD_DROPPED].value > 0) ? IPS_ALERT : IPS_OK;
+            IDSetNumber(&RecordStatsNP, nullptr);
+        }
     }
 
     // Only send FPS when there is a substancial update
@@ -265,134 +353,269 @@ void StreamManager::newFrame(const uint8_t * buffer, uint32_t nbytes)
         FpsN[0].value = newFPS;
         IDSetNumber(&FpsNP, nullptr);
     }
-    std::thread(&StreamManager::asyncStream, this, buffer, nbytes, deltams).detach();
+
+    if (StreamSP.s == IPS_BUSY)
+        pushFrame(m_StreamStage, buffer, nbytes, deltams, timestamp);
+    if (m_isRecording)
+        pushFrame(m_RecordStage, buffer, nbytes, deltams, timestamp);
 }
 
-void StreamManager::asyncStream(const uint8_t *buffer, uint32_t nbytes, double deltams)
+void StreamManager::handleRecordHalt()
 {
-    std::unique_lock<std::mutex> guard((currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE) ?
-                                       dynamic_cast<INDI::CCD*>(currentDevice)->ccdBufferLock :
-                                       dynamic_cast<INDI::SensorInterface*>(currentDevice)->detectorBufferLock);
+    char drain[16];
+    while (::read(m_HaltNotify[0], drain, sizeof(drain)) > 0)
+        ;
 
-    // For streaming, downscale 16 to 8
-    if (m_PixelDepth == 16 && (StreamSP.s == IPS_BUSY || RecordStreamSP.s == IPS_BUSY))
+    int halt;
     {
-        if (isStreaming() || strcmp(recorder->getName(), "SER"))
-        {
-            uint32_t npixels = 0;
-            if(currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE)
-            {
-                npixels = (dynamic_cast<INDI::CCD*>(currentDevice)->PrimaryCCD.getSubW() / dynamic_cast<INDI::CCD*>(currentDevice)->PrimaryCCD.getBinX()) * (dynamic_cast<INDI::CCD*>(currentDevice)->PrimaryCCD.getSubH() / dynamic_cast<INDI::CCD*>(currentDevice)->PrimaryCCD.getBinY()) * ((m_PixelFormat == INDI_RGB) ? 3 : 1);
-                //uint32_t npixels = StreamFrameN[CCDChip::FRAME_W].value * StreamFrameN[CCDChip::FRAME_H].value * ((m_PixelFormat == INDI_RGB) ? 3 : 1);
-            }
-            else if(currentDevice->getDriverInterface() & INDI::DefaultDevice::SENSOR_INTERFACE)
-            {
-                npixels = nbytes * 8 / dynamic_cast<INDI::SensorInterface*>(currentDevice)->getBPS();
-            }
-            // Allocale new buffer if size changes
-            if (downscaleBufferSize != npixels)
-            {
-                downscaleBufferSize = npixels;
-                delete [] downscaleBuffer;
-                downscaleBuffer = new uint8_t[npixels];
-            }
-
-            const uint16_t * srcBuffer = reinterpret_cast<const uint16_t *>(buffer);
-            //buffer = downscaleBuffer;
+        std::lock_guard<std::mutex> lock(m_RecordStage.lock);
+        halt = m_RecordStage.halt;
+    }
 
-            // Slow method: proper downscale
-            /*
+    // Nothing to do if recording was stopped or restarted meanwhile
+    if (!m_isRecording)
+        return;
 
-            uint16_t max = 32768;
-            uint16_t min = 0;
+    if (halt == RECORD_HALT_FAILED)
+    {
+        LOG_ERROR("Recording failed.");
+        stopRecording(true);
+    }
+    else if (halt == RECORD_HALT_DONE)
+        endRecording();
+}
 
-            for (uint32_t i=0; i < npixels; i++)
-            {
-                if (srcBuffer[i] > max)
-                    max = srcBuffer[i];
-                else if (srcBuffer[i] < min)
-                    min = srcBuffer[i];
-            }
+void StreamManager::handleRecordHaltHelper(int fd, void *context)
+{
+    INDI_UNUSED(fd);
+    static_cast<StreamManager *>(context)->handleRecordHalt();
+}
 
-            double bscale = 255. / (max - min);
-            double bzero  = (-min) * (255. / (max - min));
+void StreamManager::startStage(FrameStage &stage, size_t depth, bool dropOldest,
+                               void (StreamManager::*process)(const uint8_t *, uint32_t, double, uint64_t))
+{
+    stage.ring.resize(depth);
+    stage.dropOldest = dropOldest;
+    stage.worker     = std::thread(&StreamManager::stageWorker, this, std::ref(stage), process);
+}
 
-            for (uint32_t i=0; i < npixels; i++)
-                streamBuffer[i] = srcBuffer[i] * bscale + bzero;
-            */
+void StreamManager::stopStage(FrameStage &stage)
+{
+    {
+        std::lock_guard<std::mutex> lock(stage.lock);
+        stage.exit = true;
+    }
+    stage.ready.notify_one();
+    stage.room.notify_all();
+    stage.worker.join();
+}
 
-            // Apply gamma
-            for (uint32_t i = 0; i < npixels; i++)
-                downscaleBuffer[i] = gammaLUT_16_8[srcBuffer[i]];
+void StreamManager::clearStage(FrameStage &stage)
+{
+    std::lock_guard<std::mutex> lock(stage.lock);
+    stage.head    = stage.count = 0;
+    stage.done    = stage.dropped = 0;
+    stage.latency = 0;
+    stage.latencyCount = 0;
+    stage.halt    = 0;
+    stage.room.notify_all();
+}
 
-            nbytes /= 2;
+void StreamManager::haltStage(FrameStage &stage, int reason)
+{
+    {
+        std::lock_guard<std::mutex> lock(stage.lock);
+        if (stage.halt == 0)
+            stage.halt = reason;
+    }
+    stage.room.notify_all();
+}
 
-#if 0
-            if (StreamSP.s == IPS_BUSY)
-            {
-                streamframeCount++;
-                if (streamframeCount >= StreamOptionsN[OPTION_RATE_DIVISOR].value)
-                {
-                    uploadStream(downscaleBuffer, nbytes);
-                    streamframeCount = 0;
-                }
-            }
-#endif
+void StreamManager::pushFrame(FrameStage &stage, const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp)
+{
+    std::unique_lock<std::mutex> lock(stage.lock);
 
-            if (StreamSP.s == IPS_BUSY)
-                uploadStream(downscaleBuffer, nbytes);
+    if (stage.halt)
+        return;
 
-            // If anything but SER, let's call recorder. Otherwise, it's been called up before.
-            if (isRecording() && strcmp(recorder->getName(), "SER"))
-            {
-                recordStream(downscaleBuffer, nbytes, deltams);
-            }
+    if (stage.count == stage.ring.size())
+    {
+        if (stage.dropOldest)
+        {
+            // Stage is behind, drop the oldest frame but keep its time
+            deltams += stage.ring[stage.head].deltams;
+            stage.head = (stage.head + 1) % stage.ring.size();
+            stage.count--;
+            stage.dropped++;
         }
-
-        // Do not downscale for SER recorder.
-        if (isRecording() && !strcmp(recorder->getName(), "SER"))
+        else
         {
-            recordStream(buffer, nbytes, deltams);
+            // Hold the producer until the worker frees a slot
+            stage.room.wait(lock, [&stage] { return stage.count < stage.ring.size() || stage.exit || stage.halt; });
+            if (stage.exit || stage.halt)
+                return;
         }
     }
-    else
+
+    FrameSlot &slot = stage.ring[(stage.head + stage.count) % stage.ring.size()];
+    if (slot.data.size() < nbytes)
+        slot.data.resize(nbytes);
+    memcpy(slot.data.data(), buffer, nbytes);
+    slot.nbytes    = nbytes;
+    slot.deltams   = deltams;
+    slot.timestamp = timestamp;
+    stage.count++;
+
+    lock.unlock();
+    stage.ready.notify_one();
+}
+
+void StreamManager::stageWorker(FrameStage &stage, void (StreamManager::*process)(const uint8_t *, uint32_t, double, uint64_t))
+{
+    std::vector<uint8_t> frame;
+
+    std::unique_lock<std::mutex> lock(stage.lock);
+    for (;;)
     {
-#if 0
-        if (StreamSP.s == IPS_BUSY)
-        {
-            streamframeCount++;
-            if (streamframeCount >= StreamOptionsN[OPTION_RATE_DIVISOR].value)
-            {
-                if (uploadStream(buffer, nbytes) == false)
-                {
-                    LOG_ERROR("Streaming failed.");
-                    setStream(false);
-                    return;
-                }
-                streamframeCount = 0;
-            }
-        }
-#endif
+        stage.ready.wait(lock, [&stage] { return stage.count > 0 || stage.exit; });
+        if (stage.exit)
+            break;
+
+        // Take the slot's buffer and leave ours in its place for a later frame
+        FrameSlot &slot = stage.ring[stage.head];
+        frame.swap(slot.data);
+        uint32_t nbytes = slot.nbytes;
+        double deltams  = slot.deltams;
+        uint64_t timestamp = slot.timestamp;
+        stage.head = (stage.head + 1) % stage.ring.size();
+        stage.count--;
+        stage.room.notify_one();
+
+        if (stage.halt)
+            continue;
+
+        lock.unlock();
+        (this->*process)(frame.data(), nbytes, deltams, timestamp);
+        uint64_t finished = getMonotonicTime();
+        lock.lock();
 
-        if (StreamSP.s == IPS_BUSY)
+        stage.done++;
+        if (finished > timestamp)
         {
-            if (uploadStream(buffer, nbytes) == false)
-            {
-                LOG_ERROR("Streaming failed.");
-                setStream(false);
-                return;
-            }
+            stage.latency += (finished - timestamp) / 1000.0;
+            stage.latencyCount++;
         }
+    }
+}
+
+uint32_t StreamManager::getPixelCount(uint32_t nbytes)
+{
+    if(currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE)
+    {
+        INDI::CCD *ccd = dynamic_cast<INDI::CCD*>(currentDevice);
+        return (ccd->PrimaryCCD.getSubW() / ccd->PrimaryCCD.getBinX()) * (ccd->PrimaryCCD.getSubH() / ccd->PrimaryCCD.getBinY()) * ((m_PixelFormat == INDI_RGB) ? 3 : 1);
+    }
+    else if(currentDevice->getDriverInterface() & INDI::DefaultDevice::SENSOR_INTERFACE)
+    {
+        return nbytes * 8 / dynamic_cast<INDI::SensorInterface*>(currentDevice)->getBPS();
+    }
+    return 0;
+}
 
-        if (RecordStreamSP.s == IPS_BUSY)
+void StreamManager::downscale16(const uint16_t *src, uint8_t *dst, uint32_t npixels)
+{
+    if (DownscaleS[DOWNSCALE_STRETCH].s == ISS_ON)
+    {
+        uint16_t lo, hi;
+        minMax16(src, npixels, &lo, &hi);
+        stretch16to8(src, dst, npixels, lo, hi);
+    }
+    else
+        lut16to8(src, dst, npixels, gammaLUT_16_8);
+}
+
+void StreamManager::streamFrame(const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp)
+{
+    INDI_UNUSED(deltams);
+
+    if (StreamSP.s != IPS_BUSY)
+        return;
+
+    // The stream goes out on the same BLOB as exposures, so keep ccdBufferLock while uploading
+    std::unique_lock<std::mutex> guard((currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE) ?
+                                       dynamic_cast<INDI::CCD*>(currentDevice)->ccdBufferLock :
+                                       dynamic_cast<INDI::SensorInterface*>(currentDevice)->detectorBufferLock);
+
+    // For streaming, downscale 16 to 8
+    if (m_PixelDepth == 16)
+    {
+        uint32_t npixels = getPixelCount(nbytes);
+
+        // Allocale new buffer if size changes
+        if (downscaleBufferSize != npixels)
         {
-            if (recordStream(buffer, nbytes, deltams) == false)
-            {
-                LOG_ERROR("Recording failed.");
-                stopRecording(true);
-                return;
-            }
+            downscaleBufferSize = npixels;
+            delete [] downscaleBuffer;
+            downscaleBuffer = new uint8_t[npixels];
         }
+
+        downscale16(reinterpret_cast<const uint16_t *>(buffer), downscaleBuffer, npixels);
+
+        buffer = downscaleBuffer;
+        nbytes /= 2;
+    }
+
+    // The BLOB is stamped with the capture time, then cleared so that regular exposures get the time they are sent
+    int64_t captured = getRealtimeTime() - static_cast<int64_t>(getMonotonicTime() - timestamp);
+    time_t seconds = captured / 1000000;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    size_t len = strftime(imageBP->timestamp, MAXINDITSTAMP, "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(imageBP->timestamp + len, MAXINDITSTAMP - len, ".%03d", static_cast<int>((captured % 1000000) / 1000));
+
+    bool rc = uploadStream(buffer, nbytes);
+    imageBP->timestamp[0] = '\0';
+
+    if (rc == false)
+    {
+        LOG_ERROR("Streaming failed.");
+        setStream(false);
+    }
+}
+
+void StreamManager::recordFrame(const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp)
+{
+    // Frames still queued when recording stopped are discarded
+    if (!m_isRecording)
+        return;
+
+    // Do not downscale for SER recorder.
+    if (m_PixelDepth == 16 && strcmp(recorder->getName(), "SER"))
+    {
+        uint32_t npixels = getPixelCount(nbytes);
+
+        if (recordBuffer.size() != npixels)
+            recordBuffer.resize(npixels);
+
+        downscale16(reinterpret_cast<const uint16_t *>(buffer), recordBuffer.data(), npixels);
+
+        buffer = recordBuffer.data();
+        nbytes /= 2;
+    }
+
+    // Stopping is left to the event loop, see RECORD_HALT_NONE
+    int halt = RECORD_HALT_NONE;
+    if (recordStream(buffer, nbytes, deltams, timestamp) == false)
+        halt = RECORD_HALT_FAILED;
+    else if (recordLimitReached())
+        halt = RECORD_HALT_DONE;
+
+    if (halt != RECORD_HALT_NONE)
+    {
+        haltStage(m_RecordStage, halt);
+        // A full pipe already has the event loop on its way
+        ssize_t written = ::write(m_HaltNotify[1], "", 1);
+        INDI_UNUSED(written);
     }
 }
 
@@ -463,39 +686,40 @@ bool StreamManager::setPixelFormat(INDI_PIXEL_FORMAT pixelFormat, uint8_t pixelD
     return true;
 }
 
-bool StreamManager::recordStream(const uint8_t * buffer, uint32_t nbytes, double deltams)
+bool StreamManager::recordStream(const uint8_t * buffer, uint32_t nbytes, double deltams, uint64_t timestamp)
 {
     if (!m_isRecording)
         return false;
 
-    bool rc = recorder->writeFrame(buffer, nbytes);
+    bool rc = recorder->writeFrame(buffer, nbytes, timestamp + m_RecordClockOffset);
     if (rc == false)
         return rc;
 
     m_RecordingFrameDuration += deltams;
     m_RecordingFrameTotal += 1;
 
-    if ((RecordStreamSP.sp[1].s == ISS_ON) && (m_RecordingFrameDuration >= (RecordOptionsNP.np[0].value * 1000.0)))
-    {
-        LOGF_INFO("Ending record after %g millisecs", m_RecordingFrameDuration);
-        stopRecording();
-        RecordStreamSP.sp[1].s = ISS_OFF;
-        RecordStreamSP.sp[3].s = ISS_ON;
-        RecordStreamSP.s       = IPS_IDLE;
-        IDSetSwitch(&RecordStreamSP, nullptr);
-    }
+    return true;
+}
 
-    if ((RecordStreamSP.sp[2].s == ISS_ON) && (m_RecordingFrameTotal >= (RecordOptionsNP.np[1].value)))
-    {
+bool StreamManager::recordLimitReached() const
+{
+    return ((RecordStreamSP.sp[1].s == ISS_ON) && (m_RecordingFrameDuration >= (RecordOptionsNP.np[0].value * 1000.0))) ||
+           ((RecordStreamSP.sp[2].s == ISS_ON) && (m_RecordingFrameTotal >= (RecordOptionsNP.np[1].value)));
+}
+
+void StreamManager::endRecording()
+{
+    if (RecordStreamSP.sp[1].s == ISS_ON)
+        LOGF_INFO("Ending record after %g millisecs", m_RecordingFrameDuration);
+    else
         LOGF_INFO("Ending record after %d frames", m_RecordingFrameTotal);
-        stopRecording();
-        RecordStreamSP.sp[2].s = ISS_OFF;
-        RecordStreamSP.sp[3].s = ISS_ON;
-        RecordStreamSP.s       = IPS_IDLE;
-        IDSetSwitch(&RecordStreamSP, nullptr);
-    }
 
-    return true;
+    stopRecording();
+    RecordStreamSP.sp[1].s = ISS_OFF;
+    RecordStreamSP.sp[2].s = ISS_OFF;
+    RecordStreamSP.sp[3].s = ISS_ON;
+    RecordStreamSP.s       = IPS_IDLE;
+    IDSetSwitch(&RecordStreamSP, nullptr);
 }
 
 int StreamManager::mkpath(std::string s, mode_t mode)
@@ -608,6 +832,7 @@ bool StreamManager::startRecording()
     }
 
     recorder->setFPS(FpsN[FPS_AVERAGE].value);
+    recorder->setDirectWrite(RecordWriteS[RECORD_WRITE_DIRECT].s == ISS_ON);
 
     /* pattern substitution */
     recordfiledir.assign(RecordFileTP.tp[0].text);
@@ -659,9 +884,12 @@ bool StreamManager::startRecording()
     m_RecordingFrameDuration   = 0.0;
     m_RecordingFrameTotal = 0;
 
-    getitimer(ITIMER_REAL, &tframe1);
+    m_RecordClockOffset = getRealtimeTime() - static_cast<int64_t>(getMonotonicTime());
+
+    m_LastFrameTime = getMonotonicTime();
     mssum         = 0;
     m_FrameCounterPerSecond = 0;
+    clearStage(m_RecordStage);
     if(currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE)
     {
         if (m_isStreaming == false && dynamic_cast<INDI::CCD*>(currentDevice)->StartStreaming() == false)
@@ -705,7 +933,13 @@ bool StreamManager::stopRecording(bool force)
     }
 
     m_isRecording = false;
-    recorder->close();
+    if (!recorder->close())
+        LOGF_WARN("Writing the record file failed, %u frames were lost.", recorder->getDroppedFrames());
+
+    RecordStatsN[RECORD_RATE].value    = recorder->getWriteRate();
+    RecordStatsN[RECORD_DROPPED].value = recorder->getDroppedFrames();
+    RecordStatsNP.s = (RecordStatsN[RECORD_DROPPED].value > 0) ? IPS_ALERT : IPS_IDLE;
+    IDSetNumber(&RecordStatsNP, nullptr);
 
     if (force)
         return false;
@@ -841,6 +1075,22 @@ bool StreamManager::ISNewSwitch(const char * dev, const char * name, ISState * s
         IDSetSwitch(&RecorderSP, nullptr);
     }
 
+    // 16 to 8 bit conversion
+    if (!strcmp(name, DownscaleSP.name))
+    {
+        IUUpdateSwitch(&DownscaleSP, states, names, n);
+        DownscaleSP.s = IPS_OK;
+        IDSetSwitch(&DownscaleSP, nullptr);
+    }
+
+    // Record write mode, applied on the next recording
+    if (!strcmp(name, RecordWriteSP.name))
+    {
+        IUUpdateSwitch(&RecordWriteSP, states, names, n);
+        RecordWriteSP.s = IPS_OK;
+        IDSetSwitch(&RecordWriteSP, nullptr);
+    }
+
     return true;
 }
 
@@ -961,9 +1211,10 @@ bool StreamManager::setStream(bool enable)
 #endif
             LOGF_INFO("Starting the video stream with target exposure %.6f s (Max theoritical FPS %.f)", StreamExposureN[0].value, 1 / StreamExposureN[0].value);
 
-            getitimer(ITIMER_REAL, &tframe1);
+            m_LastFrameTime = getMonotonicTime();
             mssum         = 0;
             m_FrameCounterPerSecond = 0;
+            clearStage(m_StreamStage);
             if(currentDevice->getDriverInterface() & INDI::DefaultDevice::CCD_INTERFACE)
             {
                 if (dynamic_cast<INDI::CCD*>(currentDevice)->StartStreaming() == false)
@@ -1050,6 +1301,8 @@ bool StreamManager::saveConfigItems(FILE * fp)
     IUSaveConfigText(fp, &RecordFileTP);
     IUSaveConfigNumber(fp, &RecordOptionsNP);
     IUSaveConfigSwitch(fp, &RecorderSP);
+    IUSaveConfigSwitch(fp, &DownscaleSP);
+    IUSaveConfigSwitch(fp, &RecordWriteSP);
     return true;
 }
 
@@ -28,6 +28,10 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/time.h>
 
 #include <stdint.h>
@@ -44,8 +48,19 @@
    + Grayscale 8bit frame that represents intensity/lumienance.
    + Color 24bit RGB frame.
 
+   Frames passed to newFrame() are copied into two independent stages, each a small ring of reusable slots drained in order by its own
+   worker thread. The stream stage drops the oldest queued frame when the encoder falls behind, so the live preview never holds up the
+   camera. The record stage never drops: when it is full, newFrame() waits for the recorder. A slow disk therefore does not stall the
+   preview, and a slow client does not cost recorded frames. The STREAM_FRAMES property reports frames encoded, dropped and recorded,
+   and the average time from capture to the end of the client upload.
+
+   Drivers that know when a frame was captured (e.g. the V4L2 buffer timestamp) pass it to newFrame(). It travels with the frame
+   through both stages: the recorder stores it as the frame time (SER trailer) and the stream BLOB carries it as its timestamp.
+   FPS and latency are measured on CLOCK_MONOTONIC, so they are not disturbed by changes to the system clock.
+
    Use setPixelFormat() and setSize() before uploading the stream data. 16bit frames are only supported in some recorders. You can send
-   16bit frames, but they will be downscaled to 8bit when necessary for streaming and recording purposes. Base classes must implement
+   16bit frames, but they will be downscaled to 8bit when necessary for streaming and recording purposes, either through a fixed gamma
+   curve or stretched between the frame minimum and maximum as selected in the CCD_STREAM_DOWNSCALE property. Base classes must implement
    startStreaming() and stopStreaming() functions. When a frame is ready, use uploadStream() to send the data to active encoders and recorders.
 
    It is highly recommended to implement the streaming functionality in a dedicated thread.
@@ -119,16 +134,16 @@ class StreamManager
 
         /**
              * @brief newFrame CCD drivers call this function when a new frame is received. It is then streamed, or recorded, or both according to the settings in the streamer.
+             * The frame is copied before the function returns, so the driver may reuse buffer right away.
+             * @param timestamp capture time of the frame in microseconds on CLOCK_MONOTONIC (see getMonotonicTime()),
+             * or 0 if unknown, in which case the time of the call is used.
              */
-        void newFrame(const uint8_t *buffer, uint32_t nbytes);
+        void newFrame(const uint8_t *buffer, uint32_t nbytes, uint64_t timestamp = 0);
 
         /**
-         * @brief asyncStream Upload the stream asynchronously in a separate thread. ccdBufferLock mutex shall be locked until the record/upload
-         * operation is complete.
-         * @param buffer Buffer to stream/record
-         * @param nbytes size of buffer.
-         */
-        void asyncStream(const uint8_t *buffer, uint32_t nbytes, double deltams);
+             * @brief getMonotonicTime Current CLOCK_MONOTONIC time in microseconds, the clock of newFrame() timestamps.
+             */
+        static uint64_t getMonotonicTime();
 
         /**
              * @brief setStream Enables (starts) or disables (stops) streaming.
@@ -214,11 +229,68 @@ class StreamManager
         /**
              * @brief recordStream Calls the backend recorder to record a single frame.
              * @param deltams time in milliseconds since last frame
+             * @param timestamp capture time in microseconds on CLOCK_MONOTONIC
              */
-        bool recordStream(const uint8_t *buffer, uint32_t nbytes, double deltams);
+        bool recordStream(const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp);
+
+        // True once the selected record duration or frame count is reached
+        bool recordLimitReached() const;
+        // Stop recording at its duration or frame count limit
+        void endRecording();
 
         void prepareGammaLUT(double gamma = 2.4, double a = 12.92, double b = 0.055, double Ii = 0.00304);
 
+        // Frame pipeline. Slot buffers are swapped, never freed, so they are only reallocated when the frame size grows.
+        struct FrameSlot
+        {
+            std::vector<uint8_t> data;
+            uint32_t nbytes = 0;
+            double deltams = 0;
+            uint64_t timestamp = 0;
+        };
+
+        struct FrameStage
+        {
+            std::vector<FrameSlot> ring;
+            size_t head = 0, count = 0;
+            // When full, drop the oldest queued frame instead of waiting for room
+            bool dropOldest = true;
+            uint32_t done = 0, dropped = 0;
+            // Capture to end of processing, milliseconds, summed since the last statistics update
+            double latency = 0;
+            uint32_t latencyCount = 0;
+            // Set by the worker to have the producer stop the stage. Frames still queued are discarded and no more are taken.
+            int halt = 0;
+            bool exit = false;
+            std::mutex lock;
+            std::condition_variable ready, room;
+            std::thread worker;
+        };
+
+        void startStage(FrameStage &stage, size_t depth, bool dropOldest,
+                        void (StreamManager::*process)(const uint8_t *, uint32_t, double, uint64_t));
+        void stopStage(FrameStage &stage);
+        // Forget queued frames and reset counters
+        void clearStage(FrameStage &stage);
+        void pushFrame(FrameStage &stage, const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp);
+        // Called by the worker, releases a producer waiting for room
+        void haltStage(FrameStage &stage, int reason);
+        void stageWorker(FrameStage &stage, void (StreamManager::*process)(const uint8_t *, uint32_t, double, uint64_t));
+
+        /**
+         * @brief streamFrame Encode one frame and send it to the client. Runs on the stream stage worker.
+         */
+        void streamFrame(const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp);
+
+        /**
+         * @brief recordFrame Write one frame with the active recorder. Runs on the record stage worker.
+         */
+        void recordFrame(const uint8_t *buffer, uint32_t nbytes, double deltams, uint64_t timestamp);
+
+        uint32_t getPixelCount(uint32_t nbytes);
+        // Gamma table or min/max stretch, as selected in DownscaleSP
+        void downscale16(const uint16_t *src, uint8_t *dst, uint32_t npixels);
+
         /* Stream switch */
         ISwitch StreamS[2];
         ISwitchVectorProperty StreamSP;
@@ -244,6 +316,21 @@ class StreamManager
         INumberVectorProperty FpsNP;
         enum { FPS_INSTANT, FPS_AVERAGE };
 
+        /* Frame pipeline counters */
+        INumber FramesN[4];
+        INumberVectorProperty FramesNP;
+        enum { FRAMES_ENCODED, FRAMES_DROPPED, FRAMES_RECORDED, FRAMES_LATENCY };
+
+        /* Recorder write statistics */
+        INumber RecordStatsN[2];
+        INumberVectorProperty RecordStatsNP;
+        enum { RECORD_RATE, RECORD_DROPPED };
+
+        /* Recorder write mode: through the page cache or direct to disk */
+        ISwitch RecordWriteS[2];
+        ISwitchVectorProperty RecordWriteSP;
+        enum { RECORD_WRITE_BUFFERED, RECORD_WRITE_DIRECT };
+
         /* Record Options */
         INumber RecordOptionsN[2];
         INumberVectorProperty RecordOptionsNP;
@@ -266,6 +353,20 @@ class StreamManager
         ISwitchVectorProperty RecorderSP;
         enum { RECORDER_RAW, RECORDER_OGV };
 
+        // 16 to 8 bit conversion: fixed gamma or auto stretch between the frame minimum and maximum
+        ISwitch DownscaleS[2];
+        ISwitchVectorProperty DownscaleSP;
+        enum { DOWNSCALE_GAMMA, DOWNSCALE_STRETCH };
+
+        // Why the record stage halted. Neither the record worker nor the capture thread may stop recording:
+        // StopStreaming() may wait for the capture thread, and closing the recorder may flush for a long time.
+        // The worker writes a byte on m_HaltNotify[1] and the event loop stops recording in handleRecordHalt().
+        enum { RECORD_HALT_NONE, RECORD_HALT_DONE, RECORD_HALT_FAILED };
+        int m_HaltNotify[2] { -1, -1 };
+        int m_HaltCallbackID { -1 };
+        void handleRecordHalt();
+        static void handleRecordHaltHelper(int fd, void *context);
+
         bool m_isStreaming { false };
         bool m_isRecording { false };
         bool m_hasStreamingExposure { true };
@@ -283,9 +384,12 @@ class StreamManager
         EncoderManager *encoderManager = nullptr;
         EncoderInterface *encoder = nullptr;
 
-        // Measure FPS
-        struct itimerval tframe1, tframe2;
-        uint32_t mssum = 0, m_FrameCounterPerSecond = 0;
+        // Measure FPS, CLOCK_MONOTONIC microseconds
+        uint64_t m_LastFrameTime = 0;
+        double mssum = 0;
+        uint32_t m_FrameCounterPerSecond = 0;
+        // CLOCK_REALTIME - CLOCK_MONOTONIC in microseconds, sampled once per recording so frame times stay evenly spaced
+        int64_t m_RecordClockOffset = 0;
 
         INDI_PIXEL_FORMAT m_PixelFormat = INDI_MONO;
         uint8_t m_PixelDepth = 8;
@@ -297,5 +401,12 @@ class StreamManager
         uint32_t downscaleBufferSize = 0;
 
         uint8_t *gammaLUT_16_8 = nullptr;
+
+        // Recorder side 16 to 8 bit buffer, the stream side uses downscaleBuffer
+        std::vector<uint8_t> recordBuffer;
+
+        static const size_t STREAM_STAGE_DEPTH = 2;
+        static const size_t RECORD_STAGE_DEPTH = 8;
+        FrameStage m_StreamStage, m_RecordStage;
 };
 }
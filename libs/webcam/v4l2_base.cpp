@@ -583,7 +583,12 @@ int V4L2_Base::read_frame(char * errmsg)
                 return 0;
             }
 
+            frameTimestamp = 0;
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
+            /* Only a monotonic timestamp can be handed to the stream manager as the capture time */
+            if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+                frameTimestamp = buf.timestamp.tv_sec * 1000000ULL + buf.timestamp.tv_usec;
+
             /* TODO: the timestamp can be checked against the expected exposure to validate the frame - doesn't work, yet */
             switch (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
             {
@@ -96,6 +96,8 @@ class V4L2_Base
     //unsigned char * getColorBuffer();
     unsigned char *getRGBBuffer();
     float *getLinearY();
+    // Capture time of the last frame in microseconds on CLOCK_MONOTONIC, 0 if the device does not provide it
+    uint64_t getFrameTimestamp() const { return frameTimestamp; }
 
     void registerCallback(WPF *fp, void *ud);
 
@@ -173,6 +175,7 @@ class V4L2_Base
     struct v4l2_format fmt;
     struct v4l2_input input;
     struct v4l2_buffer buf;
+    uint64_t frameTimestamp = 0;
 
     bool cancrop;
     bool cropset;
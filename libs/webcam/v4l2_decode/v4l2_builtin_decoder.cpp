@@ -61,6 +61,7 @@
 
 //#include "indilogger.h"
 #include "ccvt.h"
+#include "colorconvert.h"
 #include "v4l2_colorspace.h"
 
 #include <cstring> // memcpy
@@ -453,18 +454,18 @@ void V4L2_Builtin_Decoder::decode(unsigned char *frame, struct v4l2_buffer *buf)
         break;
 
         case V4L2_PIX_FMT_SBGGR8:
-            bayer2rgb24(rgb24_buffer, frame, fmt.fmt.pix.width, fmt.fmt.pix.height);
+            INDI::demosaic8(frame, rgb24_buffer, fmt.fmt.pix.width, fmt.fmt.pix.height, INDI::BAYER_BGGR);
             break;
 
         case V4L2_PIX_FMT_SRGGB8:
-            bayer_rggb_2rgb24(rgb24_buffer, frame, fmt.fmt.pix.width, fmt.fmt.pix.height);
+            INDI::demosaic8(frame, rgb24_buffer, fmt.fmt.pix.width, fmt.fmt.pix.height, INDI::BAYER_RGGB);
             break;
 	case V4L2_PIX_FMT_SGRBG8:
-		bayer_grbg_to_rgb24(rgb24_buffer, frame, fmt.fmt.pix.width, fmt.fmt.pix.height);
+		INDI::demosaic8(frame, rgb24_buffer, fmt.fmt.pix.width, fmt.fmt.pix.height, INDI::BAYER_GRBG);
 		break;
         case V4L2_PIX_FMT_SBGGR16:
-            bayer16_2_rgb24((unsigned short *)rgb24_buffer, (unsigned short *)frame, fmt.fmt.pix.width,
-                            fmt.fmt.pix.height);
+            INDI::demosaic16(reinterpret_cast<const uint16_t *>(frame), reinterpret_cast<uint16_t *>(rgb24_buffer),
+                             fmt.fmt.pix.width, fmt.fmt.pix.height, INDI::BAYER_BGGR);
             break;
 
         case V4L2_PIX_FMT_JPEG:
@@ -654,7 +655,7 @@ void V4L2_Builtin_Decoder::makeY()
         case V4L2_PIX_FMT_SBGGR8:
         case V4L2_PIX_FMT_SRGGB8:
 	case V4L2_PIX_FMT_SGRBG8:
-            RGB2YUV(bufwidth, bufheight, rgb24_buffer, YBuf, UBuf, VBuf, 0);
+            INDI::rgb24ToYUV420p(rgb24_buffer, bufwidth, bufheight, YBuf, UBuf, VBuf, true, true);
             break;
         case V4L2_PIX_FMT_YUYV:
         case V4L2_PIX_FMT_UYVY:
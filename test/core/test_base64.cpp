@@ -21,8 +21,13 @@
 #include "config.h"
 #endif
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "base64.h"
 
@@ -73,3 +78,186 @@ TEST(CORE_BASE64, Test_from64tobits_fast)
 
     free(p_outbuf);
 }
+
+/* Straightforward RFC 4648 encoder the optimized code paths are checked against */
+static std::string reference64(const unsigned char *in, int inlen)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+
+    for (int i = 0; i < inlen; i += 3)
+    {
+        uint32_t n = in[i] << 16;
+        if (i + 1 < inlen)
+            n |= in[i + 1] << 8;
+        if (i + 2 < inlen)
+            n |= in[i + 2];
+        out += digits[(n >> 18) & 0x3f];
+        out += digits[(n >> 12) & 0x3f];
+        out += i + 1 < inlen ? digits[(n >> 6) & 0x3f] : '=';
+        out += i + 2 < inlen ? digits[n & 0x3f] : '=';
+    }
+    return out;
+}
+
+static std::vector<unsigned char> randomBytes(int len, unsigned int seed)
+{
+    std::vector<unsigned char> v(len);
+    srand(seed);
+    for (auto &c : v)
+        c = rand() & 0xff;
+    return v;
+}
+
+/* Every length up to a few vector widths and a few unaligned starts, so each kernel and the scalar tail run */
+TEST(CORE_BASE64, Test_to64frombits_equivalence)
+{
+    std::vector<unsigned char> raw = randomBytes(1024 + 3, 1);
+
+    for (int offset = 0; offset < 4; offset++)
+    {
+        for (int len = 0; len <= 1024 - offset; len++)
+        {
+            std::vector<unsigned char> out(4 * len / 3 + 4 + 1);
+            int n = to64frombits(out.data(), raw.data() + offset, len);
+
+            ASSERT_EQ(reference64(raw.data() + offset, len), std::string((char *)out.data(), n)) << "len " << len;
+            ASSERT_EQ(0, out[n]);
+        }
+    }
+}
+
+TEST(CORE_BASE64, Test_from64tobits_fast_equivalence)
+{
+    std::vector<unsigned char> raw = randomBytes(1024, 2);
+
+    for (int len = 1; len <= 1024; len++)
+    {
+        std::string b64 = reference64(raw.data(), len);
+        std::vector<char> out(3 * b64.size() / 4 + 1);
+
+        int n = from64tobits_fast(out.data(), b64.c_str(), b64.size());
+        ASSERT_EQ(len, n);
+        ASSERT_EQ(0, memcmp(raw.data(), out.data(), len)) << "len " << len;
+    }
+}
+
+/* Drivers send BLOBs in 72 char lines and pass the length without the newlines */
+TEST(CORE_BASE64, Test_from64tobits_fast_lines)
+{
+    std::vector<unsigned char> raw = randomBytes(100000, 3);
+
+    for (int len : { 53, 54, 55, 1000, 4095, 100000 })
+    {
+        std::string b64 = reference64(raw.data(), len), lines;
+        for (size_t i = 0; i < b64.size(); i += 72)
+        {
+            lines += '\n';
+            lines += b64.substr(i, 72);
+        }
+        lines += '\n';
+
+        std::vector<char> out(3 * lines.size() / 4 + 1);
+        int n = from64tobits_fast(out.data(), lines.c_str(), b64.size());
+        ASSERT_EQ(len, n);
+        ASSERT_EQ(0, memcmp(raw.data(), out.data(), len)) << "len " << len;
+    }
+}
+
+/* Anything that is not a plain digit must still go the old way, whatever it decodes to */
+TEST(CORE_BASE64, Test_from64tobits_fast_stray)
+{
+    std::vector<unsigned char> raw = randomBytes(300, 4);
+    std::string b64                = reference64(raw.data(), raw.size());
+
+    for (size_t pos = 0; pos < b64.size(); pos += 37)
+    {
+        std::string bad = b64;
+        bad[pos]        = '*';
+
+        std::vector<char> out(3 * bad.size() / 4 + 1);
+        int n = from64tobits_fast(out.data(), bad.c_str(), bad.size());
+        ASSERT_EQ((int)raw.size(), n);
+        size_t group = pos / 4 * 3;
+        ASSERT_EQ(0, memcmp(raw.data(), out.data(), group)) << "pos " << pos;
+        ASSERT_EQ(0, memcmp(raw.data() + group + 3, out.data() + group + 3, raw.size() - group - 3)) << "pos " << pos;
+    }
+}
+
+/* Each vector kernel this CPU runs, called directly through base64_use_kernels() against the scalar code */
+TEST(CORE_BASE64, Test_kernels_against_scalar)
+{
+    std::vector<unsigned char> raw = randomBytes(4096 + 3, 6);
+
+    for (const char *kernel : { "ssse3", "avx2", "neon" })
+    {
+        if (base64_use_kernels(kernel) != 0)
+            continue;
+
+        for (int len : { 0, 1, 2, 3, 11, 12, 13, 23, 24, 25, 47, 48, 49, 95, 96, 97, 191, 192, 193, 1000, 4096 })
+        {
+            for (int offset = 0; offset < 4; offset++)
+            {
+                const unsigned char *in = raw.data() + offset;
+                std::vector<unsigned char> enc(4 * len / 3 + 4 + 1), ref(4 * len / 3 + 4 + 1);
+
+                ASSERT_EQ(0, base64_use_kernels("none"));
+                int m = to64frombits(ref.data(), in, len);
+                ASSERT_EQ(0, base64_use_kernels(kernel));
+                int n = to64frombits(enc.data(), in, len);
+
+                ASSERT_EQ(m, n) << kernel << " len " << len;
+                ASSERT_EQ(0, memcmp(ref.data(), enc.data(), n + 1)) << kernel << " len " << len;
+            }
+
+            if (len == 0)
+                continue;
+
+            /* Plain, in 72 char lines, and with a stray char in every vector block but the final group */
+            std::string b64 = reference64(raw.data(), len), lines, stray = b64;
+            for (size_t i = 0; i < b64.size(); i += 72)
+                lines += '\n' + b64.substr(i, 72);
+            lines += '\n';
+            for (size_t pos = 5; pos + 4 < stray.size(); pos += 61)
+                stray[pos] = '*';
+
+            for (const std::string &input : { b64, lines, stray })
+            {
+                std::vector<char> dec(3 * input.size() / 4 + 3), ref(3 * input.size() / 4 + 3);
+
+                ASSERT_EQ(0, base64_use_kernels("none"));
+                int m = from64tobits_fast(ref.data(), input.c_str(), b64.size());
+                ASSERT_EQ(0, base64_use_kernels(kernel));
+                int n = from64tobits_fast(dec.data(), input.c_str(), b64.size());
+
+                ASSERT_EQ(len, m);
+                ASSERT_EQ(m, n) << kernel << " len " << len;
+                ASSERT_EQ(0, memcmp(ref.data(), dec.data(), n)) << kernel << " len " << len;
+            }
+        }
+    }
+
+    EXPECT_EQ(-1, base64_use_kernels("mmx"));
+    ASSERT_EQ(0, base64_use_kernels("auto"));
+}
+
+TEST(CORE_BASE64, Test_throughput)
+{
+    const int len                  = 16 * 1024 * 1024;
+    std::vector<unsigned char> raw = randomBytes(len, 5);
+    std::vector<unsigned char> b64(4 * len / 3 + 4);
+    std::vector<char> back(len + 3);
+
+    auto t0 = std::chrono::steady_clock::now();
+    int n   = to64frombits(b64.data(), raw.data(), len);
+    auto t1 = std::chrono::steady_clock::now();
+    int m   = from64tobits_fast(back.data(), (const char *)b64.data(), n);
+    auto t2 = std::chrono::steady_clock::now();
+
+    ASSERT_EQ(len, m);
+    ASSERT_EQ(0, memcmp(raw.data(), back.data(), len));
+
+    double enc = std::chrono::duration<double>(t1 - t0).count();
+    double dec = std::chrono::duration<double>(t2 - t1).count();
+    printf("base64 encode %.0f MB/s, decode %.0f MB/s\n", len / 1e6 / enc, len / 1e6 / dec);
+}
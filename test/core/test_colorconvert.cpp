@@ -0,0 +1,159 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "stream/ccvt.h"
+#include "stream/colorconvert.h"
+
+using namespace INDI;
+
+template <typename T>
+static std::vector<T> randomFrame(size_t len, unsigned seed, unsigned range)
+{
+    std::vector<T> v(len);
+    srand(seed);
+    for (auto &x : v)
+        x = static_cast<T>(rand() % range);
+    return v;
+}
+
+// Largest channel difference, ignoring a border of two pixels where every implementation guesses differently
+template <typename T>
+static int interiorDifference(const std::vector<T> &a, const std::vector<T> &b, size_t width, size_t height)
+{
+    int diff = 0;
+    for (size_t y = 2; y + 2 < height; y++)
+        for (size_t i = 3 * (y * width + 2); i < 3 * (y * width + width - 2); i++)
+            diff = std::max(diff, abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    return diff;
+}
+
+TEST(CORE_COLORCONVERT, Test_flat_field)
+{
+    // A grey card under a red, green and blue filter of 10, 20 and 30 must come out flat at every pixel, edges included
+    const size_t width = 37, height = 23;
+    const uint8_t level[4][4] =
+    {
+        { 10, 20, 20, 30 }, { 20, 10, 30, 20 }, { 20, 30, 10, 20 }, { 30, 20, 20, 10 }
+    };
+
+    for (int pattern = BAYER_RGGB; pattern <= BAYER_BGGR; pattern++)
+        for (int method = DEMOSAIC_BILINEAR; method <= DEMOSAIC_NEAREST; method++)
+        {
+            std::vector<uint8_t> raw(width * height), rgb(3 * width * height);
+            for (size_t y = 0; y < height; y++)
+                for (size_t x = 0; x < width; x++)
+                    raw[y * width + x] = level[pattern][(y & 1) * 2 + (x & 1)];
+
+            demosaic8(raw.data(), rgb.data(), width, height, static_cast<BayerPattern>(pattern),
+                      static_cast<DemosaicMethod>(method));
+
+            for (size_t i = 0; i < width * height; i++)
+            {
+                ASSERT_EQ(10, rgb[3 * i]) << "pattern " << pattern << " pixel " << i;
+                ASSERT_EQ(20, rgb[3 * i + 1]) << "pattern " << pattern << " pixel " << i;
+                ASSERT_EQ(30, rgb[3 * i + 2]) << "pattern " << pattern << " pixel " << i;
+            }
+        }
+}
+
+TEST(CORE_COLORCONVERT, Test_matches_ccvt)
+{
+    // The ccvt functions need an even width. 202 still leaves a scalar tail after the vector loops.
+    const size_t width = 202, height = 61;
+    std::vector<uint8_t> raw = randomFrame<uint8_t>(width * height, 1, 256);
+    std::vector<uint16_t> raw16 = randomFrame<uint16_t>(width * height, 2, 65536);
+    std::vector<uint8_t> ours(3 * width * height), theirs(3 * width * height);
+    std::vector<uint16_t> ours16(3 * width * height), theirs16(3 * width * height);
+
+    demosaic8(raw.data(), ours.data(), width, height, BAYER_BGGR);
+    bayer2rgb24(theirs.data(), raw.data(), width, height);
+    EXPECT_LE(interiorDifference(ours, theirs, width, height), 1);
+
+    demosaic8(raw.data(), ours.data(), width, height, BAYER_RGGB);
+    bayer_rggb_2rgb24(theirs.data(), raw.data(), width, height);
+    EXPECT_LE(interiorDifference(ours, theirs, width, height), 1);
+
+    demosaic8(raw.data(), ours.data(), width, height, BAYER_GRBG);
+    bayer_grbg_to_rgb24(theirs.data(), raw.data(), width, height);
+    EXPECT_LE(interiorDifference(ours, theirs, width, height), 1);
+
+    demosaic16(raw16.data(), ours16.data(), width, height, BAYER_BGGR);
+    bayer16_2_rgb24(theirs16.data(), raw16.data(), width, height);
+    EXPECT_LE(interiorDifference(ours16, theirs16, width, height), 1);
+}
+
+TEST(CORE_COLORCONVERT, Test_yuv)
+{
+    const size_t width = 202, height = 62;
+    std::vector<uint8_t> rgb = randomFrame<uint8_t>(3 * width * height, 3, 256);
+    std::vector<uint8_t> ours(width * height * 3 / 2), theirs(width * height * 3 / 2);
+    uint8_t *y = ours.data(), *u = y + width * height, *v = u + width * height / 4;
+    uint8_t *ty = theirs.data(), *tu = ty + width * height, *tv = tu + width * height / 4;
+
+    ASSERT_FALSE(rgb24ToYUV420p(rgb.data(), width - 1, height, y, u, v));
+
+    // The fixed point coefficients are within a step of the float tables of RGB2YUV
+    ASSERT_TRUE(rgb24ToYUV420p(rgb.data(), width, height, y, u, v, true, true));
+    RGB2YUV(width, height, rgb.data(), ty, tu, tv, 0);
+    int diff = 0;
+    for (size_t i = 0; i < ours.size(); i++)
+        diff = std::max(diff, abs(ours[i] - theirs[i]));
+    EXPECT_LE(diff, 2);
+
+    ASSERT_TRUE(rgb24ToYUV420p(rgb.data(), width, height, y, u, v, false, true));
+    BGR2YUV(width, height, rgb.data(), ty, tu, tv, 0);
+    diff = 0;
+    for (size_t i = 0; i < ours.size(); i++)
+        diff = std::max(diff, abs(ours[i] - theirs[i]));
+    EXPECT_LE(diff, 2);
+}
+
+TEST(CORE_COLORCONVERT, Test_throughput)
+{
+    const size_t width = 1920, height = 1080, runs = 10;
+    std::vector<uint8_t> raw = randomFrame<uint8_t>(width * height, 4, 256);
+    std::vector<uint16_t> raw16 = randomFrame<uint16_t>(width * height, 5, 65536);
+    std::vector<uint8_t> rgb(3 * width * height), yuv(width * height * 3 / 2);
+    std::vector<uint16_t> rgb16(3 * width * height);
+    uint8_t *y = yuv.data(), *u = y + width * height, *v = u + width * height / 4;
+
+    auto measure = [&](const char *name, std::function<void()> job)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < runs; i++)
+            job();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / runs;
+        printf("%-24s %7.2f ms %7.0f Mpx/s\n", name, seconds * 1e3, width * height / 1e6 / seconds);
+    };
+
+    measure("bayer2rgb24", [&] { bayer2rgb24(rgb.data(), raw.data(), width, height); });
+    measure("demosaic8 bilinear", [&] { demosaic8(raw.data(), rgb.data(), width, height, BAYER_BGGR); });
+    measure("demosaic8 nearest", [&] { demosaic8(raw.data(), rgb.data(), width, height, BAYER_BGGR, DEMOSAIC_NEAREST); });
+    measure("bayer16_2_rgb24", [&] { bayer16_2_rgb24(rgb16.data(), raw16.data(), width, height); });
+    measure("demosaic16 bilinear", [&] { demosaic16(raw16.data(), rgb16.data(), width, height, BAYER_BGGR); });
+    measure("RGB2YUV", [&] { RGB2YUV(width, height, rgb.data(), y, u, v, 0); });
+    measure("rgb24ToYUV420p", [&] { rgb24ToYUV420p(rgb.data(), width, height, y, u, v, true, true); });
+}
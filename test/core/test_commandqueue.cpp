@@ -0,0 +1,225 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "indicom.h"
+#include "connectionplugins/commandqueue.h"
+
+using Connection::CommandQueue;
+
+// A mount on the master side of a pty: answers each "name#" command with "name-ok#" after a delay, except "mute#"
+class FakeMount
+{
+    public:
+        explicit FakeMount(int delayMs) : delayMs(delayMs)
+        {
+            master = posix_openpt(O_RDWR | O_NOCTTY);
+            if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+                return;
+
+            slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+            if (slave < 0)
+                return;
+
+            struct termios tty;
+            tcgetattr(slave, &tty);
+            cfmakeraw(&tty);
+            tcsetattr(slave, TCSANOW, &tty);
+            tcgetattr(master, &tty);
+            cfmakeraw(&tty);
+            tcsetattr(master, TCSANOW, &tty);
+
+            thread = std::thread(&FakeMount::run, this);
+        }
+
+        ~FakeMount()
+        {
+            if (slave >= 0)
+                close(slave);
+            if (thread.joinable())
+                thread.join();
+            if (master >= 0)
+                close(master);
+        }
+
+        int master { -1 };
+        int slave { -1 };
+
+    private:
+        void run()
+        {
+            std::string command;
+            char c;
+            // Ends when the slave side is closed
+            while (read(master, &c, 1) == 1)
+            {
+                command += c;
+                if (c != '#')
+                    continue;
+
+                if (command != "mute#")
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+                    std::string reply = command.substr(0, command.size() - 1) + "-ok#";
+                    if (write(master, reply.data(), reply.size()) < 0)
+                        return;
+                }
+                command.clear();
+            }
+        }
+
+        int delayMs;
+        std::thread thread;
+};
+
+static CommandQueue::Command makeCommand(const std::string &name, CommandQueue::Priority priority,
+        std::vector<std::string> &replies, int &done)
+{
+    CommandQueue::Command command;
+    command.request  = name + "#";
+    command.priority = priority;
+    command.callback = [&replies, &done](int rc, const std::string & reply)
+    {
+        replies.push_back(rc == TTY_OK ? reply : "error");
+        done++;
+    };
+    return command;
+}
+
+TEST(CORE_COMMANDQUEUE, Test_replies_on_event_loop)
+{
+    FakeMount mount(1);
+    ASSERT_GE(mount.slave, 0);
+
+    CommandQueue queue;
+    ASSERT_TRUE(queue.start(mount.slave));
+    ASSERT_FALSE(queue.start(mount.slave));
+
+    std::vector<std::string> replies;
+    int done = 0, finished = 0;
+    std::thread::id caller;
+    for (const char *name : { ":GR", ":GD", ":GS" })
+        queue.enqueue(makeCommand(name, CommandQueue::PRIORITY_POLL, replies, done));
+
+    CommandQueue::Command last = makeCommand(":GA", CommandQueue::PRIORITY_POLL, replies, done);
+    auto callback = last.callback;
+    last.callback = [&](int rc, const std::string & reply)
+    {
+        caller = std::this_thread::get_id();
+        callback(rc, reply);
+        finished = 1;
+    };
+    queue.enqueue(last);
+
+    ASSERT_EQ(0, deferLoop(5000, &finished));
+    EXPECT_EQ(std::this_thread::get_id(), caller);
+    EXPECT_EQ((std::vector<std::string> { ":GR-ok#", ":GD-ok#", ":GS-ok#", ":GA-ok#" }), replies);
+
+    queue.stop();
+    EXPECT_FALSE(queue.isRunning());
+    // Dropped once stopped
+    queue.enqueue(makeCommand(":GR", CommandQueue::PRIORITY_POLL, replies, done));
+    EXPECT_EQ(0u, queue.pending());
+}
+
+// Run the event loop until \e count callbacks were called, at most 5 seconds
+static bool waitFor(const int &done, int count)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    while (done < count)
+    {
+        if (std::chrono::steady_clock::now() - t0 > std::chrono::seconds(5))
+            return false;
+        int flag = 0;
+        deferLoop(10, &flag);
+    }
+    return true;
+}
+
+TEST(CORE_COMMANDQUEUE, Test_guide_first)
+{
+    FakeMount mount(20);
+    ASSERT_GE(mount.slave, 0);
+
+    CommandQueue queue;
+    ASSERT_TRUE(queue.start(mount.slave));
+
+    std::vector<std::string> replies;
+    int done = 0;
+
+    // Let the first poll reach the wire, the others then wait behind it
+    queue.enqueue(makeCommand("poll0", CommandQueue::PRIORITY_POLL, replies, done));
+    while (queue.pending() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for (int i = 1; i < 5; i++)
+        queue.enqueue(makeCommand("poll" + std::to_string(i), CommandQueue::PRIORITY_POLL, replies, done));
+    queue.enqueue(makeCommand("slew", CommandQueue::PRIORITY_MOTION, replies, done));
+    queue.enqueue(makeCommand("guide", CommandQueue::PRIORITY_GUIDE, replies, done));
+
+    ASSERT_TRUE(waitFor(done, 7));
+    EXPECT_EQ((std::vector<std::string> { "poll0-ok#", "guide-ok#", "slew-ok#", "poll1-ok#", "poll2-ok#", "poll3-ok#", "poll4-ok#" }),
+              replies);
+
+    // Stale polls can be dropped, e.g. after an abort
+    for (int i = 0; i < 3; i++)
+        queue.enqueue(makeCommand("poll", CommandQueue::PRIORITY_POLL, replies, done));
+    queue.clear(CommandQueue::PRIORITY_POLL);
+    EXPECT_EQ(0u, queue.pending());
+    queue.stop();
+}
+
+TEST(CORE_COMMANDQUEUE, Test_timeout_does_not_block)
+{
+    FakeMount mount(1);
+    ASSERT_GE(mount.slave, 0);
+
+    CommandQueue queue;
+    ASSERT_TRUE(queue.start(mount.slave));
+
+    std::vector<std::string> replies;
+    int done = 0;
+    CommandQueue::Command mute = makeCommand("mute", CommandQueue::PRIORITY_POLL, replies, done);
+    mute.timeoutMs = 300;
+    queue.enqueue(mute);
+    queue.enqueue(makeCommand(":GR", CommandQueue::PRIORITY_POLL, replies, done));
+
+    // The event loop keeps running timers while the mount stays silent
+    int ticks = 0;
+    TCF *onTick = [](void *p)
+    {
+        (*static_cast<int *>(p))++;
+    };
+    for (int i = 1; i <= 5; i++)
+        addTimer(i * 20, onTick, &ticks);
+
+    ASSERT_TRUE(waitFor(done, 2));
+    EXPECT_EQ(5, ticks);
+    EXPECT_EQ((std::vector<std::string> { "error", ":GR-ok#" }), replies);
+    queue.stop();
+}
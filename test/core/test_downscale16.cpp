@@ -0,0 +1,181 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "stream/downscale16.h"
+
+using namespace INDI;
+
+// Every vector kernel set that may be compiled in, the ones this cpu can not run are skipped
+static const char *const vectorKernels[] = { "avx2", "sse4.1", "neon" };
+
+// Widths around every vector size so each kernel leaves a tail of every length, and one frame split in bands
+static const size_t widths[] = { 0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1001, (1 << 21) + 77 };
+
+static std::vector<uint16_t> randomFrame(size_t len, unsigned seed)
+{
+    std::vector<uint16_t> v(len);
+    srand(seed);
+    for (auto &x : v)
+        x = static_cast<uint16_t>(rand());
+    return v;
+}
+
+// Random pixels, or only the extremes when saturated
+static std::vector<std::vector<uint16_t>> testFrames(size_t len)
+{
+    std::vector<std::vector<uint16_t>> frames;
+    frames.push_back(randomFrame(len, 1));
+    frames.push_back(std::vector<uint16_t>(len, 0xFFFF));
+    frames.push_back(std::vector<uint16_t>(len, 0));
+
+    std::vector<uint16_t> extremes = randomFrame(len, 2);
+    for (auto &x : extremes)
+        x = (x & 1) ? 0xFFFF : 0;
+    frames.push_back(extremes);
+
+    // The extremes last, where only the tail loop sees them
+    std::vector<uint16_t> tail(len, 1000);
+    if (len > 0)
+        tail[len - 1] = 0xFFFF;
+    if (len > 1)
+        tail[len - 2] = 0;
+    frames.push_back(tail);
+
+    return frames;
+}
+
+TEST(CORE_DOWNSCALE16, Test_minMax16_kernels)
+{
+    for (const char *name : vectorKernels)
+    {
+        if (!useDownscaleKernels(name))
+            continue;
+
+        for (size_t len : widths)
+        {
+            for (const auto &frame : testFrames(len))
+            {
+                uint16_t lo, hi, refLo, refHi;
+
+                ASSERT_TRUE(useDownscaleKernels("none"));
+                minMax16(frame.data(), len, &refLo, &refHi);
+
+                ASSERT_TRUE(useDownscaleKernels(name));
+                minMax16(frame.data(), len, &lo, &hi);
+
+                EXPECT_EQ(refLo, lo) << name << " " << len;
+                EXPECT_EQ(refHi, hi) << name << " " << len;
+                if (len > 0)
+                {
+                    EXPECT_EQ(*std::min_element(frame.begin(), frame.end()), lo) << name << " " << len;
+                    EXPECT_EQ(*std::max_element(frame.begin(), frame.end()), hi) << name << " " << len;
+                }
+            }
+        }
+    }
+
+    useDownscaleKernels("auto");
+}
+
+TEST(CORE_DOWNSCALE16, Test_stretch16to8_kernels)
+{
+    // Full range, a narrow range that saturates most pixels, and a flat one
+    const uint16_t ranges[][2] = { { 0, 0xFFFF }, { 1000, 1255 }, { 0xFFFE, 0xFFFF }, { 300, 300 }, { 0xFFFF, 0xFFFF } };
+
+    for (const char *name : vectorKernels)
+    {
+        if (!useDownscaleKernels(name))
+            continue;
+
+        for (size_t len : widths)
+        {
+            for (const auto &frame : testFrames(len))
+            {
+                for (const auto &range : ranges)
+                {
+                    std::vector<uint8_t> out(len + 1, 0xAA), ref(len + 1, 0xAA);
+
+                    ASSERT_TRUE(useDownscaleKernels("none"));
+                    stretch16to8(frame.data(), ref.data(), len, range[0], range[1]);
+
+                    ASSERT_TRUE(useDownscaleKernels(name));
+                    stretch16to8(frame.data(), out.data(), len, range[0], range[1]);
+
+                    EXPECT_EQ(ref, out) << name << " " << len << " [" << range[0] << ", " << range[1] << "]";
+                    // Nothing written past the frame
+                    EXPECT_EQ(0xAA, out[len]);
+                }
+            }
+        }
+    }
+
+    useDownscaleKernels("auto");
+}
+
+TEST(CORE_DOWNSCALE16, Test_stretch16to8_scalar)
+{
+    const uint16_t frame[] = { 0, 999, 1000, 1001, 1128, 1254, 1255, 1256, 0xFFFF };
+    const uint8_t expected[] = { 0, 0, 0, 1, 128, 254, 255, 255, 255 };
+    uint8_t out[9];
+
+    ASSERT_TRUE(useDownscaleKernels("none"));
+    stretch16to8(frame, out, 9, 1000, 1255);
+    EXPECT_EQ(std::vector<uint8_t>(expected, expected + 9), std::vector<uint8_t>(out, out + 9));
+
+    // A flat frame maps to black
+    stretch16to8(frame, out, 9, 1000, 1000);
+    EXPECT_EQ(std::vector<uint8_t>(9, 0), std::vector<uint8_t>(out, out + 9));
+
+    useDownscaleKernels("auto");
+}
+
+TEST(CORE_DOWNSCALE16, Test_concurrent_frames)
+{
+    // The stream and record stages convert at the same time, one of them without the helper threads
+    const size_t len = (1 << 22) + 5;
+    std::vector<uint16_t> frame = randomFrame(len, 3);
+    std::vector<uint8_t> ref(len);
+    stretch16to8(frame.data(), ref.data(), len, 100, 60000);
+
+    std::vector<std::vector<uint8_t>> outs(4, std::vector<uint8_t>(len));
+    std::vector<std::thread> threads;
+    for (auto &out : outs)
+        threads.emplace_back([&frame, &out, len]
+        {
+            for (int i = 0; i < 5; i++)
+                stretch16to8(frame.data(), out.data(), len, 100, 60000);
+        });
+    for (auto &thread : threads)
+        thread.join();
+
+    for (const auto &out : outs)
+        EXPECT_EQ(ref, out);
+}
+
+TEST(CORE_DOWNSCALE16, Test_unknown_kernels)
+{
+    EXPECT_FALSE(useDownscaleKernels("mmx"));
+    EXPECT_TRUE(useDownscaleKernels("none"));
+    EXPECT_TRUE(useDownscaleKernels("auto"));
+}
@@ -0,0 +1,284 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+
+static double msNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// One timer: when it should and did fire, and in which order
+struct Fired
+{
+    int tag;
+    double due;
+    double at;
+    std::vector<Fired> *log;
+};
+
+static void recordFired(void *p)
+{
+    Fired *f = static_cast<Fired *>(p);
+    f->at    = msNow();
+    f->log->push_back(*f);
+}
+
+static Fired *addRecordedTimer(std::vector<Fired> &log, int tag, int ms, int *id = nullptr)
+{
+    Fired *f = new Fired { tag, msNow() + ms, 0, &log };
+    int t    = addTimer(ms, recordFired, f);
+    if (id)
+        *id = t;
+    return f;
+}
+
+static void setFlag(void *p)
+{
+    *static_cast<int *>(p) = 1;
+}
+
+// Run the loop for ms
+static void runFor(int ms)
+{
+    int never = 0;
+    deferLoop(ms, &never);
+}
+
+TEST(CORE_EVENTLOOP, Test_timer_order)
+{
+    std::vector<Fired> log;
+    std::vector<Fired *> timers;
+
+    // Ties run in the order they were added
+    const int delays[] = { 30, 10, 20, 10, 0, 20, 0 };
+    for (size_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++)
+        timers.push_back(addRecordedTimer(log, i, delays[i]));
+
+    runFor(100);
+
+    std::vector<int> order;
+    for (const auto &f : log)
+        order.push_back(f.tag);
+    EXPECT_EQ(std::vector<int>({ 4, 6, 1, 3, 2, 5, 0 }), order);
+
+    for (auto f : timers)
+        delete f;
+}
+
+TEST(CORE_EVENTLOOP, Test_timer_heap)
+{
+    std::vector<Fired> log;
+    std::vector<Fired *> timers;
+    std::vector<int> ids;
+    std::set<int> removed;
+
+    // Enough timers to grow the heap and the id hash several times
+    srand(1);
+    for (int i = 0; i < 1000; i++)
+    {
+        int id;
+        timers.push_back(addRecordedTimer(log, i, rand() % 50, &id));
+        ids.push_back(id);
+    }
+
+    // Every id is unique
+    EXPECT_EQ(ids.size(), std::set<int>(ids.begin(), ids.end()).size());
+
+    // Remove every third, from the middle of the heap as well as its top
+    for (int i = 0; i < 1000; i += 3)
+    {
+        rmTimer(ids[i]);
+        removed.insert(i);
+    }
+
+    runFor(100);
+
+    std::set<int> fired;
+    double last = 0;
+    for (const auto &f : log)
+    {
+        EXPECT_TRUE(fired.insert(f.tag).second) << "timer " << f.tag << " fired twice";
+        EXPECT_EQ(0u, removed.count(f.tag)) << "removed timer " << f.tag << " fired";
+        // Never early, and in trigger order on the monotonic clock
+        EXPECT_GE(f.at, f.due - 1) << f.tag;
+        EXPECT_GE(f.at, last);
+        last = f.at;
+    }
+    EXPECT_EQ(1000u - removed.size(), fired.size());
+
+    // The ids of fired and removed timers are dead, removing them again touches nothing
+    int flag = 0;
+    int live = addTimer(20, setFlag, &flag);
+    for (int id : ids)
+        rmTimer(id);
+    rmTimer(0);
+    rmTimer(-1);
+    EXPECT_EQ(0, deferLoop(1000, &flag));
+    rmTimer(live);
+
+    for (auto f : timers)
+        delete f;
+}
+
+TEST(CORE_EVENTLOOP, Test_timer_reschedule)
+{
+    std::vector<Fired> log;
+    Fired a { 1, 0, 0, &log }, b { 2, 0, 0, &log };
+
+    // Move a from before b to after it
+    int ida = addTimer(10, recordFired, &a);
+    addTimer(30, recordFired, &b);
+    rmTimer(ida);
+    a.due = msNow() + 50;
+    int ida2 = addTimer(50, recordFired, &a);
+    EXPECT_NE(ida, ida2);
+
+    runFor(150);
+
+    ASSERT_EQ(2u, log.size());
+    EXPECT_EQ(2, log[0].tag);
+    EXPECT_EQ(1, log[1].tag);
+    EXPECT_GE(log[1].at, a.due - 1);
+}
+
+// A timer that adds itself again from its own callback, until count runs out
+struct Repeat
+{
+    int count;
+    int *done;
+};
+
+static void repeatTimer(void *p)
+{
+    Repeat *r = static_cast<Repeat *>(p);
+    if (--r->count > 0)
+        addTimer(0, repeatTimer, r);
+    else
+        *r->done = 1;
+}
+
+static void countWork(void *p)
+{
+    (*static_cast<int *>(p))++;
+}
+
+TEST(CORE_EVENTLOOP, Test_timer_readd_from_callback)
+{
+    // A zero delay timer adding itself must not hold up the work procs
+    int done = 0, work = 0;
+    Repeat r { 100, &done };
+    addTimer(0, repeatTimer, &r);
+    int wid = addWorkProc(countWork, &work);
+
+    EXPECT_EQ(0, deferLoop(1000, &done));
+    rmWorkProc(wid);
+    EXPECT_GT(work, 0);
+}
+
+static void readByte(int fd, void *p)
+{
+    char c;
+    if (read(fd, &c, 1) == 1)
+        (*static_cast<int *>(p))++;
+}
+
+TEST(CORE_EVENTLOOP, Test_callback_id_reuse)
+{
+    int a[2], b[2];
+    ASSERT_EQ(0, pipe(a));
+    ASSERT_EQ(0, pipe(b));
+
+    int na = 0, nb = 0;
+    int ida = addCallback(a[0], readByte, &na);
+    ASSERT_EQ(1, write(a[1], "x", 1));
+    rmCallback(ida);
+
+    // The freed id goes to the next callback, the pending byte on a must not reach it
+    int idb = addCallback(b[0], readByte, &nb);
+    EXPECT_EQ(ida, idb);
+    ASSERT_EQ(1, write(b[1], "y", 1));
+
+    runFor(100);
+
+    EXPECT_EQ(0, na);
+    EXPECT_EQ(1, nb);
+
+    rmCallback(idb);
+    for (int fd : { a[0], a[1], b[0], b[1] })
+        close(fd);
+}
+
+TEST(CORE_EVENTLOOP, Test_callback_removed_after_close)
+{
+    int p[2];
+    ASSERT_EQ(0, pipe(p));
+
+    // The pipe stays readable through a dup after its callback fd is closed
+    int n   = 0;
+    int dup = ::dup(p[0]);
+    int id  = addCallback(p[0], readByte, &n);
+    ASSERT_EQ(1, write(p[1], "x", 1));
+    close(p[0]);
+    rmCallback(id);
+
+    // Work procs only run when no fd is ready, they would starve if the loop kept waking for the pipe
+    int flag = 0;
+    int wid  = addWorkProc(setFlag, &flag);
+    EXPECT_EQ(0, deferLoop(1000, &flag));
+    rmWorkProc(wid);
+    EXPECT_EQ(0, n);
+
+    close(dup);
+    close(p[1]);
+}
+
+TEST(CORE_EVENTLOOP, Test_callback_removed_after_fd_reuse)
+{
+    int a[2], b[2];
+    ASSERT_EQ(0, pipe(a));
+
+    // Close the fd of the first callback and get the same number for a second one
+    int na = 0, nb = 0;
+    int ida = addCallback(a[0], readByte, &na);
+    close(a[0]);
+    ASSERT_EQ(0, pipe(b));
+    ASSERT_EQ(a[0], b[0]);
+    int idb = addCallback(b[0], readByte, &nb);
+
+    // Removing the first must leave the second watched
+    rmCallback(ida);
+    ASSERT_EQ(1, write(b[1], "y", 1));
+    runFor(100);
+    EXPECT_EQ(0, na);
+    EXPECT_EQ(1, nb);
+
+    rmCallback(idb);
+    for (int fd : { a[1], b[0], b[1] })
+        close(fd);
+}
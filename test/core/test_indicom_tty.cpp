@@ -0,0 +1,217 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "indicom.h"
+
+// A pty pair standing in for a mount: the test writes replies on the master and the TTY functions read the slave
+class PtyLoopback
+{
+    public:
+        PtyLoopback()
+        {
+            master = posix_openpt(O_RDWR | O_NOCTTY);
+            if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+                return;
+
+            slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+            if (slave < 0)
+                return;
+
+            struct termios tty;
+            tcgetattr(slave, &tty);
+            cfmakeraw(&tty);
+            tcsetattr(slave, TCSANOW, &tty);
+        }
+
+        ~PtyLoopback()
+        {
+            if (slave >= 0)
+                close(slave);
+            if (master >= 0)
+                close(master);
+        }
+
+        void reply(const std::string &text)
+        {
+            ASSERT_EQ(static_cast<ssize_t>(text.size()), write(master, text.data(), text.size()));
+            // Let the line discipline move it over to the slave
+            tcdrain(master);
+        }
+
+        int master { -1 };
+        int slave { -1 };
+};
+
+// read syscalls made by this process so far, -1 if the kernel does not account them
+static long readSyscalls()
+{
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (!fp)
+        return -1;
+
+    long syscr = -1;
+    char line[128];
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "syscr: %ld", &syscr) == 1)
+            break;
+    fclose(fp);
+    return syscr;
+}
+
+// What tty_nread_section used to do, one select and one read per byte
+static int readSectionBytewise(int fd, char *buf, int nsize, char stop_char, int *nbytes_read)
+{
+    *nbytes_read = 0;
+    for (;;)
+    {
+        if (tty_timeout(fd, 1))
+            return TTY_TIME_OUT;
+        if (read(fd, buf + *nbytes_read, 1) != 1)
+            return TTY_READ_ERROR;
+        if (buf[(*nbytes_read)++] == stop_char)
+            return TTY_OK;
+        if (*nbytes_read >= nsize)
+            return TTY_OVERFLOW;
+    }
+}
+
+TEST(CORE_TTY, Test_sections)
+{
+    PtyLoopback pty;
+    ASSERT_GE(pty.slave, 0);
+
+    char buf[64];
+    int nbytes_read = 0;
+
+    // Two replies and the start of a third arrive together, the rest of the third later
+    pty.reply("abc#def#gh");
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("abc#", std::string(buf, nbytes_read));
+    ASSERT_EQ(TTY_OK, tty_read_section(pty.slave, buf, '#', 1, &nbytes_read));
+    EXPECT_EQ("def#", std::string(buf, nbytes_read));
+    pty.reply("i#");
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("ghi#", std::string(buf, nbytes_read));
+
+    // Fixed length reads take the leftovers first
+    pty.reply("12#345");
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("12#", std::string(buf, nbytes_read));
+    ASSERT_EQ(TTY_OK, tty_read(pty.slave, buf, 3, 1, &nbytes_read));
+    EXPECT_EQ("345", std::string(buf, nbytes_read));
+
+    // Overflow keeps the rest for the next call
+    pty.reply("abcdef#");
+    ASSERT_EQ(TTY_OVERFLOW, tty_nread_section(pty.slave, buf, 4, '#', 1, &nbytes_read));
+    EXPECT_EQ(4, nbytes_read);
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("ef#", std::string(buf, nbytes_read));
+
+    // A new command drops whatever is left of the previous reply
+    int nbytes_written = 0;
+    pty.reply("ok#stale");
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    ASSERT_EQ(TTY_OK, tty_write_string(pty.slave, ":GR#", &nbytes_written));
+    pty.reply("fresh#");
+    ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("fresh#", std::string(buf, nbytes_read));
+}
+
+TEST(CORE_TTY, Test_syscalls)
+{
+    PtyLoopback pty;
+    ASSERT_GE(pty.slave, 0);
+
+    // Three LX200 style replies, about 30 bytes, read once per poll
+    const std::string status = "+12*34:56#-01*23:45#12:34:56#";
+    const int polls = 1000;
+    char buf[64];
+    int nbytes_read = 0;
+
+    long r0 = readSyscalls();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < polls; i++)
+    {
+        pty.reply(status);
+        for (int j = 0; j < 3; j++)
+            ASSERT_EQ(TTY_OK, readSectionBytewise(pty.slave, buf, sizeof(buf), '#', &nbytes_read));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    long r1 = readSyscalls();
+    for (int i = 0; i < polls; i++)
+    {
+        pty.reply(status);
+        for (int j = 0; j < 3; j++)
+            ASSERT_EQ(TTY_OK, tty_nread_section(pty.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    long r2 = readSyscalls();
+
+    double bytewise = std::chrono::duration<double, std::micro>(t1 - t0).count() / polls;
+    double buffered = std::chrono::duration<double, std::micro>(t2 - t1).count() / polls;
+    printf("bytewise: %.1f us per reply, buffered: %.1f us per reply\n", bytewise, buffered);
+
+    if (r0 < 0)
+        return;
+
+    printf("bytewise: %.1f reads per reply, buffered: %.1f reads per reply\n", double(r1 - r0) / polls,
+           double(r2 - r1) / polls);
+    EXPECT_LE(r2 - r1, (r1 - r0) / 10);
+}
+
+TEST(CORE_TTY, Test_port_settings)
+{
+    PtyLoopback first, second;
+    ASSERT_GE(first.slave, 0);
+    ASSERT_GE(second.slave, 0);
+
+    char buf[64];
+    int nbytes_read = 0;
+
+    // Only the port asking for it loses the line feed left over from the previous reply
+    tty_set_port_clr_trailing_lf(first.slave, 1);
+    first.reply("\nabc#");
+    second.reply("\nabc#");
+    ASSERT_EQ(TTY_OK, tty_nread_section(first.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("abc#", std::string(buf, nbytes_read));
+    ASSERT_EQ(TTY_OK, tty_nread_section(second.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("\nabc#", std::string(buf, nbytes_read));
+
+    // A millisecond timeout does not wait the whole second asked for by the read
+    tty_set_port_timeout_ms(first.slave, 50);
+    auto t0 = std::chrono::steady_clock::now();
+    EXPECT_EQ(TTY_TIME_OUT, tty_nread_section(first.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::milliseconds(500));
+
+    // Resetting the port brings back the process defaults
+    tty_reset_port(first.slave);
+    first.reply("\nabc#");
+    ASSERT_EQ(TTY_OK, tty_nread_section(first.slave, buf, sizeof(buf), '#', 1, &nbytes_read));
+    EXPECT_EQ("\nabc#", std::string(buf, nbytes_read));
+}
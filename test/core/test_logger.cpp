@@ -0,0 +1,207 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "indilogger.h"
+
+using INDI::Logger;
+
+namespace INDI
+{
+class LoggerTest
+{
+    public:
+        static std::unique_lock<std::mutex> holdFileWriter()
+        {
+            return Logger::getInstance().holdFileWriter();
+        }
+
+        static uint64_t fileWriterRounds()
+        {
+            return Logger::getInstance().fileWriterRounds();
+        }
+};
+}
+
+static const char *DEVICE = "Logger Test";
+
+// Log into a scratch home directory rather than the one of the user running the tests
+static void configureFileLog()
+{
+    static bool configured = false;
+    if (configured)
+        return;
+
+    char home[] = "/tmp/test_logger_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(home));
+    setenv("HOME", home, 1);
+    Logger::getInstance().configure("test_logger", Logger::file_on | Logger::screen_off,
+                                    Logger::DBG_ERROR | Logger::DBG_WARNING | Logger::DBG_SESSION, 0);
+    configured = true;
+}
+
+static std::vector<std::string> logLines()
+{
+    Logger::getInstance().flush();
+    std::vector<std::string> lines;
+    std::ifstream in(Logger::getLogFile());
+    for (std::string line; std::getline(in, line);)
+        lines.push_back(line);
+    return lines;
+}
+
+TEST(CORE_LOGGER, Test_disabled_level_is_cheap)
+{
+    configureFileLog();
+
+    const int calls = 1000000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++)
+        DEBUGFDEVICE(DEVICE, Logger::DBG_DEBUG, "position %f %f step %d", 1.0 * i, 2.0 * i, i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / calls;
+
+    // Formatting the message alone, which a disabled level must skip
+    char msg[257];
+    t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++)
+        snprintf(msg, sizeof(msg), "position %f %f step %d", 1.0 * i, 2.0 * i, i);
+    double formatNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / calls;
+
+    printf("disabled DBG_DEBUG: %.1f ns per call, formatting: %.1f ns\n", ns, formatNs);
+    EXPECT_LT(ns, formatNs / 2);
+
+    for (const auto &line : logLines())
+        EXPECT_EQ(std::string::npos, line.find("position"));
+}
+
+TEST(CORE_LOGGER, Test_threads)
+{
+    configureFileLog();
+    size_t before    = logLines().size();
+    uint64_t dropped = Logger::getInstance().droppedMessages();
+
+    const int threads = 4, messages = 200;
+    std::vector<std::thread> writers;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+        writers.emplace_back([t]
+        {
+            for (int i = 0; i < messages; i++)
+            {
+                DEBUGFDEVICE(DEVICE, Logger::DBG_SESSION, "thread %d message %d", t, i);
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+    for (auto &writer : writers)
+        writer.join();
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    printf("%d messages from %d threads in %.0f us\n", threads * messages, threads, us);
+
+    std::vector<std::string> lines = logLines();
+    ASSERT_GE(lines.size(), before);
+
+    // Every message made it, in order within each thread
+    int next[threads] = { 0 };
+    for (size_t i = before; i < lines.size(); i++)
+    {
+        int t, n;
+        size_t at = lines[i].find("thread ");
+        ASSERT_NE(std::string::npos, at) << lines[i];
+        ASSERT_EQ(2, sscanf(lines[i].c_str() + at, "thread %d message %d", &t, &n));
+        ASSERT_EQ(next[t]++, n);
+        EXPECT_EQ(0u, lines[i].find("INFO\t"));
+        EXPECT_NE(std::string::npos, lines[i].find("[Logger Test] thread"));
+    }
+    for (int t = 0; t < threads; t++)
+        EXPECT_EQ(messages, next[t]);
+    EXPECT_EQ(dropped, Logger::getInstance().droppedMessages());
+}
+
+TEST(CORE_LOGGER, Test_overflow_is_counted)
+{
+    configureFileLog();
+    size_t before          = logLines().size();
+    uint64_t droppedBefore = Logger::getInstance().droppedMessages();
+
+    // Far more than the queue holds while the writer is stalled, as behind a slow disk
+    const int messages = 5000;
+    {
+        std::unique_lock<std::mutex> stalled = INDI::LoggerTest::holdFileWriter();
+        ASSERT_TRUE(stalled.owns_lock());
+        for (int i = 0; i < messages; i++)
+            DEBUGFDEVICE(DEVICE, Logger::DBG_SESSION, "burst %d", i);
+    }
+
+    std::vector<std::string> lines = logLines();
+    uint64_t dropped = Logger::getInstance().droppedMessages() - droppedBefore, noted = 0;
+    size_t written = 0;
+    for (size_t i = before; i < lines.size(); i++)
+    {
+        unsigned long long n;
+        size_t at = lines[i].find(": ");
+        if (lines[i].find("burst ") != std::string::npos)
+            written++;
+        else if (at != std::string::npos && sscanf(lines[i].c_str() + at, ": %llu messages dropped", &n) == 1)
+            noted += n;
+    }
+
+    printf("%zu written, %llu dropped\n", written, static_cast<unsigned long long>(dropped));
+    EXPECT_GT(dropped, 0u);
+    EXPECT_GT(written, 0u);
+    EXPECT_EQ(static_cast<uint64_t>(messages), written + dropped);
+    EXPECT_EQ(dropped, noted);
+}
+
+TEST(CORE_LOGGER, Test_writer_parked_while_file_off)
+{
+    configureFileLog();
+    const int levels = Logger::DBG_ERROR | Logger::DBG_WARNING | Logger::DBG_SESSION;
+
+    // The writer comes by every 100 ms while file logging is on
+    uint64_t rounds = INDI::LoggerTest::fileWriterRounds();
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    EXPECT_GE(INDI::LoggerTest::fileWriterRounds(), rounds + 2);
+
+    // and not at all while it is off, one round may have been under way
+    Logger::getInstance().configure("test_logger", Logger::file_off | Logger::screen_off, levels, 0);
+    rounds = INDI::LoggerTest::fileWriterRounds();
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    EXPECT_LE(INDI::LoggerTest::fileWriterRounds(), rounds + 1);
+
+    // Back on, the writer picks up new lines without a flush
+    Logger::getInstance().configure("test_logger", Logger::file_on | Logger::screen_off, levels, 0);
+    DEBUGDEVICE(DEVICE, Logger::DBG_SESSION, "back on");
+
+    bool found = false;
+    for (int i = 0; i < 20 && !found; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::ifstream in(Logger::getLogFile());
+        for (std::string line; std::getline(in, line);)
+            found = found || line.find("back on") != std::string::npos;
+    }
+    EXPECT_TRUE(found);
+}
@@ -0,0 +1,102 @@
+/*******************************************************************************
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <zlib.h>
+
+#include "zchunk.h"
+
+using namespace INDI;
+
+// Some compressible data, not all the same byte
+static std::vector<uint8_t> makeFrame(size_t size)
+{
+    std::vector<uint8_t> frame(size);
+    for (size_t i = 0; i < size; i++)
+        frame[i] = static_cast<uint8_t>((i / 7) ^ (i % 13));
+    return frame;
+}
+
+TEST(CORE_ZCHUNK, Test_round_trip)
+{
+    for (size_t size : { 0, 1, 4096, 4097, 100000 })
+    {
+        std::vector<uint8_t> frame = makeFrame(size), stream;
+        ASSERT_TRUE(ZChunk::compress(frame.data(), frame.size(), stream, Z_BEST_SPEED, 4096));
+        ASSERT_EQ(size, ZChunk::rawSize(stream.data(), stream.size()));
+
+        std::vector<uint8_t> out(size);
+        ASSERT_TRUE(ZChunk::uncompress(stream.data(), stream.size(), out.data(), out.size()));
+        EXPECT_EQ(frame, out);
+    }
+}
+
+TEST(CORE_ZCHUNK, Test_truncated)
+{
+    std::vector<uint8_t> frame = makeFrame(100000), stream;
+    ASSERT_TRUE(ZChunk::compress(frame.data(), frame.size(), stream, Z_BEST_SPEED, 4096));
+
+    // Cut anywhere: header, length table or chunks
+    std::vector<uint8_t> out(frame.size());
+    for (size_t size : { size_t(0), size_t(10), size_t(30), stream.size() / 2, stream.size() - 1 })
+    {
+        EXPECT_EQ(0u, ZChunk::rawSize(stream.data(), size)) << size;
+        EXPECT_FALSE(ZChunk::uncompress(stream.data(), size, out.data(), out.size())) << size;
+    }
+}
+
+TEST(CORE_ZCHUNK, Test_corrupt)
+{
+    std::vector<uint8_t> frame = makeFrame(100000), stream;
+    ASSERT_TRUE(ZChunk::compress(frame.data(), frame.size(), stream, Z_BEST_SPEED, 4096));
+    std::vector<uint8_t> out(frame.size());
+
+    // A huge raw size must not get through, whatever the chunk count
+    std::vector<uint8_t> bad = stream;
+    bad[15] = 0x7f;
+    EXPECT_EQ(0u, ZChunk::rawSize(bad.data(), bad.size()));
+
+    // 25 chunks of 1 GiB, far more than their deflated bytes can hold
+    bad = stream;
+    const uint8_t header[] = { 0, 0, 0, 0x40, 1, 0, 0, 0, 6, 0, 0, 0 };
+    std::copy(header, header + sizeof(header), bad.begin() + 4);
+    EXPECT_EQ(0u, ZChunk::rawSize(bad.data(), bad.size()));
+
+    // Bad magic
+    bad = stream;
+    bad[0] = 'X';
+    EXPECT_EQ(0u, ZChunk::rawSize(bad.data(), bad.size()));
+    EXPECT_FALSE(ZChunk::uncompress(bad.data(), bad.size(), out.data(), out.size()));
+
+    // Chunk length beyond the stream
+    bad = stream;
+    bad[23] = 0x7f;
+    EXPECT_EQ(0u, ZChunk::rawSize(bad.data(), bad.size()));
+    EXPECT_FALSE(ZChunk::uncompress(bad.data(), bad.size(), out.data(), out.size()));
+
+    // Damaged deflate data inflates to garbage or not at all
+    bad = stream;
+    bad[bad.size() - 100] ^= 0xff;
+    EXPECT_FALSE(ZChunk::uncompress(bad.data(), bad.size(), out.data(), out.size()));
+
+    // Output buffer smaller than the raw size
+    EXPECT_FALSE(ZChunk::uncompress(stream.data(), stream.size(), out.data(), out.size() - 1));
+}